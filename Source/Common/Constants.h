@@ -12,21 +12,30 @@
 #define WINDOW_RES     1024         // Camera resolution
 #define MAX_FRAMES     30           // Max. number of frames before convergence is achieved
 #define MAX_VOL_SAMP   32           // Max. number of volume samples per pixel
-#define MAX_N_VBOS     8            // Maximal number of vertex buffers
+#define MAX_N_VBOS     16           // Maximal number of vertex buffers
 #define MAX_DIST       1000.0f      // Camera distance to far plane
 #define PRI_SM_RES     1024         // Primary shadow map resolution in one dimension
 #define SEC_SM_RES     64           // Secondary shadow map resolution in one dimension
+#define N_LODS         3            // Number of levels of detail of meshes (for shadow maps)
 #define N_GI_BOUNCES   3            // Number of light bounces for GI
-#define MAX_MATERIALS  8            // Max. number of materials
+#define MAX_MATERIALS  65536        // Max. number of materials (16-bit indices)
 #define MAX_N_VPLS     150          // Max. number of VPLs
 #define MAX_N_FAILS    1000         // Max. number of failed attempts to trace a path
 #define PACKET_SZ      8            // Ray packet size for packet tracing
+#define TILE_SZ        16           // Screen tile size for VPL culling
+#define TRANSM_RES     64           // Resolution of the PPL transmittance volume (per axis)
+#define TRANSM_GRP_SZ  4            // Work group size (per axis) for PPL transmittance update
 #define RAY_OFFSET     1E-4f        // Offset in normal direction to avoid self-intersections
 #define TRI_EPS        1E-4f        // Small epsilon value used by triangle intersector
 #define SURVIVAL_P_RR  0.95f        // Survival probability for Russian Roulette
 #define EXPOSURE       12           // Default exposure time
 #define THRESHOLD_MS   500          // Used to ignore repeated key activations
-#define TITLE_LEN      70           // Number of characters in window title
+#define TITLE_LEN      80           // Number of characters in window title
+#define SCRIPT_LN_LEN  256          // Max. number of characters in a line of a render script
+#define SCRIPT_SEED    42           // Random seed used for (reproducible) scripted rendering
+#define PI_DENS_BUDGET 4            // Per-frame time budget (in ms) for density preintegration
+#define PROF_N_FRAMES  4            // Number of frames of GPU timer queries in flight
+#define PROF_N_SAMPLES 128          // Number of samples of rolling GPU timing statistics
 #define PRIM_PL_POS    {278.2f, \
                         600.0f, \
                         279.5f}     // Primary point light position
@@ -41,6 +50,8 @@
 #define MAX_FOG_HEIGHT 548.8f       // Height limit of fog (for VPLs)
 #define HG_G           0.25f        // Henyey-Greenstein func. scattering asymmetry parameter
 #define N_OCTAVES      6            // Number of octaves for simplex noise
+#define MAX_DENS_LVLS  16           // Max. number of MIP levels of fog density
+#define WT_N_SEGMENTS  16           // Segments (with local majorants) per fog size for tracking
 
 /* Texture unit allocation */
 #define TEX_U_DENS_V   0            // DensityField (for fog)
@@ -56,10 +67,23 @@
 #define TEX_U_VOL_COMP 10           // Subsampled volume contribution (radiance)
 #define TEX_U_RND_OFF  11           // Primary (camera) rays' random offset texture
 #define TEX_U_DEPTH    12           // Depth buffer texture
+#define TEX_U_VPL_CONT 13           // Unfiltered (interleaved) VPL contribution
+#define TEX_U_PPL_DENS 14           // Fog density integrated towards the primary light
+#define TEX_U_MOMENTS  15           // Luminance moments of the frames (for convergence tracking)
+#define TEX_U_HISTORY  16           // Mean indirect radiance and number of frames of the history
+#define TEX_U_DIRECT   17           // Direct lighting (radiance) of the last shaded frame
+#define TEX_U_DISPLAY  18           // Tone mapped image (copied to the display framebuffer)
 
 /* Image unit allocation */
 #define IMG_U_ACCUM    0            // Accumulation buffer texture for progressive rendering
 #define IMG_U_FOG_DIST 1            // Primary ray entry/exit distances for fog
+#define IMG_U_PI_DENS  2            // Preintegrated fog density values (GPU preintegration)
+#define IMG_U_VPL_CONT 3            // Unfiltered (interleaved) VPL contribution
+#define IMG_U_PPL_DENS 4            // Fog density integrated towards the primary light
+#define IMG_U_MOMENTS  5            // Luminance moments of the frames (for convergence tracking)
+#define IMG_U_HISTORY  6            // Mean indirect radiance and number of frames of the history
+#define IMG_U_DIRECT   7            // Direct lighting (radiance) of the last shaded frame
+#define IMG_U_DISPLAY  8            // Tone mapped image (copied to the display framebuffer)
 
 /* Uniform locations */
 #define UL_SM_MODELMAT 0            // Model matrix
@@ -67,13 +91,16 @@
 #define UL_SM_LAYER_ID 7            // layer_id
 #define UL_SM_WPOS_VPL 8            // VPL position in world coordinates
 #define UL_SM_INVMAXD2 9            // Inverse max. distance squared
-#define UL_GB_MAT_ID   0            // Material index
 
 /* Uniform binding indices */
-#define UB_MAT_ARR     0            // Material array
 #define UB_PPL_ARR     1            // Primary point light (PPL) array
 #define UB_VPL_ARR     2            // Virtual Point Light (VPL) array
 
+/* Shader storage binding indices */
+#define SB_MAT_ARR     0            // Material array
+#define SB_TILE_VPLS   1            // Per-tile VPL lists
+#define SB_TILE_CONV   2            // Per-tile convergence flags
+
 /* Misc. OpenGL definitions */
 #define GL_FALSE       0            // gl::FALSE_
 #define GL_TRUE        1            // gl::TRUE_
@@ -12,6 +12,8 @@ using uint = unsigned int;
     #define NORETURN __declspec( noreturn )
     // Assume that std::generate_canonical is broken
     #define BROKEN_STD_GENERATE_CANONICAL
+    // Assume thread_local is not supported (only POD types can be thread-local)
+    #define THREAD_LOCAL __declspec( thread )
     // Synthesizing default move CTORs and assignment OPs is not supported by MSVC 2013
     // MSVC will use copy CTORs and assignment OPs instead
     #define DEFAULT_MOVE(T)
@@ -19,6 +21,7 @@ using uint = unsigned int;
     #define NOEXCEPT  noexcept
     #define CONSTEXPR constexpr
     #define NORETURN  [[ noreturn ]]
+    #define THREAD_LOCAL thread_local
     #define DEFAULT_MOVE(T) T(T&&) NOEXCEPT = default;    \
                             T& operator=(T&&) NOEXCEPT = default
 #endif
@@ -53,3 +56,7 @@ using uint = unsigned int;
 
 // Use old-style vertex array binding; disable on Quadro
 #define OLD_STYLE_BINDING
+
+// Define to preintegrate fog density on the GPU using a compute shader
+// By default, the CPU path is used (with progressive re-preintegration and caching)
+// #define GPU_PI_DENSITY
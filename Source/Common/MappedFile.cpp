@@ -0,0 +1,104 @@
+#include "MappedFile.h"
+#include <cassert>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <Windows.h>
+
+CONSTEXPR size_t   HASH_BLOCK_SZ = 1 << 20;                 // Size of a hashed block (1 MiB)
+CONSTEXPR uint64_t FNV_OFFSET    = 14695981039346656037ull; // FNV-1a offset basis
+CONSTEXPR uint64_t FNV_PRIME     = 1099511628211ull;        // FNV-1a prime
+
+// Computes a variant of the FNV-1a hash which consumes 8 bytes per step
+static inline uint64_t hashBytes(const char* const data, const size_t size) {
+    uint64_t h{FNV_OFFSET};
+    size_t   i{0};
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(uint64_t));
+        h = (h ^ word) * FNV_PRIME;
+    }
+    for (; i < size; ++i) {
+        h = (h ^ static_cast<unsigned char>(data[i])) * FNV_PRIME;
+    }
+    return h;
+}
+
+MappedFile::MappedFile(const char* const file_name): m_file{INVALID_HANDLE_VALUE},
+                       m_mapping{nullptr}, m_data{nullptr}, m_size{0} {
+    m_file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (INVALID_HANDLE_VALUE == m_file) return;
+    LARGE_INTEGER file_sz;
+    // Empty files cannot be mapped
+    if (!GetFileSizeEx(m_file, &file_sz) || 0 == file_sz.QuadPart) return;
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping) return;
+    m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_data) {
+        m_size = static_cast<size_t>(file_sz.QuadPart);
+    }
+}
+
+MappedFile::MappedFile(MappedFile&& mf): m_file{mf.m_file}, m_mapping{mf.m_mapping},
+                       m_data{mf.m_data}, m_size{mf.m_size} {
+    // Mark as moved
+    mf.m_file    = INVALID_HANDLE_VALUE;
+    mf.m_mapping = nullptr;
+    mf.m_data    = nullptr;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& mf) {
+    assert(this != &mf);
+    // Free memory
+    destroy();
+    // Now copy the data
+    memcpy(this, &mf, sizeof(*this));
+    // Mark as moved
+    mf.m_file    = INVALID_HANDLE_VALUE;
+    mf.m_mapping = nullptr;
+    mf.m_data    = nullptr;
+    return *this;
+}
+
+MappedFile::~MappedFile() {
+    destroy();
+}
+
+void MappedFile::destroy() {
+    // Check if it was moved
+    if (m_data)    { UnmapViewOfFile(m_data); }
+    if (m_mapping) { CloseHandle(m_mapping); }
+    if (INVALID_HANDLE_VALUE != m_file) { CloseHandle(m_file); }
+}
+
+bool MappedFile::isMapped() const {
+    return nullptr != m_data;
+}
+
+const char* MappedFile::data() const {
+    return m_data;
+}
+
+size_t MappedFile::size() const {
+    return m_size;
+}
+
+uint64_t MappedFile::lastWriteTime() const {
+    FILETIME write_time;
+    if (!isMapped() || !GetFileTime(m_file, nullptr, nullptr, &write_time)) return 0;
+    return static_cast<uint64_t>(write_time.dwHighDateTime) << 32 | write_time.dwLowDateTime;
+}
+
+uint64_t MappedFile::hash() const {
+    // Hash blocks independently, then hash the sequence of block hashes
+    const int n_blocks{static_cast<int>((m_size + HASH_BLOCK_SZ - 1) / HASH_BLOCK_SZ)};
+    std::vector<uint64_t> block_hashes(n_blocks);
+    #pragma omp parallel for
+    for (int b = 0; b < n_blocks; ++b) {
+        const size_t offset{b * HASH_BLOCK_SZ};
+        block_hashes[b] = hashBytes(m_data + offset, std::min(HASH_BLOCK_SZ, m_size - offset));
+    }
+    return hashBytes(reinterpret_cast<const char*>(block_hashes.data()),
+                     block_hashes.size() * sizeof(uint64_t));
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "Definitions.h"
+
+/* Read-only memory-mapped file (Windows) */
+class MappedFile {
+public:
+    MappedFile() = delete;
+    RULE_OF_FIVE_NO_COPY(MappedFile);
+    // Maps the entire file into memory; use isMapped() to check for success
+    explicit MappedFile(const char* const file_name);
+    // Returns 'true' if the file has been mapped successfully
+    bool isMapped() const;
+    // Returns a pointer to the contents of the file
+    const char* data() const;
+    // Returns the size of the file in bytes
+    size_t size() const;
+    // Returns the time of the last write to the file (in 100 ns intervals since 1601)
+    uint64_t lastWriteTime() const;
+    // Computes a (non-cryptographic) 64-bit hash of the contents of the file in parallel
+    uint64_t hash() const;
+private:
+    // Unmaps the file and closes all handles
+    void destroy();
+    // Private data members
+    void*       m_file;                 // File handle
+    void*       m_mapping;              // File mapping object handle
+    const char* m_data;                 // Mapped view of the file
+    size_t      m_size;                 // Size of the file in bytes
+};
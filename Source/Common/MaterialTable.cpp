@@ -0,0 +1,49 @@
+#include "MaterialTable.h"
+#include <cassert>
+#include <GLM\common.hpp>
+#include "Constants.h"
+#include "Utility.hpp"
+#include "..\GL\GLPersistentBuffer.hpp"
+
+MaterialTable::MaterialTable(const uint capacity, const GLuint bind_idx): m_capacity{0},
+                                                                          m_bind_idx{bind_idx} {
+    reserve(glm::max(capacity, 1u));
+}
+
+uint MaterialTable::add(const rt::PhongMaterial& material) {
+    const uint index{size()};
+    if (index >= MAX_MATERIALS) {
+        printError("Too many materials: max. %u supported.", MAX_MATERIALS);
+        TERMINATE();
+    }
+    if (index == m_capacity) {
+        // Double the capacity
+        reserve(glm::min(2 * m_capacity, static_cast<uint>(MAX_MATERIALS)));
+    }
+    m_materials.push_back(material);
+    // The slot is not referenced by any draw yet, so it is safe to write to it
+    static_cast<rt::PhongMaterial*>(m_ssbo->data())[index] = material;
+    return index;
+}
+
+uint MaterialTable::size() const {
+    return static_cast<uint>(m_materials.size());
+}
+
+const rt::PhongMaterial* MaterialTable::get(const uint index) const {
+    assert(index < size());
+    return &m_materials[index];
+}
+
+void MaterialTable::reserve(const uint capacity) {
+    assert(capacity >= size());
+    // OpenGL defers the destruction of the old buffer until the GPU is done with it
+    m_ssbo = std::make_unique<GLPSB430>(capacity * sizeof(rt::PhongMaterial));
+    m_capacity = capacity;
+    // Upload the CPU copy
+    auto* const materials = static_cast<rt::PhongMaterial*>(m_ssbo->data());
+    for (uint i = 0, n = size(); i < n; ++i) {
+        materials[i] = m_materials[i];
+    }
+    m_ssbo->bind(m_bind_idx);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include "..\RT\RTBase.h"
+#include "..\GL\GLPersistentBuffer.h"
+
+/* Growable table of materials mirrored by a (std430) shader storage buffer
+   Addresses and indices of materials remain valid as the table grows */
+class MaterialTable {
+public:
+    MaterialTable() = delete;
+    RULE_OF_ZERO_NO_COPY(MaterialTable);
+    // Creates an empty table with GPU storage for 'capacity' materials
+    // The storage buffer is bound to the specified binding point
+    explicit MaterialTable(const uint capacity, const GLuint bind_idx);
+    // Adds a material (possibly at run time, growing the storage buffer); returns its index
+    uint add(const rt::PhongMaterial& material);
+    // Returns the number of materials
+    uint size() const;
+    // Returns the material at the specified index (CPU copy)
+    const rt::PhongMaterial* get(const uint index) const;
+private:
+    // Reallocates the storage buffer s.t. it can hold 'capacity' materials
+    void reserve(const uint capacity);
+    // Private data members
+    std::deque<rt::PhongMaterial> m_materials;  // CPU copy of materials (stable addresses)
+    std::unique_ptr<GLPSB430>     m_ssbo;       // GPU copy of materials
+    uint                          m_capacity;   // Capacity of the storage buffer
+    GLuint                        m_bind_idx;   // Storage buffer binding index
+};
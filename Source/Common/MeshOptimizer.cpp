@@ -0,0 +1,399 @@
+#include "MeshOptimizer.h"
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+CONSTEXPR uint NO_VERT = UINT32_MAX;    // Marks the absence of a vertex
+
+// Packs integer grid cell coordinates (21 bits per axis) into a 64-bit key
+static inline uint64_t cellKey(const int x, const int y, const int z) {
+    const uint64_t mask{(1u << 21) - 1};
+    return (static_cast<uint64_t>(x) & mask)         |
+           (static_cast<uint64_t>(y) & mask) << 21   |
+           (static_cast<uint64_t>(z) & mask) << 42;
+}
+
+// Packs an undirected edge into a 64-bit key
+static inline uint64_t edgeKey(const uint u, const uint v) {
+    return static_cast<uint64_t>(std::min(u, v)) << 32 | std::max(u, v);
+}
+
+/* Error quadric: symmetric 4x4 matrix stored as its upper triangle */
+struct Quadric {
+    double q[10];
+};
+
+// Adds the quadric of the plane (n, d) to 'quadric'
+static inline void addPlane(const double n[3], const double d, Quadric& quadric) {
+    const double p[4] = {n[0], n[1], n[2], d};
+    for (int i = 0, k = 0; i < 4; ++i) {
+        for (int j = i; j < 4; ++j, ++k) {
+            quadric.q[k] += p[i] * p[j];
+        }
+    }
+}
+
+// Computes the error of the position with respect to the sum of two quadrics
+static inline double quadricError(const Quadric& a, const Quadric& b, const float* const pos) {
+    const double p[4] = {pos[0], pos[1], pos[2], 1.0};
+    double error{0.0};
+    for (int i = 0, k = 0; i < 4; ++i) {
+        for (int j = i; j < 4; ++j, ++k) {
+            // Off-diagonal elements appear twice
+            error += (i == j ? 1.0 : 2.0) * (a.q[k] + b.q[k]) * p[i] * p[j];
+        }
+    }
+    return std::max(error, 0.0);
+}
+
+// Computes the (unnormalized) normal of the triangle
+static inline void triNormal(const float* const p0, const float* const p1, const float* const p2,
+                             double n[3]) {
+    const double e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    const double e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+void MeshOptimizer::weldVertices(std::vector<float>& positions, std::vector<float>& normals,
+                                 std::vector<uint>& indices, const float pos_eps,
+                                 const float nrm_eps) {
+    const uint n_verts{static_cast<uint>(positions.size() / 3)};
+    const bool has_normals{!normals.empty()};
+    if (0 == n_verts) return;
+    // Compute the bounding box
+    float box[2][3] = {{FLT_MAX, FLT_MAX, FLT_MAX}, {-FLT_MAX, -FLT_MAX, -FLT_MAX}};
+    for (uint v = 0; v < n_verts; ++v) {
+        for (int k = 0; k < 3; ++k) {
+            box[0][k] = std::min(box[0][k], positions[3 * v + k]);
+            box[1][k] = std::max(box[1][k], positions[3 * v + k]);
+        }
+    }
+    float max_extent{0.0f};
+    for (int k = 0; k < 3; ++k) {
+        max_extent = std::max(max_extent, box[1][k] - box[0][k]);
+    }
+    // Use grid cells of the size of the tolerance; cell size is positive
+    const float eps{std::max(pos_eps * max_extent, FLT_MIN)};
+    const float inv_cell_sz{1.0f / eps};
+    auto cellCoord = [&](const float* const pos, const int k) {
+        return static_cast<int>(floorf((pos[k] - box[0][k]) * inv_cell_sz));
+    };
+    // Each cell stores a linked list of unique vertices
+    std::unordered_map<uint64_t, uint> cell_heads;
+    cell_heads.reserve(n_verts);
+    std::vector<uint>  next_in_cell;
+    std::vector<uint>  remap(n_verts);
+    std::vector<float> new_positions, new_normals;
+    new_positions.reserve(positions.size());
+    new_normals.reserve(normals.size());
+    for (uint v = 0; v < n_verts; ++v) {
+        const float* const pos{&positions[3 * v]};
+        const float* const nrm{has_normals ? &normals[3 * v] : nullptr};
+        const int c[3] = {cellCoord(pos, 0), cellCoord(pos, 1), cellCoord(pos, 2)};
+        // Search the neighbouring cells for a vertex within the tolerance
+        uint match{NO_VERT};
+        for (int dz = -1; dz <= 1 && NO_VERT == match; ++dz)
+        for (int dy = -1; dy <= 1 && NO_VERT == match; ++dy)
+        for (int dx = -1; dx <= 1 && NO_VERT == match; ++dx) {
+            const auto head = cell_heads.find(cellKey(c[0] + dx, c[1] + dy, c[2] + dz));
+            if (cell_heads.end() == head) continue;
+            for (uint u = head->second; NO_VERT != u; u = next_in_cell[u]) {
+                bool is_close{true};
+                for (int k = 0; k < 3; ++k) {
+                    is_close &= fabsf(new_positions[3 * u + k] - pos[k]) <= eps;
+                    if (has_normals) {
+                        is_close &= fabsf(new_normals[3 * u + k] - nrm[k]) <= nrm_eps;
+                    }
+                }
+                if (is_close) {
+                    match = u;
+                    break;
+                }
+            }
+        }
+        if (NO_VERT == match) {
+            // Create a new unique vertex
+            match = static_cast<uint>(next_in_cell.size());
+            new_positions.insert(new_positions.end(), pos, pos + 3);
+            if (has_normals) {
+                new_normals.insert(new_normals.end(), nrm, nrm + 3);
+            }
+            // Insert it at the head of the list
+            const auto res = cell_heads.emplace(cellKey(c[0], c[1], c[2]), match);
+            next_in_cell.push_back(res.second ? NO_VERT : res.first->second);
+            res.first->second = match;
+        }
+        remap[v] = match;
+    }
+    positions.swap(new_positions);
+    normals.swap(new_normals);
+    // Remap indices and remove degenerate triangles
+    size_t n_indices{0};
+    for (size_t i = 0, n = indices.size(); i < n; i += 3) {
+        const uint a{remap[indices[i]]}, b{remap[indices[i + 1]]}, c{remap[indices[i + 2]]};
+        if (a != b && b != c && c != a) {
+            indices[n_indices++] = a;
+            indices[n_indices++] = b;
+            indices[n_indices++] = c;
+        }
+    }
+    indices.resize(n_indices);
+}
+
+void MeshOptimizer::optimizeVertexCache(std::vector<uint>& indices, const uint n_verts,
+                                        const uint cache_sz) {
+    const uint n_tris{static_cast<uint>(indices.size() / 3)};
+    if (0 == n_tris) return;
+    // Build vertex-to-triangle adjacency in the compressed sparse row (CSR) format
+    std::vector<uint> first_adj(n_verts + 1, 0);
+    for (size_t i = 0, n = indices.size(); i < n; ++i) {
+        ++first_adj[indices[i] + 1];
+    }
+    for (uint v = 0; v < n_verts; ++v) {
+        first_adj[v + 1] += first_adj[v];
+    }
+    std::vector<uint> adj_tris(indices.size());
+    std::vector<uint> next_adj(first_adj.begin(), first_adj.end() - 1);
+    for (size_t i = 0, n = indices.size(); i < n; ++i) {
+        adj_tris[next_adj[indices[i]]++] = static_cast<uint>(i / 3);
+    }
+    // Number of triangles yet to be emitted per vertex
+    std::vector<uint> live_counts(n_verts);
+    for (uint v = 0; v < n_verts; ++v) {
+        live_counts[v] = first_adj[v + 1] - first_adj[v];
+    }
+    std::vector<uint> cache_times(n_verts, 0);  // Time stamps of vertices entering the cache
+    std::vector<bool> is_emitted(n_tris, false);
+    std::vector<uint> dead_ends;                // Stack of recently referenced vertices
+    std::vector<uint> candidates;               // Vertices of the last emitted fan
+    std::vector<uint> new_indices;
+    new_indices.reserve(indices.size());
+    uint time{cache_sz + 1};                    // Current time stamp
+    uint cursor{0};                             // Input order cursor
+    // Returns a vertex with remaining triangles, or NO_VERT if there is none
+    auto skipDeadEnd = [&]() {
+        while (!dead_ends.empty()) {
+            const uint v{dead_ends.back()};
+            dead_ends.pop_back();
+            if (live_counts[v] > 0) return v;
+        }
+        for (; cursor < n_verts; ++cursor) {
+            if (live_counts[cursor] > 0) return cursor;
+        }
+        return NO_VERT;
+    };
+    for (uint fan = skipDeadEnd(); NO_VERT != fan; ) {
+        // Emit all remaining triangles adjacent to the fanning vertex
+        candidates.clear();
+        for (uint a = first_adj[fan]; a < first_adj[fan + 1]; ++a) {
+            const uint t{adj_tris[a]};
+            if (is_emitted[t]) continue;
+            for (uint k = 0; k < 3; ++k) {
+                const uint v{indices[3 * t + k]};
+                new_indices.push_back(v);
+                dead_ends.push_back(v);
+                candidates.push_back(v);
+                --live_counts[v];
+                if (time - cache_times[v] > cache_sz) {
+                    // The vertex is not in the cache
+                    cache_times[v] = time++;
+                }
+            }
+            is_emitted[t] = true;
+        }
+        // Pick the candidate which remains in the cache the longest after its fan is emitted
+        uint best_vert{NO_VERT};
+        int  best_prio{-1};
+        for (auto c = candidates.begin(); c != candidates.end(); ++c) {
+            if (live_counts[*c] > 0) {
+                int prio{0};
+                if (time - cache_times[*c] + 2 * live_counts[*c] <= cache_sz) {
+                    prio = static_cast<int>(time - cache_times[*c]);
+                }
+                if (prio > best_prio) {
+                    best_prio = prio;
+                    best_vert = *c;
+                }
+            }
+        }
+        fan = (NO_VERT != best_vert) ? best_vert : skipDeadEnd();
+    }
+    indices.swap(new_indices);
+}
+
+void MeshOptimizer::optimizeVertexFetch(std::vector<float>& positions,
+                                        std::vector<float>& normals,
+                                        std::vector<uint>& indices) {
+    const uint n_verts{static_cast<uint>(positions.size() / 3)};
+    const bool has_normals{!normals.empty()};
+    std::vector<uint>  remap(n_verts, NO_VERT);
+    std::vector<float> new_positions, new_normals;
+    new_positions.reserve(positions.size());
+    new_normals.reserve(normals.size());
+    uint n_new_verts{0};
+    for (auto i = indices.begin(); i != indices.end(); ++i) {
+        if (NO_VERT == remap[*i]) {
+            remap[*i] = n_new_verts++;
+            new_positions.insert(new_positions.end(), &positions[3 * *i], &positions[3 * *i] + 3);
+            if (has_normals) {
+                new_normals.insert(new_normals.end(), &normals[3 * *i], &normals[3 * *i] + 3);
+            }
+        }
+        *i = remap[*i];
+    }
+    positions.swap(new_positions);
+    normals.swap(new_normals);
+}
+
+float MeshOptimizer::simplify(const std::vector<float>& positions,
+                              const std::vector<uint>& indices, const uint target_n_tris,
+                              const float max_error, std::vector<uint>& simplified) {
+    const uint n_verts{static_cast<uint>(positions.size() / 3)};
+    const uint n_tris{static_cast<uint>(indices.size() / 3)};
+    simplified = indices;
+    if (n_tris <= target_n_tris) return 0.0f;
+    auto pos = [&positions](const uint v) { return &positions[3 * v]; };
+    // Compute the size of the mesh
+    float box[2][3] = {{FLT_MAX, FLT_MAX, FLT_MAX}, {-FLT_MAX, -FLT_MAX, -FLT_MAX}};
+    for (uint v = 0; v < n_verts; ++v) {
+        for (int k = 0; k < 3; ++k) {
+            box[0][k] = std::min(box[0][k], positions[3 * v + k]);
+            box[1][k] = std::max(box[1][k], positions[3 * v + k]);
+        }
+    }
+    float max_extent{0.0f};
+    for (int k = 0; k < 3; ++k) {
+        max_extent = std::max(max_extent, box[1][k] - box[0][k]);
+    }
+    const double max_error_sq{static_cast<double>(max_error * max_extent) *
+                              static_cast<double>(max_error * max_extent)};
+    // Accumulate the quadrics of the planes of adjacent triangles
+    std::vector<Quadric> quadrics(n_verts, Quadric{});
+    std::vector<std::vector<uint>> vert_tris(n_verts);
+    std::unordered_map<uint64_t, uint> edge_counts;
+    edge_counts.reserve(indices.size());
+    for (uint t = 0; t < n_tris; ++t) {
+        const uint* const tri{&indices[3 * t]};
+        double n[3];
+        triNormal(pos(tri[0]), pos(tri[1]), pos(tri[2]), n);
+        const double len{sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2])};
+        for (int k = 0; k < 3; ++k) {
+            vert_tris[tri[k]].push_back(t);
+            ++edge_counts[edgeKey(tri[k], tri[(k + 1) % 3])];
+        }
+        if (len > 0.0) {
+            for (int k = 0; k < 3; ++k) {
+                n[k] /= len;
+            }
+            const double d{-(n[0] * pos(tri[0])[0] + n[1] * pos(tri[0])[1] +
+                             n[2] * pos(tri[0])[2])};
+            for (int k = 0; k < 3; ++k) {
+                addPlane(n, d, quadrics[tri[k]]);
+            }
+        }
+    }
+    // Lock the vertices of boundary (and non-manifold) edges to prevent cracks
+    std::vector<bool> is_locked(n_verts, false);
+    for (auto e = edge_counts.begin(); e != edge_counts.end(); ++e) {
+        if (2 != e->second) {
+            is_locked[static_cast<uint>(e->first >> 32)] = true;
+            is_locked[static_cast<uint>(e->first)]       = true;
+        }
+    }
+    edge_counts.clear();
+    /* Candidate collapse of vertex 'from' onto vertex 'to' */
+    struct Collapse {
+        double cost;
+        uint   from, to;
+        uint   from_ver, to_ver;            // Versions of vertices when the cost was computed
+        bool operator>(const Collapse& other) const { return cost > other.cost; }
+    };
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+    std::vector<uint> versions(n_verts, 0);
+    std::vector<bool> is_removed(n_verts, false);
+    auto pushCollapse = [&](const uint from, const uint to) {
+        if (is_locked[from]) return;
+        const double cost{quadricError(quadrics[from], quadrics[to], pos(to))};
+        if (cost <= max_error_sq) {
+            const Collapse c = {cost, from, to, versions[from], versions[to]};
+            queue.push(c);
+        }
+    };
+    for (uint t = 0; t < n_tris; ++t) {
+        for (int k = 0; k < 3; ++k) {
+            pushCollapse(indices[3 * t + k], indices[3 * t + (k + 1) % 3]);
+            pushCollapse(indices[3 * t + (k + 1) % 3], indices[3 * t + k]);
+        }
+    }
+    // Collapse edges
+    std::vector<bool> is_dead(n_tris, false);
+    uint   n_live_tris{n_tris};
+    double error_sq{0.0};
+    while (n_live_tris > target_n_tris && !queue.empty()) {
+        const Collapse c = queue.top();
+        queue.pop();
+        if (is_removed[c.from] || is_removed[c.to] ||
+            versions[c.from] != c.from_ver || versions[c.to] != c.to_ver) continue;
+        // Reject collapses which flip (or degenerate) any of the remaining triangles
+        bool is_valid{true};
+        for (auto t = vert_tris[c.from].begin(); t != vert_tris[c.from].end() && is_valid; ++t) {
+            const uint* const tri{&simplified[3 * *t]};
+            if (is_dead[*t] || c.to == tri[0] || c.to == tri[1] || c.to == tri[2]) continue;
+            const float* p[3];
+            for (int k = 0; k < 3; ++k) {
+                p[k] = pos(c.from == tri[k] ? c.to : tri[k]);
+            }
+            double n_old[3], n_new[3];
+            triNormal(pos(tri[0]), pos(tri[1]), pos(tri[2]), n_old);
+            triNormal(p[0], p[1], p[2], n_new);
+            is_valid = n_old[0] * n_new[0] + n_old[1] * n_new[1] + n_old[2] * n_new[2] > 0.0;
+        }
+        if (!is_valid) continue;
+        // Move the triangles of 'from' to 'to', removing those which become degenerate
+        for (auto t = vert_tris[c.from].begin(); t != vert_tris[c.from].end(); ++t) {
+            if (is_dead[*t]) continue;
+            uint* const tri{&simplified[3 * *t]};
+            if (c.to == tri[0] || c.to == tri[1] || c.to == tri[2]) {
+                is_dead[*t] = true;
+                --n_live_tris;
+            } else {
+                for (int k = 0; k < 3; ++k) {
+                    if (c.from == tri[k]) tri[k] = c.to;
+                }
+                vert_tris[c.to].push_back(*t);
+            }
+        }
+        for (int k = 0; k < 10; ++k) {
+            quadrics[c.to].q[k] += quadrics[c.from].q[k];
+        }
+        is_removed[c.from] = true;
+        ++versions[c.to];
+        error_sq = std::max(error_sq, c.cost);
+        // Update the costs of the edges incident to 'to'
+        for (auto t = vert_tris[c.to].begin(); t != vert_tris[c.to].end(); ++t) {
+            if (is_dead[*t]) continue;
+            for (int k = 0; k < 3; ++k) {
+                const uint v{simplified[3 * *t + k]};
+                if (c.to == v) continue;
+                pushCollapse(c.to, v);
+                pushCollapse(v, c.to);
+            }
+        }
+    }
+    // Compact the remaining triangles
+    size_t n_indices{0};
+    for (uint t = 0; t < n_tris; ++t) {
+        if (is_dead[t]) continue;
+        for (int k = 0; k < 3; ++k) {
+            simplified[n_indices++] = simplified[3 * t + k];
+        }
+    }
+    simplified.resize(n_indices);
+    return static_cast<float>(sqrt(error_sq));
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+#include "Definitions.h"
+
+/* Static class implementing optimizations of indexed triangle meshes */
+class MeshOptimizer {
+public:
+    MeshOptimizer() = delete;
+    RULE_OF_ZERO(MeshOptimizer);
+    // Merges vertices with positions closer than 'pos_eps' (relative to the size of the mesh)
+    // and normals closer than 'nrm_eps' (per component); if there are no normals, only
+    // positions are compared; triangles which become degenerate are removed
+    static void weldVertices(std::vector<float>& positions, std::vector<float>& normals,
+                             std::vector<uint>& indices, const float pos_eps,
+                             const float nrm_eps);
+    // Reorders triangles for the post-transform vertex cache of the specified size
+    // Uses the Tipsify algorithm [Sander et al. 2007]; preserves the winding order
+    static void optimizeVertexCache(std::vector<uint>& indices, const uint n_verts,
+                                    const uint cache_sz);
+    // Reorders vertices in the order of their first use (for the pre-transform cache)
+    // Unreferenced vertices are removed
+    static void optimizeVertexFetch(std::vector<float>& positions, std::vector<float>& normals,
+                                    std::vector<uint>& indices);
+    // Simplifies the mesh by collapsing edges in the order of increasing quadric error
+    // [Garland and Heckbert 1997] until it has at most 'target_n_tris' triangles, or the next
+    // collapse would exceed 'max_error' (relative to the size of the mesh)
+    // Vertices are collapsed onto their neighbours, so the simplified indices refer to the
+    // original vertices; boundary vertices (including those of seams) are never moved
+    // Returns the geometric error (in units of distance) of the simplified mesh
+    static float simplify(const std::vector<float>& positions, const std::vector<uint>& indices,
+                          const uint target_n_tris, const float max_error,
+                          std::vector<uint>& simplified);
+};
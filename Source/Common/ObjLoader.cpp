@@ -0,0 +1,407 @@
+#include "ObjLoader.h"
+#include <map>
+#include <cmath>
+#include <cctype>
+#include <string>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include "MappedFile.h"
+#include "Utility.hpp"
+
+namespace tinyobj {
+    // Parses the material library; defined (but not declared) by TinyOBJ
+    std::string LoadMtl(std::map<std::string, material_t>& material_map,
+                        const char* filename, const char* mtl_basepath);
+    // Resets all material properties; defined (but not declared) by TinyOBJ
+    void InitMaterial(material_t& material);
+}
+
+CONSTEXPR size_t CHUNK_SZ = 4 << 20;            // Approximate size of a parsed chunk (4 MiB)
+CONSTEXPR int    NO_IDX   = INT_MIN;            // Marks an absent normal index
+
+/* Vertex of a face */
+struct FaceVert {
+    int  pos_idx, nrm_idx;                      // Position and normal indices (0-based)
+    bool pos_local, nrm_local;                  // Whether indices are relative to the chunk
+};
+
+/* Data parsed from a contiguous range of lines */
+struct ObjChunk {
+    std::vector<float>    positions;            // Positions defined within the chunk
+    std::vector<float>    normals;              // Normals defined within the chunk
+    std::vector<FaceVert> verts;                // Triangle vertices (3 per triangle)
+    std::vector<int>      tri_mat_ids;          // Material index per triangle
+    std::vector<std::pair<size_t, std::string>> mat_switches;  // (First triangle, material)
+    std::string           mtl_lib;              // Material library file name
+    bool                  is_valid;             // Whether the chunk is well-formed
+};
+
+// Checks whether the character is a space or a tab
+static inline bool isBlank(const char c) {
+    return ' ' == c || '\t' == c;
+}
+
+// Checks whether the character is a decimal digit
+static inline bool isDigit(const char c) {
+    return static_cast<unsigned char>(c - '0') < 10;
+}
+
+// Skips spaces and tabs
+static inline void skipBlanks(const char*& p, const char* const end) {
+    while (p < end && isBlank(*p)) ++p;
+}
+
+// Checks whether the line starts with the keyword followed by a blank
+static inline bool isKeyword(const char* const p, const char* const end,
+                             const char* const keyword, const size_t len) {
+    return static_cast<size_t>(end - p) > len && 0 == strncmp(p, keyword, len) &&
+           isBlank(p[len]);
+}
+
+// Parses a (signed) decimal integer; returns 'false' if there are no digits
+static inline bool parseInt(const char*& p, const char* const end, int& val) {
+    bool is_neg{false};
+    if (p < end && ('-' == *p || '+' == *p)) {
+        is_neg = '-' == *p;
+        ++p;
+    }
+    if (p == end || !isDigit(*p)) return false;
+    int abs_val{0};
+    while (p < end && isDigit(*p)) {
+        abs_val = 10 * abs_val + (*p++ - '0');
+    }
+    val = is_neg ? -abs_val : abs_val;
+    return true;
+}
+
+// Parses a floating-point number in the fixed or the scientific notation
+// Trades correct rounding of the last bit for speed; returns 'false' if there are no digits
+static inline bool parseFloat(const char*& p, const char* const end, float& val) {
+    static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                   1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                   1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    skipBlanks(p, end);
+    bool is_neg{false};
+    if (p < end && ('-' == *p || '+' == *p)) {
+        is_neg = '-' == *p;
+        ++p;
+    }
+    // Accumulate up to 19 significant digits in the mantissa
+    uint64_t mantissa{0};
+    int      n_digits{0}, exponent{0};
+    for (; p < end && isDigit(*p); ++p, ++n_digits) {
+        if (mantissa < 1000000000000000000ull) {
+            mantissa = 10 * mantissa + (*p - '0');
+        } else {
+            ++exponent;
+        }
+    }
+    if (p < end && '.' == *p) {
+        for (++p; p < end && isDigit(*p); ++p, ++n_digits) {
+            if (mantissa < 1000000000000000000ull) {
+                mantissa = 10 * mantissa + (*p - '0');
+                --exponent;
+            }
+        }
+    }
+    if (0 == n_digits) return false;
+    if (p < end && ('e' == *p || 'E' == *p)) {
+        const char* exp_begin{++p};
+        int exp_val;
+        if (parseInt(p, end, exp_val)) {
+            exponent += exp_val;
+        } else {
+            p = exp_begin - 1;
+        }
+    }
+    double abs_val{static_cast<double>(mantissa)};
+    if (exponent < 0) {
+        abs_val = (exponent >= -22) ? abs_val / pow10[-exponent] : abs_val * pow(10.0, exponent);
+    } else if (exponent > 0) {
+        abs_val = (exponent <=  22) ? abs_val * pow10[exponent]  : abs_val * pow(10.0, exponent);
+    }
+    val = static_cast<float>(is_neg ? -abs_val : abs_val);
+    return true;
+}
+
+// Parses 3 floating-point numbers
+static inline bool parseFloat3(const char*& p, const char* const end, float* const vals) {
+    return parseFloat(p, end, vals[0]) && parseFloat(p, end, vals[1]) &&
+           parseFloat(p, end, vals[2]);
+}
+
+// Parses the name following a keyword
+static inline std::string parseName(const char*& p, const char* const end) {
+    skipBlanks(p, end);
+    const char* const begin{p};
+    while (p < end && !isspace(static_cast<unsigned char>(*p))) ++p;
+    return std::string{begin, p};
+}
+
+// Parses a face vertex in one of the formats: 'v', 'v/vt', 'v//vn', 'v/vt/vn'
+// Negative (relative) indices are converted to indices relative to the chunk
+static inline bool parseFaceVert(const char*& p, const char* const end, const int n_pos,
+                                 const int n_nrm, FaceVert& vert) {
+    int pos_idx, nrm_idx{0}, tex_idx;
+    if (!parseInt(p, end, pos_idx) || 0 == pos_idx) return false;
+    if (p < end && '/' == *p) {
+        ++p;
+        // Texture coordinates are not used
+        parseInt(p, end, tex_idx);
+        if (p < end && '/' == *p) {
+            ++p;
+            if (!parseInt(p, end, nrm_idx) || 0 == nrm_idx) return false;
+        }
+    }
+    vert.pos_local = pos_idx < 0;
+    vert.pos_idx   = vert.pos_local ? n_pos + pos_idx : pos_idx - 1;
+    vert.nrm_local = nrm_idx < 0;
+    vert.nrm_idx   = vert.nrm_local ? n_nrm + nrm_idx : (nrm_idx ? nrm_idx - 1 : NO_IDX);
+    return true;
+}
+
+// Parses the lines within [begin, end)
+static void parseChunk(const char* const begin, const char* const end, ObjChunk& chunk) {
+    chunk.is_valid = true;
+    std::vector<FaceVert> face;
+    for (const char* p = begin; p < end; ) {
+        skipBlanks(p, end);
+        const char* const line_end{static_cast<const char*>(memchr(p, '\n', end - p))};
+        const char* const eol{line_end ? line_end : end};
+        bool is_valid{true};
+        if (isKeyword(p, eol, "v", 1)) {
+            // Position
+            p += 2;
+            float pos[3];
+            is_valid = parseFloat3(p, eol, pos);
+            chunk.positions.insert(chunk.positions.end(), pos, pos + 3);
+        } else if (isKeyword(p, eol, "vn", 2)) {
+            // Normal
+            p += 3;
+            float nrm[3];
+            is_valid = parseFloat3(p, eol, nrm);
+            chunk.normals.insert(chunk.normals.end(), nrm, nrm + 3);
+        } else if (isKeyword(p, eol, "f", 1)) {
+            // Face
+            p += 2;
+            const int n_pos{static_cast<int>(chunk.positions.size() / 3)};
+            const int n_nrm{static_cast<int>(chunk.normals.size() / 3)};
+            face.clear();
+            for (skipBlanks(p, eol); p < eol && !isspace(static_cast<unsigned char>(*p));
+                 skipBlanks(p, eol)) {
+                FaceVert vert;
+                if (!parseFaceVert(p, eol, n_pos, n_nrm, vert)) {
+                    is_valid = false;
+                    break;
+                }
+                face.push_back(vert);
+            }
+            // Triangulate the polygon as a fan
+            for (size_t i = 2, n = face.size(); is_valid && i < n; ++i) {
+                chunk.verts.push_back(face[0]);
+                chunk.verts.push_back(face[i - 1]);
+                chunk.verts.push_back(face[i]);
+            }
+        } else if (isKeyword(p, eol, "usemtl", 6)) {
+            p += 7;
+            chunk.mat_switches.emplace_back(chunk.verts.size() / 3, parseName(p, eol));
+        } else if (isKeyword(p, eol, "mtllib", 6)) {
+            p += 7;
+            if (chunk.mtl_lib.empty()) {
+                chunk.mtl_lib = parseName(p, eol);
+            }
+        }
+        // Other statements (comments, texture coordinates, groups...) are ignored
+        if (!is_valid) {
+            chunk.is_valid = false;
+            return;
+        }
+        p = eol + 1;
+    }
+}
+
+bool ObjLoader::load(const char* const file_name, const char* const mtl_base_path,
+                     std::vector<Group>& groups) {
+    const MappedFile file{file_name};
+    if (!file.isMapped()) {
+        printError("Failed to map file: %s", file_name);
+        return false;
+    }
+    // Split the file into chunks at line boundaries
+    const char* const data{file.data()};
+    const size_t      size{file.size()};
+    const int n_chunks{static_cast<int>((size + CHUNK_SZ - 1) / CHUNK_SZ)};
+    std::vector<const char*> bounds(n_chunks + 1);
+    bounds[0]        = data;
+    bounds[n_chunks] = data + size;
+    for (int c = 1; c < n_chunks; ++c) {
+        const char* p{std::max(data + c * CHUNK_SZ, bounds[c - 1])};
+        const char* const line_end{static_cast<const char*>(memchr(p, '\n', data + size - p))};
+        bounds[c] = line_end ? line_end + 1 : data + size;
+    }
+    // Parse the chunks in parallel
+    std::vector<ObjChunk> chunks(n_chunks);
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < n_chunks; ++c) {
+        parseChunk(bounds[c], bounds[c + 1], chunks[c]);
+    }
+    // Load the material library
+    std::map<std::string, tinyobj::material_t> material_map;
+    for (auto c = chunks.begin(); c != chunks.end(); ++c) {
+        if (!c->is_valid) {
+            printError("Malformed statement within file: %s", file_name);
+            return false;
+        }
+        if (!c->mtl_lib.empty() && material_map.empty()) {
+            const std::string err{tinyobj::LoadMtl(material_map, c->mtl_lib.c_str(),
+                                                   mtl_base_path)};
+            if (!err.empty()) {
+                printError("%s", err.c_str());
+                return false;
+            }
+        }
+    }
+    // Assign material indices in the order of material names
+    // Faces preceding the first 'usemtl' statement use the unnamed material
+    std::map<std::string, int> mat_ids;
+    mat_ids[""] = 0;
+    for (auto c = chunks.begin(); c != chunks.end(); ++c) {
+        for (auto s = c->mat_switches.begin(); s != c->mat_switches.end(); ++s) {
+            mat_ids[s->second] = 0;
+        }
+    }
+    std::vector<const std::string*> mat_names;
+    for (auto m = mat_ids.begin(); m != mat_ids.end(); ++m) {
+        m->second = static_cast<int>(mat_names.size());
+        mat_names.push_back(&m->first);
+    }
+    const int n_mats{static_cast<int>(mat_names.size())};
+    // Compute chunk offsets and materials active at the start of each chunk
+    std::vector<int> pos_offsets(n_chunks + 1, 0), nrm_offsets(n_chunks + 1, 0);
+    std::vector<int> first_mat_ids(n_chunks, mat_ids[""]);
+    for (int c = 0; c < n_chunks; ++c) {
+        pos_offsets[c + 1] = pos_offsets[c] + static_cast<int>(chunks[c].positions.size() / 3);
+        nrm_offsets[c + 1] = nrm_offsets[c] + static_cast<int>(chunks[c].normals.size() / 3);
+        if (c + 1 < n_chunks) {
+            first_mat_ids[c + 1] = chunks[c].mat_switches.empty() ? first_mat_ids[c] :
+                                   mat_ids[chunks[c].mat_switches.back().second];
+        }
+    }
+    const int n_pos{pos_offsets[n_chunks]}, n_nrm{nrm_offsets[n_chunks]};
+    // Resolve indices and materials; gather positions and normals
+    std::vector<float> positions(3 * static_cast<size_t>(n_pos));
+    std::vector<float> normals(3 * static_cast<size_t>(n_nrm));
+    std::vector<size_t> tri_counts(n_chunks * n_mats, 0);
+    bool is_valid{true};
+    #pragma omp parallel for schedule(dynamic) reduction(&&: is_valid)
+    for (int c = 0; c < n_chunks; ++c) {
+        ObjChunk& chunk = chunks[c];
+        std::copy(chunk.positions.begin(), chunk.positions.end(),
+                  positions.begin() + 3 * pos_offsets[c]);
+        std::copy(chunk.normals.begin(),   chunk.normals.end(),
+                  normals.begin()   + 3 * nrm_offsets[c]);
+        // Release memory early
+        std::vector<float>().swap(chunk.positions);
+        std::vector<float>().swap(chunk.normals);
+        for (auto v = chunk.verts.begin(); v != chunk.verts.end(); ++v) {
+            if (v->pos_local) { v->pos_idx += pos_offsets[c]; }
+            if (v->nrm_local) { v->nrm_idx += nrm_offsets[c]; }
+            is_valid = is_valid && 0 <= v->pos_idx && v->pos_idx < n_pos &&
+                       (NO_IDX == v->nrm_idx || (0 <= v->nrm_idx && v->nrm_idx < n_nrm));
+        }
+        const size_t n_tris{chunk.verts.size() / 3};
+        chunk.tri_mat_ids.resize(n_tris);
+        int  mat_id{first_mat_ids[c]};
+        auto s = chunk.mat_switches.begin();
+        for (size_t t = 0; t < n_tris; ++t) {
+            for (; s != chunk.mat_switches.end() && s->first == t; ++s) {
+                mat_id = mat_ids.find(s->second)->second;
+            }
+            chunk.tri_mat_ids[t] = mat_id;
+            ++tri_counts[c * n_mats + mat_id];
+        }
+    }
+    if (!is_valid) {
+        printError("Vertex index out of range within file: %s", file_name);
+        return false;
+    }
+    // Compute the offsets of chunks within material groups
+    std::vector<size_t> tri_offsets(n_chunks * n_mats);
+    std::vector<size_t> group_sizes(n_mats, 0);
+    for (int m = 0; m < n_mats; ++m) {
+        for (int c = 0; c < n_chunks; ++c) {
+            tri_offsets[c * n_mats + m] = group_sizes[m];
+            group_sizes[m] += tri_counts[c * n_mats + m];
+        }
+    }
+    // Scatter triangles to material groups
+    std::vector<std::vector<FaceVert>> group_verts(n_mats);
+    for (int m = 0; m < n_mats; ++m) {
+        group_verts[m].resize(3 * group_sizes[m]);
+    }
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < n_chunks; ++c) {
+        ObjChunk& chunk = chunks[c];
+        std::vector<size_t> next_tri(tri_offsets.begin() + c * n_mats,
+                                     tri_offsets.begin() + (c + 1) * n_mats);
+        for (size_t t = 0, n = chunk.tri_mat_ids.size(); t < n; ++t) {
+            const int m{chunk.tri_mat_ids[t]};
+            std::copy(chunk.verts.begin() + 3 * t, chunk.verts.begin() + 3 * (t + 1),
+                      group_verts[m].begin() + 3 * next_tri[m]++);
+        }
+        std::vector<FaceVert>().swap(chunk.verts);
+    }
+    // Create a mesh per non-empty group, merging identical (position, normal) pairs
+    groups.clear();
+    std::vector<int> group_mat_ids;
+    for (int m = 0; m < n_mats; ++m) {
+        if (group_sizes[m] > 0) {
+            group_mat_ids.push_back(m);
+        }
+    }
+    const int n_groups{static_cast<int>(group_mat_ids.size())};
+    groups.resize(n_groups);
+    #pragma omp parallel for schedule(dynamic)
+    for (int g = 0; g < n_groups; ++g) {
+        const std::vector<FaceVert>& verts = group_verts[group_mat_ids[g]];
+        Group& group = groups[g];
+        // Normals are generated later unless every vertex references one
+        bool has_normals{true};
+        for (auto v = verts.begin(); v != verts.end(); ++v) {
+            has_normals &= NO_IDX != v->nrm_idx;
+        }
+        std::unordered_map<uint64_t, uint> vert_ids;
+        vert_ids.reserve(verts.size());
+        group.indices.reserve(verts.size());
+        for (auto v = verts.begin(); v != verts.end(); ++v) {
+            const uint64_t nrm_key{has_normals ? static_cast<uint>(v->nrm_idx) : 0u};
+            const uint64_t key{static_cast<uint64_t>(v->pos_idx) << 32 | nrm_key};
+            const uint     new_id{static_cast<uint>(vert_ids.size())};
+            const auto     res = vert_ids.emplace(key, new_id);
+            if (res.second) {
+                const float* const pos{&positions[3 * static_cast<size_t>(v->pos_idx)]};
+                group.positions.insert(group.positions.end(), pos, pos + 3);
+                if (has_normals) {
+                    const float* const nrm{&normals[3 * static_cast<size_t>(v->nrm_idx)]};
+                    group.normals.insert(group.normals.end(), nrm, nrm + 3);
+                }
+            }
+            group.indices.push_back(res.first->second);
+        }
+    }
+    // Look up the materials
+    for (int g = 0; g < n_groups; ++g) {
+        const std::string& mat_name = *mat_names[group_mat_ids[g]];
+        const auto mat = material_map.find(mat_name);
+        if (material_map.end() != mat) {
+            groups[g].material = mat->second;
+        } else {
+            // Same as TinyOBJ: unknown materials are reset to defaults
+            tinyobj::InitMaterial(groups[g].material);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+#include <TinyOBJ\tiny_obj_loader.h>
+#include "Definitions.h"
+
+/* Static class implementing a multithreaded loader of Wavefront OBJ files */
+class ObjLoader {
+public:
+    ObjLoader() = delete;
+    RULE_OF_ZERO(ObjLoader);
+    /* Triangle mesh containing all faces which share a single material */
+    struct Group {
+        tinyobj::material_t material;   // Material of the faces
+        std::vector<float>  positions;  // Vertex positions (3 floats per vertex)
+        std::vector<float>  normals;    // Vertex normals (3 floats per vertex); may be empty
+        std::vector<uint>   indices;    // Vertex indices (3 per triangle)
+    };
+    // Loads the OBJ file and the material library it references from 'mtl_base_path'
+    // The file is memory-mapped, split into chunks and parsed in parallel
+    // Faces are triangulated and grouped by material; groups are sorted by material name
+    // Returns 'false' on failure
+    static bool load(const char* const file_name, const char* const mtl_base_path,
+                     std::vector<Group>& groups);
+};
@@ -8,6 +8,10 @@ void UnitRNG::init() {
     m_gen = std::mt19937{rd()};
 }
 
+void UnitRNG::init(const uint seed) {
+    m_gen = std::mt19937{seed};
+}
+
 float UnitRNG::generate() {
     #ifdef BROKEN_STD_GENERATE_CANONICAL
         static const std::uniform_real_distribution<float> dis{0.0, 1.0};
@@ -16,3 +20,7 @@ float UnitRNG::generate() {
         return std::generate_canonical<float, std::numeric_limits<float>::digits>(gen);
     #endif
 }
+
+uint UnitRNG::generateUint() {
+    return m_gen();
+}
@@ -19,8 +19,12 @@ public:
     RULE_OF_ZERO(UnitRNG);
     // Performs initialization
     static void init();
+    // Performs initialization with the specified seed (for reproducible results)
+    static void init(const uint seed);
     // Generates a random single-precision float on [0, 1)
     static float generate();
+    // Generates a random 32-bit unsigned integer (e.g. a seed)
+    static uint generateUint();
 private:
     static std::mt19937 m_gen;    // Mersenne Twister pseudorandom number generator
 };
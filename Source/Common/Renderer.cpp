@@ -3,9 +3,11 @@
 #include "Utility.hpp"
 #include "Halton.hpp"
 #include "Random.h"
+#include "TraceLog.h"
 #include "..\GL\GLShader.hpp"
 #include "..\GL\GLUniformManager.hpp"
 #include "..\GL\GLTexture2D.hpp"
+#include "..\GL\GLGPUProfiler.hpp"
 #include "..\RT\PhotonTracer.h"
 #include "..\VPL\PointLight.hpp"
 #include "..\VPL\OmniShadowMap.hpp"
@@ -16,12 +18,18 @@ using glm::normalize;
 
 CONSTEXPR GLuint  ss_quad_va_components  = 1;    // Position
 CONSTEXPR GLsizei ss_quad_va_comp_cnts[] = {3};  // vec3
+// Names of GPUPass values
+static const char* const gpu_pass_names[N_GPU_PASSES] = {"PPL transm", "PPL SM", "VPL SM",
+                                                         "G-buffer", "PI density", "VPL cull",
+                                                         "Surface", "VPL filter", "Volume",
+                                                         "Combine", "Convergence"};
 
 DeferredRenderer::DeferredRenderer(const int res_x, const int res_y):
                   m_res_x{res_x}, m_res_y{res_y},
                   m_hal_tbo{MAX_FRAMES * MAX_VOL_SAMP * sizeof(GLfloat), TEX_U_HALTON, gl::R32F},
                   m_ppl_OSM{PRI_SM_RES, 1,          MAX_DIST, TEX_U_PPL_SM},
                   m_vpl_OSM{SEC_SM_RES, MAX_N_VPLS, MAX_DIST, TEX_U_VPL_SM},
+                  m_ppl_dens_w_pos{0.0f}, m_is_fog_ready{false}, m_is_transm_valid{false},
                   m_ss_quad_va{ss_quad_va_components, ss_quad_va_comp_cnts},
                   m_tex_depth{TEX_U_DEPTH, res_x, res_y, false, false},
                   m_tex_accum{TEX_U_ACCUM, res_x, res_y, false, false},
@@ -30,7 +38,13 @@ DeferredRenderer::DeferredRenderer(const int res_x, const int res_y):
                   m_tex_mat_id{TEX_U_MAT_ID, res_x, res_y, false, false},
                   m_tex_fog_dist{TEX_U_FOG_DIST, res_x, res_y, false, false},
                   m_tex_vol_comp{TEX_U_VOL_COMP, res_x / 2, res_y / 2, false, true},
-                  m_tex_rnd_offset{TEX_U_RND_OFF, res_x / 2, res_y / 2, false, false} {
+                  m_tex_rnd_offset{TEX_U_RND_OFF, res_x / 2, res_y / 2, false, false},
+                  m_tex_vpl_contrib{TEX_U_VPL_CONT, res_x, res_y, false, false},
+                  m_tex_moments{TEX_U_MOMENTS, res_x, res_y, false, false},
+                  m_tex_history{TEX_U_HISTORY, res_x, res_y, false, false},
+                  m_tex_direct{TEX_U_DIRECT, res_x, res_y, false, false},
+                  m_tex_display{TEX_U_DISPLAY, res_x, res_y, false, false},
+                  m_gpu_prof{gpu_pass_names} {
     // Generate a Halton sequence for 30 frames with (up to) 24 samples per frame
     CONSTEXPR GLuint seq_sz{MAX_FRAMES * MAX_VOL_SAMP};
     GLfloat hal_seq[seq_sz];
@@ -40,12 +54,19 @@ DeferredRenderer::DeferredRenderer(const int res_x, const int res_y):
     loadShaders();
     // Manage the following uniforms automatically
     m_uni_mngr_surf.setManagedUniforms(m_sp_shade_surface, {"gi_enabled", "clamp_rsq",
-                                                            "frame_id", "n_vpls", "ext_k",
-                                                            "sca_albedo", "tri_buf_idx"});
+                                                            "frame_id", "ext_k", "sca_albedo",
+                                                            "tri_buf_idx", "interleaved",
+                                                            "keep_history"});
     m_uni_mngr_vol.setManagedUniforms(m_sp_shade_volume, {"gi_enabled", "clamp_rsq", "transm_opt",
                                                           "frame_id", "n_vpls", "sca_k", "ext_k",
                                                           "sca_albedo", "tri_buf_idx"});
-    m_uni_mngr_combine.setManagedUniforms(m_sp_combine, {"exposure", "frame_id", "ext_k"});
+    m_uni_mngr_combine.setManagedUniforms(m_sp_combine, {"exposure", "frame_id", "ext_k",
+                                                         "keep_history"});
+    m_uni_mngr_cull.setManagedUniforms(m_sp_cull_vpls, {"n_vpls", "tri_buf_idx",
+                                                        "sca_albedo", "exposure", "frame_id"});
+    m_uni_mngr_ilv.setManagedUniforms(m_sp_interleave, {"frame_id"});
+    m_uni_mngr_transm.setManagedUniforms(m_sp_ppl_transm, {"ppl_w_pos"});
+    m_uni_mngr_conv.setManagedUniforms(m_sp_converge, {"exposure"});
     // Create a screen space quad
     CONSTEXPR float ss_quad_pos[] = {-1.0f, -1.0f, 0.0f,    // Bottom left
                                       1.0f, -1.0f, 0.0f,    // Bottom right
@@ -58,9 +79,25 @@ DeferredRenderer::DeferredRenderer(const int res_x, const int res_y):
                          0, false, 0, gl::READ_WRITE, gl::RGBA32F);
     gl::BindImageTexture(IMG_U_FOG_DIST, m_tex_fog_dist.id(),
                          0, false, 0, gl::READ_WRITE, gl::RG32F);
+    gl::BindImageTexture(IMG_U_VPL_CONT, m_tex_vpl_contrib.id(),
+                         0, false, 0, gl::READ_WRITE, gl::RGBA32F);
+    gl::BindImageTexture(IMG_U_MOMENTS, m_tex_moments.id(),
+                         0, false, 0, gl::READ_WRITE, gl::RGBA32F);
+    gl::BindImageTexture(IMG_U_HISTORY, m_tex_history.id(),
+                         0, false, 0, gl::READ_WRITE, gl::RGBA32F);
+    gl::BindImageTexture(IMG_U_DIRECT, m_tex_direct.id(),
+                         0, false, 0, gl::READ_WRITE, gl::RGBA32F);
+    gl::BindImageTexture(IMG_U_DISPLAY, m_tex_display.id(),
+                         0, false, 0, gl::WRITE_ONLY, gl::RGBA16F);
     // Generate framebuffers
     generateDeferredFBO();
     generateVolumeFBO();
+    generateDisplayFBO();
+    // Allocate storage for per-tile VPL lists and convergence flags
+    generateTileVPLBuffer();
+    generateTileConvBuffer();
+    // Allocate the PPL transmittance volume
+    generatePplDensTex();
     // Fill the texture with random numbers
     fillRandOffsetTex();
 }
@@ -83,10 +120,24 @@ void DeferredRenderer::loadShaders() {
     m_sp_shade_volume.loadShader("Source\\Shaders\\Shade.vert");
     m_sp_shade_volume.loadShader("Source\\Shaders\\Volume.frag");
     m_sp_shade_volume.link();
-    // Load shaders which combine the results of surface and volume shading
-    m_sp_combine.loadShader("Source\\Shaders\\Shade.vert");
-    m_sp_combine.loadShader("Source\\Shaders\\Combine.frag");
+    // Load the shader which combines the results of surface and volume shading
+    m_sp_combine.loadShader("Source\\Shaders\\Combine.comp");
     m_sp_combine.link();
+    // Load the shader which preintegrates fog density
+    m_sp_pi_dens.loadShader("Source\\Shaders\\Preintegrate.comp");
+    m_sp_pi_dens.link();
+    // Load the shader which culls VPLs for each screen tile
+    m_sp_cull_vpls.loadShader("Source\\Shaders\\CullVPLs.comp");
+    m_sp_cull_vpls.link();
+    // Load the shader which filters interleaved VPL contribution
+    m_sp_interleave.loadShader("Source\\Shaders\\Interleave.comp");
+    m_sp_interleave.link();
+    // Load the shader which updates the PPL transmittance volume
+    m_sp_ppl_transm.loadShader("Source\\Shaders\\Transmittance.comp");
+    m_sp_ppl_transm.link();
+    // Load the shader which determines which tiles have converged
+    m_sp_converge.loadShader("Source\\Shaders\\Convergence.comp");
+    m_sp_converge.link();
 }
 
 void DeferredRenderer::generateDeferredFBO() {
@@ -131,6 +182,67 @@ void DeferredRenderer::generateVolumeFBO() {
     }
 }
 
+void DeferredRenderer::generateDisplayFBO() {
+    // Generate and bind the FBO
+    gl::GenFramebuffers(1, &m_disp_fbo_handle);
+    gl::BindFramebuffer(gl::READ_FRAMEBUFFER, m_disp_fbo_handle);
+    // Attach the texture to the framebuffer
+    gl::FramebufferTexture2D(gl::READ_FRAMEBUFFER, gl::COLOR_ATTACHMENT0, gl::TEXTURE_2D,
+                             m_tex_display.id(), 0);
+    // Specify the buffer to read from
+    gl::ReadBuffer(gl::COLOR_ATTACHMENT0);
+    // Verify the framebuffer
+    const GLenum result{gl::CheckFramebufferStatus(gl::READ_FRAMEBUFFER)};
+    if (gl::FRAMEBUFFER_COMPLETE != result) {
+        printError("Framebuffer is incomplete.");
+        TERMINATE();
+    }
+}
+
+void DeferredRenderer::generateTileVPLBuffer() {
+    assert(0 == m_res_x % TILE_SZ && 0 == m_res_y % TILE_SZ);
+    const GLsizeiptr n_tiles{(m_res_x / TILE_SZ) * (m_res_y / TILE_SZ)};
+    // Each list consists of the number of VPLs followed by their indices
+    gl::GenBuffers(1, &m_tile_vpl_handle);
+    gl::BindBuffer(gl::SHADER_STORAGE_BUFFER, m_tile_vpl_handle);
+    gl::BufferData(gl::SHADER_STORAGE_BUFFER, n_tiles * (MAX_N_VPLS + 1) * sizeof(GLuint),
+                   nullptr, gl::DYNAMIC_COPY);
+    gl::BindBufferBase(gl::SHADER_STORAGE_BUFFER, SB_TILE_VPLS, m_tile_vpl_handle);
+}
+
+void DeferredRenderer::generateTileConvBuffer() {
+    const GLsizeiptr n_tiles{(m_res_x / TILE_SZ) * (m_res_y / TILE_SZ)};
+    gl::GenBuffers(1, &m_tile_conv_handle);
+    gl::BindBuffer(gl::SHADER_STORAGE_BUFFER, m_tile_conv_handle);
+    gl::BufferData(gl::SHADER_STORAGE_BUFFER, n_tiles * sizeof(GLuint),
+                   nullptr, gl::DYNAMIC_COPY);
+    // No tile has converged yet
+    gl::ClearBufferData(gl::SHADER_STORAGE_BUFFER, gl::R32UI, gl::RED_INTEGER,
+                        gl::UNSIGNED_INT, nullptr);
+    gl::BindBufferBase(gl::SHADER_STORAGE_BUFFER, SB_TILE_CONV, m_tile_conv_handle);
+}
+
+void DeferredRenderer::generatePplDensTex() {
+    static_assert(0 == TRANSM_RES % TRANSM_GRP_SZ, "Invalid work group size.");
+    gl::ActiveTexture(gl::TEXTURE0 + TEX_U_PPL_DENS);
+    // Allocate texture storage
+    gl::GenTextures(1, &m_ppl_dens_handle);
+    gl::BindTexture(gl::TEXTURE_3D, m_ppl_dens_handle);
+    gl::TexStorage3D(gl::TEXTURE_3D, 1, gl::R32F, TRANSM_RES, TRANSM_RES, TRANSM_RES);
+    // Use trilinear texture filtering
+    gl::TexParameteri(gl::TEXTURE_3D, gl::TEXTURE_MAG_FILTER, gl::LINEAR);
+    gl::TexParameteri(gl::TEXTURE_3D, gl::TEXTURE_MIN_FILTER, gl::LINEAR);
+    // Use edge-clamping for all 3 dimensions
+    gl::TexParameteri(gl::TEXTURE_3D, gl::TEXTURE_WRAP_S, gl::CLAMP_TO_EDGE);
+    gl::TexParameteri(gl::TEXTURE_3D, gl::TEXTURE_WRAP_T, gl::CLAMP_TO_EDGE);
+    gl::TexParameteri(gl::TEXTURE_3D, gl::TEXTURE_WRAP_R, gl::CLAMP_TO_EDGE);
+    // There is no fog until it is set up; the density is zero
+    gl::ClearTexImage(m_ppl_dens_handle, 0, gl::RED, gl::FLOAT, nullptr);
+    // Bind all layers to the image unit for writing by the compute shader
+    gl::BindImageTexture(IMG_U_PPL_DENS, m_ppl_dens_handle,
+                         0, true, 0, gl::WRITE_ONLY, gl::R32F);
+}
+
 void DeferredRenderer::fillRandOffsetTex() const {
     // It is a subsampled, half-resolution texture
     const int n_elems{m_res_x / 2 * m_res_y / 2};
@@ -156,13 +268,29 @@ DeferredRenderer::DeferredRenderer(DeferredRenderer&& dr): settings(dr.settings)
                   m_sp_shade_surface{std::move(dr.m_sp_shade_surface)},
                   m_sp_shade_volume{std::move(dr.m_sp_shade_volume)},
                   m_sp_combine{std::move(dr.m_sp_combine)},
+                  m_sp_pi_dens{std::move(dr.m_sp_pi_dens)},
+                  m_sp_cull_vpls{std::move(dr.m_sp_cull_vpls)},
+                  m_sp_interleave{std::move(dr.m_sp_interleave)},
+                  m_sp_ppl_transm{std::move(dr.m_sp_ppl_transm)},
+                  m_sp_converge{std::move(dr.m_sp_converge)},
                   m_hal_tbo{std::move(dr.m_hal_tbo)},
                   m_uni_mngr_surf{std::move(dr.m_uni_mngr_surf)},
                   m_uni_mngr_vol{std::move(dr.m_uni_mngr_vol)},
                   m_uni_mngr_combine{std::move(dr.m_uni_mngr_combine)},
+                  m_uni_mngr_cull{std::move(dr.m_uni_mngr_cull)},
+                  m_uni_mngr_ilv{std::move(dr.m_uni_mngr_ilv)},
+                  m_uni_mngr_transm{std::move(dr.m_uni_mngr_transm)},
+                  m_uni_mngr_conv{std::move(dr.m_uni_mngr_conv)},
                   m_ppl_OSM{std::move(dr.m_ppl_OSM)}, m_vpl_OSM{std::move(dr.m_vpl_OSM)},
                   m_defer_fbo_handle{dr.m_defer_fbo_handle},
                   m_vol_fbo_handle{dr.m_vol_fbo_handle},
+                  m_disp_fbo_handle{dr.m_disp_fbo_handle},
+                  m_tile_vpl_handle{dr.m_tile_vpl_handle},
+                  m_tile_conv_handle{dr.m_tile_conv_handle},
+                  m_ppl_dens_handle{dr.m_ppl_dens_handle},
+                  m_ppl_dens_w_pos{dr.m_ppl_dens_w_pos},
+                  m_is_fog_ready{dr.m_is_fog_ready},
+                  m_is_transm_valid{dr.m_is_transm_valid},
                   m_ss_quad_va{std::move(dr.m_ss_quad_va)},
                   m_tex_depth{std::move(dr.m_tex_depth)},
                   m_tex_accum{std::move(m_tex_accum)},
@@ -171,7 +299,13 @@ DeferredRenderer::DeferredRenderer(DeferredRenderer&& dr): settings(dr.settings)
                   m_tex_mat_id{std::move(dr.m_tex_mat_id)},
                   m_tex_fog_dist{std::move(dr.m_tex_fog_dist)},
                   m_tex_vol_comp{std::move(dr.m_tex_vol_comp)},
-                  m_tex_rnd_offset{std::move(dr.m_tex_rnd_offset)} {
+                  m_tex_rnd_offset{std::move(dr.m_tex_rnd_offset)},
+                  m_tex_vpl_contrib{std::move(dr.m_tex_vpl_contrib)},
+                  m_tex_moments{std::move(dr.m_tex_moments)},
+                  m_tex_history{std::move(dr.m_tex_history)},
+                  m_tex_direct{std::move(dr.m_tex_direct)},
+                  m_tex_display{std::move(dr.m_tex_display)},
+                  m_gpu_prof{std::move(dr.m_gpu_prof)} {
     // Mark as moved
     dr.m_defer_fbo_handle = 0;
 }
@@ -179,6 +313,10 @@ DeferredRenderer::DeferredRenderer(DeferredRenderer&& dr): settings(dr.settings)
 DeferredRenderer& DeferredRenderer::operator=(DeferredRenderer&& dr) {
     assert(this != &dr);
     // Free memory
+    gl::DeleteTextures(1, &m_ppl_dens_handle);
+    gl::DeleteBuffers(1, &m_tile_conv_handle);
+    gl::DeleteBuffers(1, &m_tile_vpl_handle);
+    gl::DeleteFramebuffers(1, &m_disp_fbo_handle);
     gl::DeleteFramebuffers(1, &m_vol_fbo_handle);
     gl::DeleteFramebuffers(1, &m_defer_fbo_handle);
     // Now copy the data
@@ -192,6 +330,10 @@ DeferredRenderer::~DeferredRenderer() {
     // Check if it was moved
     if (m_defer_fbo_handle) {
         gl::DeleteFramebuffers(1, &m_defer_fbo_handle);
+        gl::DeleteFramebuffers(1, &m_disp_fbo_handle);
+        gl::DeleteBuffers(1, &m_tile_vpl_handle);
+        gl::DeleteBuffers(1, &m_tile_conv_handle);
+        gl::DeleteTextures(1, &m_ppl_dens_handle);
     }
 }
 
@@ -211,14 +353,45 @@ const GLSLProgram& DeferredRenderer::combineSP() const {
     return m_sp_combine;
 }
 
+const GLSLProgram& DeferredRenderer::piDensitySP() const {
+    return m_sp_pi_dens;
+}
+
+const GLSLProgram& DeferredRenderer::cullVPLsSP() const {
+    return m_sp_cull_vpls;
+}
+
+const GLSLProgram& DeferredRenderer::interleaveSP() const {
+    return m_sp_interleave;
+}
+
+const GLSLProgram& DeferredRenderer::pplTransmSP() const {
+    return m_sp_ppl_transm;
+}
+
+const GLSLProgram& DeferredRenderer::convergenceSP() const {
+    return m_sp_converge;
+}
+
+void DeferredRenderer::invalidatePplTransm() {
+    m_is_fog_ready    = true;
+    m_is_transm_valid = false;
+}
+
+const GLTex2D_4x32F& DeferredRenderer::accumBuffer() const {
+    return m_tex_accum;
+}
+
 void DeferredRenderer::updateLights(const Scene& scene, const vec3& target,
                                     LightArray<PPL>& ppls, LightArray<VPL>& vpls) {
+    TRACE_ZONE("Light update");
     // Update the primary light
     ppls.clear();
     ppls.addLight(PPL{settings.ppl_w_pos, PRIM_PL_INTENS});
     const auto& prim_pl = ppls[0];
-    // Update VPLs
-    if (settings.gi_enabled) {
+    updatePplTransm(prim_pl.wPos());
+    // Update VPLs (once the k-d tree has been built)
+    if (settings.gi_enabled && scene.isTraceable()) {
         const vec3 shoot_dir{normalize(target - prim_pl.wPos())};
         rt::PhotonTracer::trace(scene, prim_pl, shoot_dir, settings.max_num_vpls, vpls);
         // Disable GI on VPL tracing failure
@@ -226,6 +399,22 @@ void DeferredRenderer::updateLights(const Scene& scene, const vec3& target,
     }
 }
 
+void DeferredRenderer::updatePplTransm(const vec3& ppl_w_pos) {
+    // The volume only depends on the light position and the fog density
+    if (!m_is_fog_ready || (m_is_transm_valid && ppl_w_pos == m_ppl_dens_w_pos)) return;
+    m_sp_ppl_transm.use();
+    m_uni_mngr_transm.setUniformValues(ppl_w_pos);
+    // Launch a work group per block of voxels
+    CONSTEXPR GLuint n_groups{TRANSM_RES / TRANSM_GRP_SZ};
+    m_gpu_prof.begin(GPU_PASS_PPL_TRANSM);
+    gl::DispatchCompute(n_groups, n_groups, n_groups);
+    m_gpu_prof.end(GPU_PASS_PPL_TRANSM);
+    // Make the results visible to the shading passes
+    gl::MemoryBarrier(gl::TEXTURE_FETCH_BARRIER_BIT);
+    m_ppl_dens_w_pos  = ppl_w_pos;
+    m_is_transm_valid = true;
+}
+
 void DeferredRenderer::generateShadowMaps(const Scene& scene, const mat4& model_mat,
                                           const LightArray<PPL>& ppls,
                                           const LightArray<VPL>& vpls) const {
@@ -236,8 +425,14 @@ void DeferredRenderer::generateShadowMaps(const Scene& scene, const mat4& model_
     gl::Enable(gl::POLYGON_OFFSET_FILL);
     gl::PolygonOffset(1.1f, 4.0f);
     // Render
+    m_gpu_prof.begin(GPU_PASS_PPL_SM);
     m_ppl_OSM.generate(scene, ppls, model_mat);
-    if (settings.gi_enabled) m_vpl_OSM.generate(scene, vpls, model_mat);
+    m_gpu_prof.end(GPU_PASS_PPL_SM);
+    if (settings.gi_enabled) {
+        m_gpu_prof.begin(GPU_PASS_VPL_SM);
+        m_vpl_OSM.generate(scene, vpls, model_mat);
+        m_gpu_prof.end(GPU_PASS_VPL_SM);
+    }
     // Disable depth offsetting again
     gl::Disable(gl::POLYGON_OFFSET_FILL);
 }
@@ -252,26 +447,63 @@ void DeferredRenderer::generateGBuffer(const Scene& scene) const {
     // Install the shader program
     m_sp_gbuf.use();
     // Render
+    m_gpu_prof.begin(GPU_PASS_GBUF);
     scene.render();
+    m_gpu_prof.end(GPU_PASS_GBUF);
+}
+
+void DeferredRenderer::preintegrateDensity() const {
+    m_sp_pi_dens.use();
+    // Launch a work group per packet
+    m_gpu_prof.begin(GPU_PASS_PI_DENS);
+    gl::DispatchCompute(m_res_x / PACKET_SZ, m_res_y / PACKET_SZ, 1);
+    m_gpu_prof.end(GPU_PASS_PI_DENS);
+    // Make the results visible to the shading passes
+    gl::MemoryBarrier(gl::TEXTURE_FETCH_BARRIER_BIT);
 }
 
 void DeferredRenderer::shade(const int tri_buf_idx) const {
+    if (settings.gi_enabled && settings.frame_num < MAX_FRAMES) {
+        /* Cull VPLs for each screen tile */
+        m_sp_cull_vpls.use();
+        m_uni_mngr_cull.setUniformValues(settings.max_num_vpls, tri_buf_idx,
+                                         settings.sca_k / (settings.abs_k + settings.sca_k),
+                                         settings.exposure, settings.frame_num);
+        // Launch a work group per tile (converged tiles terminate immediately)
+        m_gpu_prof.begin(GPU_PASS_VPL_CULL);
+        gl::DispatchCompute(m_res_x / TILE_SZ, m_res_y / TILE_SZ, 1);
+        m_gpu_prof.end(GPU_PASS_VPL_CULL);
+        // Make the lists visible to surface shading
+        gl::MemoryBarrier(gl::SHADER_STORAGE_BARRIER_BIT);
+    }
     // Disable depth testing
     gl::Disable(gl::DEPTH_TEST);
     /* Perform surface shading */
     m_sp_shade_surface.use();
     // Set dynamic uniforms
     m_uni_mngr_surf.setUniformValues(settings.gi_enabled, settings.clamp_r_sq,
-                                     settings.frame_num, settings.max_num_vpls,
-                                     settings.abs_k + settings.sca_k,
+                                     settings.frame_num, settings.abs_k + settings.sca_k,
                                      settings.sca_k / (settings.abs_k + settings.sca_k),
-                                     tri_buf_idx);
+                                     tri_buf_idx, settings.interleaved, settings.keep_history);
     // Bind and clear the display framebuffer
     gl::BindFramebuffer(gl::FRAMEBUFFER, DEFAULT_FBO);
     gl::Clear(gl::COLOR_BUFFER_BIT);
     // Render surfaces at the full resolution
     gl::Viewport(0, 0, m_res_x, m_res_y);
+    m_gpu_prof.begin(GPU_PASS_SURFACE);
     m_ss_quad_va.draw(gl::TRIANGLE_STRIP);
+    m_gpu_prof.end(GPU_PASS_SURFACE);
+    if (settings.gi_enabled && settings.interleaved && settings.frame_num < MAX_FRAMES) {
+        /* Filter interleaved VPL contribution, and add it to the accumulation buffer */
+        gl::MemoryBarrier(gl::SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        m_sp_interleave.use();
+        m_uni_mngr_ilv.setUniformValues(settings.frame_num);
+        m_gpu_prof.begin(GPU_PASS_VPL_FILTER);
+        gl::DispatchCompute(m_res_x / TILE_SZ, m_res_y / TILE_SZ, 1);
+        m_gpu_prof.end(GPU_PASS_VPL_FILTER);
+        // Make the results visible to the combination pass
+        gl::MemoryBarrier(gl::SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
     // Check if there is fog to render
     if (settings.abs_k + settings.sca_k > 0.0f) {
         /* Perform volume shading */
@@ -287,18 +519,52 @@ void DeferredRenderer::shade(const int tri_buf_idx) const {
         gl::Clear(gl::COLOR_BUFFER_BIT);
         // Render fog at the quarter of the full resolution
         gl::Viewport(0, 0, m_res_x / 2, m_res_y / 2);
+        m_gpu_prof.begin(GPU_PASS_VOLUME);
         m_ss_quad_va.draw(gl::TRIANGLE_STRIP);
+        m_gpu_prof.end(GPU_PASS_VOLUME);
     }
-    /* Combine surface and volume shading results */
+    /* Combine surface and volume shading results, and perform tone mapping */
+    // Make the image stores of the surface pass visible
+    gl::MemoryBarrier(gl::SHADER_IMAGE_ACCESS_BARRIER_BIT);
     m_sp_combine.use();
     m_uni_mngr_combine.setUniformValues(settings.exposure, settings.frame_num,
-                                        settings.abs_k + settings.sca_k);
-    // Bind and clear the display framebuffer
-    gl::BindFramebuffer(gl::FRAMEBUFFER, DEFAULT_FBO);
-    gl::Clear(gl::COLOR_BUFFER_BIT);
-    // Create full resolution screen output
-    gl::Viewport(0, 0, m_res_x, m_res_y);
-    m_ss_quad_va.draw(gl::TRIANGLE_STRIP);
+                                        settings.abs_k + settings.sca_k, settings.keep_history);
+    // Launch a work group per tile; each one filters its neighbourhood in shared memory
+    m_gpu_prof.begin(GPU_PASS_COMBINE);
+    gl::DispatchCompute(m_res_x / TILE_SZ, m_res_y / TILE_SZ, 1);
+    m_gpu_prof.end(GPU_PASS_COMBINE);
+    // Copy the tone mapped image to the display framebuffer
+    gl::MemoryBarrier(gl::FRAMEBUFFER_BARRIER_BIT);
+    gl::BindFramebuffer(gl::READ_FRAMEBUFFER, m_disp_fbo_handle);
+    gl::BindFramebuffer(gl::DRAW_FRAMEBUFFER, DEFAULT_FBO);
+    gl::BlitFramebuffer(0, 0, m_res_x, m_res_y, 0, 0, m_res_x, m_res_y,
+                        gl::COLOR_BUFFER_BIT, gl::NEAREST);
+    if (settings.frame_num < MAX_FRAMES) {
+        /* Determine which tiles have converged, so that the next frame skips them */
+        gl::MemoryBarrier(gl::SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        m_sp_converge.use();
+        m_uni_mngr_conv.setUniformValues(settings.exposure);
+        // Launch a work group per tile
+        m_gpu_prof.begin(GPU_PASS_CONVERGE);
+        gl::DispatchCompute(m_res_x / TILE_SZ, m_res_y / TILE_SZ, 1);
+        m_gpu_prof.end(GPU_PASS_CONVERGE);
+        // Make the flags visible to the shading passes
+        gl::MemoryBarrier(gl::SHADER_STORAGE_BARRIER_BIT);
+    }
     // Enable depth testing again
     gl::Enable(gl::DEPTH_TEST);
+    // Start timing the next frame
+    m_gpu_prof.nextFrame();
+}
+
+GLGPUProfiler<N_GPU_PASSES>::Stats DeferredRenderer::computeGPUStats(const GPUPass pass) const {
+    return m_gpu_prof.computeStats(pass);
+}
+
+void DeferredRenderer::printGPUStats() const {
+    printInfo("%-12s %6s %6s %6s", "GPU (ms)", "min", "mean", "p99");
+    for (int p = 0; p < N_GPU_PASSES; ++p) {
+        const auto stats = m_gpu_prof.computeStats(p);
+        printInfo("%-12s %6.2f %6.2f %6.2f", m_gpu_prof.name(p), stats.min, stats.mean, stats.p99);
+    }
 }
@@ -6,6 +6,7 @@
 #include "..\GL\GLTextureBuffer.h"
 #include "..\GL\GLUniformManager.h"
 #include "..\GL\GLTexture2D.h"
+#include "..\GL\GLGPUProfiler.h"
 #include "..\VPL\OmniShadowMap.h"
 
 class PPL;
@@ -20,7 +21,10 @@ struct RenderSettings {
     RULE_OF_ZERO(RenderSettings);
     bool      gi_enabled;       // Indicates whether Global Illumination is enabled
     bool      clamp_r_sq;       // Indicates whether radius squared of VPLs is being clamped
-    bool	  transm_opt;       // If set to false, shadow rays use ray marching for transmittance
+    bool	  transm_opt;       // If set to false, VPL shadow rays use ray marching for transm.
+    bool      interleaved;      // Indicates whether VPLs are interleaved across pixel blocks
+    bool      temporal;         // Indicates whether history is kept when the light moves
+    bool      keep_history;     // Indicates whether the current frame reuses the history
     int       exposure;         // Exposure time; higher values increase brightness
     int       frame_num;        // Current frame number
     uint      curr_time_ms;     // Number of milliseconds since timer reset (curr. frame)
@@ -31,6 +35,22 @@ struct RenderSettings {
     glm::vec3 ppl_w_pos;        // Primary point light's position in world coordinates
 };
 
+/* Rendering passes timed on the GPU */
+enum GPUPass {
+    GPU_PASS_PPL_TRANSM,                    // Primary light transmittance volume update
+    GPU_PASS_PPL_SM,                        // Primary light shadow maps
+    GPU_PASS_VPL_SM,                        // VPL shadow maps
+    GPU_PASS_GBUF,                          // G-buffer generation
+    GPU_PASS_PI_DENS,                       // Fog density preintegration (GPU path only)
+    GPU_PASS_VPL_CULL,                      // Tiled VPL culling
+    GPU_PASS_SURFACE,                       // Surface shading
+    GPU_PASS_VPL_FILTER,                    // Filtering of interleaved VPL contribution
+    GPU_PASS_VOLUME,                        // Volume shading
+    GPU_PASS_COMBINE,                       // Combination of surface and volume shading
+    GPU_PASS_CONVERGE,                      // Per-tile convergence test
+    N_GPU_PASSES
+};
+
 /* Implements OpenGL deferred renderer functionality */
 class DeferredRenderer {
 public:
@@ -44,6 +64,20 @@ public:
     const GLSLProgram& volumeSP() const;
     // Returns the shader program which combines surf. & vol. shading
     const GLSLProgram& combineSP() const;
+    // Returns the compute shader program which preintegrates fog density
+    const GLSLProgram& piDensitySP() const;
+    // Returns the compute shader program which culls VPLs for each screen tile
+    const GLSLProgram& cullVPLsSP() const;
+    // Returns the compute shader program which filters interleaved VPL contribution
+    const GLSLProgram& interleaveSP() const;
+    // Returns the compute shader program which updates the PPL transmittance volume
+    const GLSLProgram& pplTransmSP() const;
+    // Returns the compute shader program which determines which tiles have converged
+    const GLSLProgram& convergenceSP() const;
+    // Forces an update of the PPL transmittance volume; call once the fog has been set up
+    void invalidatePplTransm();
+    // Returns the accumulation buffer (sum of the radiance of accumulated frames)
+    const GLTex2D_4x32F& accumBuffer() const;
     // Updates the primary lights and the VPLs (using the settings)
     void updateLights(const Scene& scene, const glm::vec3& target,
                       LightArray<PPL>& ppls, LightArray<VPL>& vpls);
@@ -53,8 +87,14 @@ public:
                             const LightArray<VPL>& vpls) const;
     // Generates a G-buffer with positions, normals and material ids
     void generateGBuffer(const Scene& scene) const;
-    // Performs shading
+    // Preintegrates fog density along primary rays on the GPU (requires a G-buffer)
+    void preintegrateDensity() const;
+    // Performs shading; this is the last pass of the frame
     void shade(const int tri_buf_idx) const;
+    // Returns rolling GPU timing statistics of the specified pass (in milliseconds)
+    GLGPUProfiler<N_GPU_PASSES>::Stats computeGPUStats(const GPUPass pass) const;
+    // Prints GPU timing statistics of all passes
+    void printGPUStats() const;
     // Public data members
     RenderSettings settings;                // Rendering parameters updated by InputHandler
 private:
@@ -64,6 +104,16 @@ private:
     void generateDeferredFBO();
     // Generates the subsampled volume contribution framebuffer object
     void generateVolumeFBO();
+    // Generates the framebuffer object used to copy the tone mapped image to the display
+    void generateDisplayFBO();
+    // Generates the shader storage buffer with per-tile VPL lists
+    void generateTileVPLBuffer();
+    // Generates the shader storage buffer with per-tile convergence flags
+    void generateTileConvBuffer();
+    // Generates the 3D texture with fog density integrated towards the primary light
+    void generatePplDensTex();
+    // Updates the PPL transmittance volume for the specified light position (if out of date)
+    void updatePplTransm(const glm::vec3& ppl_w_pos);
     // Fills the random ray offset texture
     void fillRandOffsetTex() const;
     // Private data members
@@ -73,21 +123,44 @@ private:
     GLSLProgram         m_sp_shade_surface; // GLSL program which performs surface shading
     GLSLProgram         m_sp_shade_volume;  // GLSL program which performs volume shading
     GLSLProgram         m_sp_combine;       // GLSL program which combines surf. & vol. shading
+    GLSLProgram         m_sp_pi_dens;       // GLSL program which preintegrates fog density
+    GLSLProgram         m_sp_cull_vpls;     // GLSL program which culls VPLs for each tile
+    GLSLProgram         m_sp_interleave;    // GLSL program which filters interleaved VPL contrib.
+    GLSLProgram         m_sp_ppl_transm;    // GLSL program which updates PPL transmittance volume
+    GLSLProgram         m_sp_converge;      // GLSL program which finds converged tiles
     GLTextureBuffer     m_hal_tbo;          // Halton sequence texture buffer object
-    GLUniformManager<7> m_uni_mngr_surf;    // OpenGL uniform manager for m_sp_shade_surface
+    GLUniformManager<8> m_uni_mngr_surf;    // OpenGL uniform manager for m_sp_shade_surface
     GLUniformManager<9> m_uni_mngr_vol;     // OpenGL uniform manager for m_sp_shade_volume
-    GLUniformManager<3> m_uni_mngr_combine; // OpenGL uniform manager for m_sp_combine
+    GLUniformManager<4> m_uni_mngr_combine; // OpenGL uniform manager for m_sp_combine
+    GLUniformManager<5> m_uni_mngr_cull;    // OpenGL uniform manager for m_sp_cull_vpls
+    GLUniformManager<1> m_uni_mngr_ilv;     // OpenGL uniform manager for m_sp_interleave
+    GLUniformManager<1> m_uni_mngr_transm;  // OpenGL uniform manager for m_sp_ppl_transm
+    GLUniformManager<1> m_uni_mngr_conv;    // OpenGL uniform manager for m_sp_converge
     OmniShadowMap       m_ppl_OSM;          // Omnidirectional shadow map for primary lights
     OmniShadowMap       m_vpl_OSM;          // Omnidirectional shadow map for VPLs
     GLuint              m_defer_fbo_handle; // Deferred framebuffer handle
     GLuint              m_vol_fbo_handle;   // Renders subsampled volume contribution
+    GLuint              m_disp_fbo_handle;  // Reads the tone mapped image for display
+    GLuint              m_tile_vpl_handle;  // Per-tile VPL lists (shader storage buffer)
+    GLuint              m_tile_conv_handle; // Per-tile convergence flags (shader storage buffer)
+    GLuint              m_ppl_dens_handle;  // Fog density integrated towards the primary light
+    glm::vec3           m_ppl_dens_w_pos;   // Primary light position used for integration
+    bool                m_is_fog_ready;     // Indicates whether there is fog to integrate
+    bool                m_is_transm_valid;  // Indicates whether the PPL transm. volume is valid
     GLVertArray         m_ss_quad_va;       // Vertex array with a screen space quad
     GLTex2D_Depth       m_tex_depth;        // Depth buffer texture
     GLTex2D_4x32F       m_tex_accum;        // Accumulation buffer image/texture
     GLTex2D_3x32F       m_tex_w_pos;        // World position texture
     GLTex2D_2x32F       m_tex_w_norm;       // Normal vector texture
-    GLTex2D_1x8UI       m_tex_mat_id;       // Material id texture
+    GLTex2D_1x16UI      m_tex_mat_id;       // Material id texture
     GLTex2D_2x32F       m_tex_fog_dist;     // Primary ray entry/exit distances for fog
     GLTex2D_3x32F       m_tex_vol_comp;     // Subsampled volume contribution (radiance)
     GLTex2D_1x32F       m_tex_rnd_offset;   // Primary (camera) rays' random offset texture
+    GLTex2D_4x32F       m_tex_vpl_contrib;  // Unfiltered (interleaved) VPL contribution
+    GLTex2D_4x32F       m_tex_moments;      // Luminance moments of the frames
+    GLTex2D_4x32F       m_tex_history;      // Mean indirect radiance and number of frames
+    GLTex2D_4x32F       m_tex_direct;       // Direct lighting of the last shaded frame
+    GLTex2D_4x16F       m_tex_display;      // Tone mapped image
+    // Passes are timed by const methods; timing does not affect rendering
+    mutable GLGPUProfiler<N_GPU_PASSES> m_gpu_prof;
 };
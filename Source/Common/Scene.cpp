@@ -1,165 +1,688 @@
 #include "Scene.h"
-#include <TinyOBJ\tiny_obj_loader.h>
-#include <GLM\gtx\normal.hpp>
+#include <chrono>
+#include <string>
+#include <GLM\geometric.hpp>
+#include <GLM\matrix.hpp>
+#include <GLM\common.hpp>
 #include "Constants.h"
+#include "ObjLoader.h"
+#include "MeshOptimizer.h"
+#include "MappedFile.h"
+#include "Random.h"
+#include "TraceLog.h"
 #include "..\RT\KdTree.hpp"
 #include "..\GL\GLPersistentBuffer.hpp"
 
 using glm::vec3;
 using glm::uvec3;
+using glm::mat3;
+using glm::mat4;
 using glm::normalize;
 
-CONSTEXPR GLsizei n_mesh_attr         = 2;              // Position, normal
-CONSTEXPR GLsizei mesh_attr_lengths[] = {3, 3};         // vec3, vec3
+// Position, normal; per instance: material index, object-to-world matrix (4 columns),
+// object-to-world normal transformation matrix (3 columns)
+CONSTEXPR GLsizei n_mesh_attr         = 10;
+CONSTEXPR GLsizei mesh_attr_lengths[] = {3, 3, 1, 4, 4, 4, 4, 3, 3, 3};
+CONSTEXPR float   CREASE_COS          = 0.5f;           // Cosine of the min. crease angle
+// Identifies the scene cache format; increment the version (last byte) after changing
+// the format, or anything affecting its contents (e.g. k-d tree construction parameters)
+CONSTEXPR uint64_t CACHE_MAGIC        = 0x4e43534c47494703ull; // "\x03GIGLSCN"
+CONSTEXPR float    WELD_POS_EPS       = 1e-5f;          // Relative position welding tolerance
+CONSTEXPR float    WELD_NRM_EPS       = 1e-3f;          // Normal welding tolerance
+CONSTEXPR uint     INIT_N_MATERIALS   = 64;             // Initial material table capacity
+CONSTEXPR uint     VERTEX_CACHE_SZ    = 16;             // Post-transform vertex cache size
+CONSTEXPR uint     LOD_REDUCTION      = 4;              // Triangle count ratio of adjacent LODs
+CONSTEXPR float    LOD_MAX_ERROR      = 0.05f;          // Max. relative error per LOD
 
-Scene::Scene(): m_geom_va{1, mesh_attr_lengths},
-                m_material_pbo{MAX_MATERIALS * sizeof(rt::PhongMaterial)},
+/* Header of the binary scene cache; followed by materials, object ranges, vertices,
+   normals, object-relative indices and the serialized k-d tree (in that order) */
+struct Scene::CacheHeader {
+    uint64_t magic;                     // Identifies the format and its version
+    uint64_t src_size;                  // Size of the source file in bytes
+    uint64_t src_time;                  // Time of the last write to the source file
+    uint64_t src_hash;                  // Hash of the contents of the source file
+    uint32_t n_objects;                 // Number of objects (and materials)
+    uint32_t n_verts;                   // Number of vertices (and normals)
+    uint32_t n_indices;                 // Number of indices
+    uint32_t kd_tree_sz;                // Size of the serialized k-d tree in bytes
+};
+
+/* Parsed mesh data; produced by a worker thread when loading asynchronously
+   Vertices, normals, indices and the k-d tree may point into the mapped cache file */
+struct Scene::MeshData {
+    std::string                    cache_file_name; // Name of the binary cache file
+    CacheHeader                    key;             // Identifies the version of the source file
+    std::unique_ptr<MappedFile>    cache;           // Mapped cache file (if up to date)
+    std::vector<rt::PhongMaterial> materials;       // Materials (one per object)
+    std::vector<ObjectRange>       ranges;          // Vertex and index ranges of objects
+    std::vector<vec3>              vertex_buf;      // Storage of vertices (unless cached)
+    std::vector<vec3>              normal_buf;      // Storage of normals (unless cached)
+    std::vector<uint>              index_buf;       // Storage of indices (unless cached)
+    const vec3*                    vertices;        // Vertices of the mesh
+    const vec3*                    normals;         // Normals of the mesh
+    const uint*                    indices;         // Object-relative indices
+    uint                           n_verts;         // Number of vertices (and normals)
+    uint                           n_indices;       // Number of indices
+    const char*                    kd_tree_data;    // Serialized k-d tree (if cached)
+};
+
+// Returns 'true' if the result of the asynchronous operation is available
+template <typename T>
+static inline bool isReady(const std::future<T>& future) {
+    return std::future_status::ready == future.wait_for(std::chrono::seconds{0});
+}
+
+// Returns the size of the cache (in bytes) described by the header
+static inline size_t cacheSize(const uint n_objects, const uint n_verts, const uint n_indices,
+                               const uint kd_tree_sz) {
+    return 4 * sizeof(uint64_t) + 4 * sizeof(uint32_t) +
+           n_objects * sizeof(rt::PhongMaterial) + n_objects * (3 + 2 * N_LODS) * sizeof(uint) +
+           2 * static_cast<size_t>(n_verts) * sizeof(vec3) +
+           static_cast<size_t>(n_indices) * sizeof(uint) + kd_tree_sz;
+}
+
+// Generates per-vertex normals by averaging area-weighted normals of adjacent triangles
+// Only triangles within the crease angle of each other are averaged: vertices on creases
+// are split (one copy per distinct normal), so the indices and positions are updated
+// Takes time linear in the size of the mesh (for a bounded vertex valence)
+static void generateNormals(std::vector<float>& positions, std::vector<uint>& indices,
+                            std::vector<float>& normals) {
+    const int n_verts{static_cast<int>(positions.size()) / 3};
+    const int n_indices{static_cast<int>(indices.size())};
+    const int n_tris{n_indices / 3};
+    auto vertex = [&positions](const uint i) {
+        return vec3{positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]};
+    };
+    // Compute face normals; their lengths are equal to twice the triangle areas
+    std::vector<vec3> face_normals(n_tris), unit_normals(n_tris);
+    #pragma omp parallel for
+    for (int t = 0; t < n_tris; ++t) {
+        const vec3 v0{vertex(indices[3 * t])};
+        const vec3 v1{vertex(indices[3 * t + 1])};
+        const vec3 v2{vertex(indices[3 * t + 2])};
+        face_normals[t] = glm::cross(v1 - v0, v2 - v0);
+        const float len{glm::length(face_normals[t])};
+        unit_normals[t] = (len > 0.0f) ? face_normals[t] / len : vec3{0.0f};
+    }
+    // Build vertex-to-corner adjacency in the compressed sparse row (CSR) format
+    std::vector<int> first_adj(n_verts + 1, 0);
+    for (int k = 0; k < n_indices; ++k) {
+        ++first_adj[indices[k] + 1];
+    }
+    for (int v = 0; v < n_verts; ++v) {
+        first_adj[v + 1] += first_adj[v];
+    }
+    std::vector<int> adj_corners(n_indices);
+    std::vector<int> next_adj(first_adj.begin(), first_adj.end() - 1);
+    for (int k = 0; k < n_indices; ++k) {
+        adj_corners[next_adj[indices[k]]++] = k;
+    }
+    // Accumulate area-weighted face normals of the triangles around each corner
+    // The adjacent triangles are visited in the same order for all corners of a vertex,
+    // so corners on the same side of a crease get bitwise identical normals
+    std::vector<vec3> corner_normals(n_indices);
+    #pragma omp parallel for
+    for (int k = 0; k < n_indices; ++k) {
+        const uint v{indices[k]};
+        const vec3 tri_normal{unit_normals[k / 3]};
+        vec3 sum{0.0f};
+        for (int a = first_adj[v]; a < first_adj[v + 1]; ++a) {
+            const int t{adj_corners[a] / 3};
+            if (glm::dot(tri_normal, unit_normals[t]) >= CREASE_COS) {
+                sum += face_normals[t];
+            }
+        }
+        const float len{glm::length(sum)};
+        // Degenerate triangles get an arbitrary normal
+        corner_normals[k] = (len > 0.0f) ? sum / len : vec3{0.0f, 0.0f, 1.0f};
+    }
+    // Create a vertex per distinct normal of each original vertex; corners processed
+    // earlier already refer to the new vertices; unreferenced vertices are removed
+    std::vector<float> new_positions;
+    new_positions.reserve(positions.size());
+    normals.clear();
+    normals.reserve(positions.size());
+    for (int v = 0; v < n_verts; ++v) {
+        for (int a = first_adj[v]; a < first_adj[v + 1]; ++a) {
+            const int  k{adj_corners[a]};
+            const vec3 normal{corner_normals[k]};
+            uint match{UINT_MAX};
+            for (int b = first_adj[v]; b < a; ++b) {
+                if (corner_normals[adj_corners[b]] == normal) {
+                    match = indices[adj_corners[b]];
+                    break;
+                }
+            }
+            if (UINT_MAX == match) {
+                match = static_cast<uint>(new_positions.size() / 3);
+                new_positions.insert(new_positions.end(), &positions[3 * v],
+                                     &positions[3 * v] + 3);
+                normals.insert(normals.end(), &normal.x, &normal.x + 3);
+            }
+            indices[k] = match;
+        }
+    }
+    positions.swap(new_positions);
+}
+
+Scene::Scene(): m_geom_va{n_mesh_attr, mesh_attr_lengths},
+                m_materials{INIT_N_MATERIALS, SB_MAT_ARR}, m_draw_cmd_buf{nullptr},
                 m_fog_vol{nullptr}, m_fog_enabled{false}, m_kd_tree{nullptr} {
-    m_material_pbo.bind(UB_MAT_ARR);
+    // Advance the per-instance attributes once per instance
+    for (GLuint i = 2; i < n_mesh_attr; ++i) {
+        m_geom_va.setDivisor(i, 1);
+    }
 }
 
+Scene::Mesh::Mesh(): first_obj{0}, n_objs{0}, first_vert{0}, ebo16{gl::UNSIGNED_SHORT},
+                     kd_tree{nullptr}, first_cmd{0}, n_cmds16{0}, n_cmds32{0},
+                     max_scale{1.0f} {}
+
 void Scene::loadObjects(const char* const file_name) {
+    addInstances(loadMesh(file_name), std::vector<mat4>(1, mat4{1.0f}));
+}
+
+void Scene::loadObjectsAsync(const char* const file_name) {
+    addInstances(loadMeshAsync(file_name), std::vector<mat4>(1, mat4{1.0f}));
+}
+
+uint Scene::loadMesh(const char* const file_name) {
+    assert(m_pending.empty());
+    m_meshes.emplace_back();
+    Mesh& mesh = m_meshes.back();
+    const auto parsed = parseMesh(file_name);
+    createMesh(*parsed, mesh);
+    mesh.kd_tree = buildKdTree(*parsed, mesh);
+    return static_cast<uint>(m_meshes.size()) - 1;
+}
+
+uint Scene::loadMeshAsync(const char* const file_name) {
+    // The mesh remains empty until its geometry is resident
+    m_meshes.emplace_back();
+    m_meshes.back().first_obj = static_cast<uint>(m_objects.size());
+    m_pending.emplace_back();
+    PendingLoad& load = m_pending.back();
+    load.mesh_id = static_cast<uint>(m_meshes.size()) - 1;
+    const std::string name{file_name};
+    load.parsed = std::async(std::launch::async, [name]() {
+        return parseMesh(name.c_str());
+    });
+    return load.mesh_id;
+}
+
+bool Scene::update() {
+    TRACE_ZONE("Scene update");
+    bool has_changed{false};
+    // Triangles access vertices of the scene during k-d tree construction,
+    // so new vertices may only be added while no trees are being built
+    bool is_building{false};
+    for (auto load = m_pending.begin(); load != m_pending.end(); ++load) {
+        is_building = is_building || load->kd_tree.valid();
+    }
+    for (auto load = m_pending.begin(); load != m_pending.end();) {
+        Mesh& mesh = m_meshes[load->mesh_id];
+        if (load->parsed.valid()) {
+            if (!is_building && isReady(load->parsed)) {
+                // Upload the geometry, and start rendering the mesh
+                load->data = load->parsed.get();
+                createMesh(*load->data, mesh);
+                updateInstanceData();
+                // Build the k-d tree in the background
+                const MeshData* const data{load->data.get()};
+                const Mesh* const     m{&mesh};
+                load->kd_tree = std::async(std::launch::async, [data, m]() {
+                    return buildKdTree(*data, *m);
+                });
+                is_building = true;
+                has_changed = true;
+            }
+            ++load;
+        } else if (isReady(load->kd_tree)) {
+            // Start raytracing the mesh
+            mesh.kd_tree = load->kd_tree.get();
+            traceInstances(mesh, 0);
+            load = m_pending.erase(load);
+            has_changed = true;
+        } else {
+            ++load;
+        }
+    }
+    return has_changed;
+}
+
+void Scene::finishLoading() {
+    while (!m_pending.empty()) {
+        for (auto load = m_pending.begin(); load != m_pending.end(); ++load) {
+            if (load->parsed.valid()) {
+                load->parsed.wait();
+            } else {
+                load->kd_tree.wait();
+            }
+        }
+        update();
+    }
+}
+
+bool Scene::isTraceable() const {
+    return nullptr != m_kd_tree;
+}
+
+std::shared_ptr<Scene::MeshData> Scene::parseMesh(const char* const file_name) {
+    TRACE_ZONE("Parse mesh");
+    const auto parsed = std::make_shared<MeshData>();
+    // Identify the version of the source file
+    {
+        const MappedFile src{file_name};
+        if (!src.isMapped()) {
+            printError("Failed to open object file %s.", file_name);
+            TERMINATE();
+        }
+        parsed->key = CacheHeader{CACHE_MAGIC, src.size(), src.lastWriteTime(), src.hash(),
+                                  0, 0, 0, 0};
+    }
+    // Try to bypass parsing and k-d tree construction
+    parsed->cache_file_name = std::string{file_name} + ".cache";
+    if (readCache(*parsed)) return parsed;
     // Copy path from filename
     const char* const last_backslash_pos{strrchr(file_name, '\\')};
-    const auto path_len = last_backslash_pos - file_name + 1;    // + 1 for '\\'
-    char* const path{new char[path_len + 1]};					 // + 1 for '\0'
-    strncpy(path, file_name, path_len);
-    path[path_len] = '\0';										// Null-terminating
-    std::vector<tinyobj::shape_t> shapes;
-    tinyobj::LoadObj(shapes, file_name, path);
-    if (shapes.empty()) {
+    const std::string path{file_name, last_backslash_pos + 1};    // + 1 for '\\'
+    // Load triangle meshes grouped (and sorted) by material
+    std::vector<ObjLoader::Group> groups;
+    if (!ObjLoader::load(file_name, path.c_str(), groups) || groups.empty()) {
         printError("Object file loading failed!");
         TERMINATE();
     }
-    // Sort shapes by material
-    auto cmp_shapes_by_material = [](const tinyobj::shape_t& lhs,
-                                     const tinyobj::shape_t& rhs) {
-        return lhs.material.name < rhs.material.name;
-    };
-    std::sort(shapes.begin(), shapes.end(), cmp_shapes_by_material);
-    // Process loaded shapes and transform them to objects
-    // Combine them by materials
-    uint global_vert_offset{0};
-    uint object_vert_offset{0};
-    Object* curr_object{nullptr};
-    uint    curr_mat_id{0};
-    const std::string* curr_mat_name{nullptr};
-    for (auto s = shapes.begin(); s != shapes.end(); ++s) {
-        const uint vert_count{static_cast<uint>(s->mesh.positions.size()) / 3};
-        if (s->mesh.normals.empty()) {
-            // Generate normals
-            for (uint i = 0; i < vert_count; ++i) {
-                uint indices[3];
-                for (uint k = 0, e = static_cast<uint>(s->mesh.indices.size()); k < e; ++k) {
-                    if (i == s->mesh.indices[k]) {
-                        const uint rem{k % 3};
-                        indices[rem] = s->mesh.indices[k];
-                        switch (rem) {
-                            case 0:
-                                indices[1] = s->mesh.indices[k + 1];
-                                indices[2] = s->mesh.indices[k + 2];
-                                break;
-                            case 1:
-                                indices[0] = s->mesh.indices[k - 1];
-                                indices[2] = s->mesh.indices[k + 1];
-                                break;
-                            case 2:
-                                indices[0] = s->mesh.indices[k - 2];
-                                indices[1] = s->mesh.indices[k - 1];
-                                break;
+    if (groups.size() > MAX_MATERIALS) {
+        printError("Too many materials: %u (max. %u)", static_cast<uint>(groups.size()),
+                   MAX_MATERIALS);
+        TERMINATE();
+    }
+    // Weld vertices and optimize the meshes for rasterization
+    const int n_groups{static_cast<int>(groups.size())};
+    std::vector<ObjectRange> lods(n_groups);
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < n_groups; ++i) {
+        ObjLoader::Group& g = groups[i];
+        MeshOptimizer::weldVertices(g.positions, g.normals, g.indices, WELD_POS_EPS,
+                                    WELD_NRM_EPS);
+        if (g.normals.empty()) {
+            // Generate normals; vertices on creases are split (after welding, which
+            // compares only positions in the absence of normals)
+            generateNormals(g.positions, g.indices, g.normals);
+        }
+        const uint n_verts{static_cast<uint>(g.positions.size() / 3)};
+        MeshOptimizer::optimizeVertexCache(g.indices, n_verts, VERTEX_CACHE_SZ);
+        MeshOptimizer::optimizeVertexFetch(g.positions, g.normals, g.indices);
+        // Generate coarser levels of detail, each from the previous one, and append them
+        lods[i].n_indices[0] = static_cast<uint>(g.indices.size());
+        lods[i].lod_error[0] = 0.0f;
+        size_t first_idx{0};
+        for (int l = 1; l < N_LODS; ++l) {
+            const uint n_prev{lods[i].n_indices[l - 1]};
+            const std::vector<uint> prev_lod(g.indices.begin() + first_idx,
+                                             g.indices.begin() + first_idx + n_prev);
+            std::vector<uint> lod;
+            const float error{MeshOptimizer::simplify(g.positions, prev_lod,
+                                                      n_prev / 3 / LOD_REDUCTION,
+                                                      LOD_MAX_ERROR, lod)};
+            MeshOptimizer::optimizeVertexCache(lod, static_cast<uint>(g.positions.size() / 3),
+                                               VERTEX_CACHE_SZ);
+            first_idx += n_prev;
+            lods[i].n_indices[l] = static_cast<uint>(lod.size());
+            lods[i].lod_error[l] = lods[i].lod_error[l - 1] + error;
+            g.indices.insert(g.indices.end(), lod.begin(), lod.end());
+        }
+    }
+    // Concatenate groups (one per material)
+    std::vector<vec3>& vertices = parsed->vertex_buf;
+    std::vector<vec3>& normals  = parsed->normal_buf;
+    std::vector<uint>& indices  = parsed->index_buf;
+    size_t n_verts{0}, n_indices{0};
+    for (auto g = groups.begin(); g != groups.end(); ++g) {
+        n_verts   += g->positions.size() / 3;
+        n_indices += g->indices.size();
+    }
+    vertices.reserve(n_verts);
+    normals.reserve(n_verts);
+    indices.reserve(n_indices);
+    parsed->materials.reserve(groups.size());
+    for (uint mat_id = 0, n = static_cast<uint>(groups.size()); mat_id < n; ++mat_id) {
+        const ObjLoader::Group& g = groups[mat_id];
+        // Set material properties
+        vec3 rho_d{g.material.diffuse[0], g.material.diffuse[1], g.material.diffuse[2]};
+        vec3 rho_s{g.material.specular[0], g.material.specular[1], g.material.specular[2]};
+        // Normalize s.t. rho_d + rho_s <= vec3(1.0f)
+        const vec3 sum{rho_d + rho_s};
+        if (sum.r > 1.0f || sum.g > 1.0f || sum.b > 1.0f) {
+            rho_d /= sum;
+            rho_s /= sum;
+        }
+        const vec3    k_d{rho_d * INV_PI};
+        const GLfloat n_s{g.material.shininess};
+        const vec3    k_s{rho_s * (n_s + 2.0f) * 0.5f * INV_PI};
+        const vec3    k_e{g.material.emission[0], g.material.emission[1],
+                          g.material.emission[2]};
+        // Store material coefficients
+        parsed->materials.push_back(rt::PhongMaterial{k_d, k_s, n_s, k_e});
+        // Store vertices and indices
+        ObjectRange range = lods[mat_id];
+        range.first_vert = static_cast<uint>(vertices.size());
+        range.n_verts    = static_cast<uint>(g.positions.size()) / 3;
+        range.first_idx  = static_cast<uint>(indices.size());
+        parsed->ranges.push_back(range);
+        for (size_t k = 0, e = g.positions.size(); k < e; k += 3) {
+            vertices.emplace_back(g.positions[k], g.positions[k + 1], g.positions[k + 2]);
+        }
+        for (size_t k = 0, e = g.normals.size(); k < e; k += 3) {
+            normals.emplace_back(g.normals[k], g.normals[k + 1], g.normals[k + 2]);
+        }
+        indices.insert(indices.end(), g.indices.begin(), g.indices.end());
+    }
+    groups.clear();
+    if (indices.empty()) {
+        printError("Object file %s contains no triangles!", file_name);
+        TERMINATE();
+    }
+    parsed->vertices  = vertices.data();
+    parsed->normals   = normals.data();
+    parsed->indices   = indices.data();
+    parsed->n_verts   = static_cast<uint>(vertices.size());
+    parsed->n_indices = static_cast<uint>(indices.size());
+    return parsed;
+}
+
+void Scene::createMesh(const MeshData& parsed, Mesh& mesh) {
+    mesh.first_obj  = static_cast<uint>(m_objects.size());
+    mesh.first_vert = static_cast<uint>(m_vertices.size());
+    for (auto m = parsed.materials.begin(); m != parsed.materials.end(); ++m) {
+        m_materials.add(*m);
+    }
+    m_vertices.insert(m_vertices.end(), parsed.vertices, parsed.vertices + parsed.n_verts);
+    m_normals.insert(m_normals.end(), parsed.normals, parsed.normals + parsed.n_verts);
+    createObjects(mesh, parsed.ranges, parsed.indices);
+}
+
+std::unique_ptr<rt::KdTri> Scene::buildKdTree(const MeshData& parsed, const Mesh& mesh) {
+    TRACE_ZONE("Build k-d tree");
+    if (parsed.kd_tree_data) {
+        return std::make_unique<rt::KdTri>(mesh.triangles, parsed.kd_tree_data);
+    }
+    auto kd_tree = std::make_unique<rt::KdTri>(mesh.triangles, 10, 1, 30, 2);
+    writeCache(parsed, *kd_tree);
+    return kd_tree;
+}
+
+void Scene::addInstances(const uint mesh_id, const std::vector<mat4>& obj_to_world) {
+    assert(mesh_id < m_meshes.size());
+    Mesh& mesh = m_meshes[mesh_id];
+    const size_t first_instance{mesh.instances.size()};
+    mesh.instances.insert(mesh.instances.end(), obj_to_world.begin(), obj_to_world.end());
+    if (mesh.kd_tree) traceInstances(mesh, first_instance);
+    updateInstanceData();
+}
+
+void Scene::traceInstances(const Mesh& mesh, const size_t first_instance) {
+    assert(mesh.kd_tree);
+    if (first_instance == mesh.instances.size()) return;
+    m_instances.reserve(m_instances.size() + mesh.instances.size() - first_instance);
+    for (auto t = mesh.instances.begin() + first_instance; t != mesh.instances.end(); ++t) {
+        m_instances.emplace_back(mesh.kd_tree.get(), *t);
+    }
+    // Rebuild the top-level acceleration structure
+    // Intersecting an instance is about as expensive as traversing a small tree
+    m_kd_tree = std::make_unique<rt::KdInst>(m_instances, 80, 1, 24, 1);
+}
+
+void Scene::createObjects(Mesh& mesh, const std::vector<ObjectRange>& ranges,
+                          const uint* const indices) {
+    // Buffer the vertices of the entire scene; the CPU copies are used for raytracing
+    const size_t n_elems{3 * m_vertices.size()};
+    m_geom_va.loadData(0, n_elems, &m_vertices[0].x);
+    m_geom_va.loadData(1, n_elems, &m_normals[0].x);
+    m_geom_va.buffer();
+    size_t n_tris{0};
+    for (auto r = ranges.begin(); r != ranges.end(); ++r) {
+        n_tris += r->n_indices[0] / 3;
+    }
+    mesh.triangles.reserve(n_tris);
+    uint n_indices32{0}, n_indices16{0};
+    const uint n_ranges{static_cast<uint>(ranges.size())};
+    const uint first_mat_id{m_materials.size() - n_ranges};
+    mesh.n_objs = n_ranges;
+    mesh.bbox   = BBox{};
+    for (uint i = 0; i < n_ranges; ++i) {
+        const ObjectRange& r = ranges[i];
+        const uint mat_id{first_mat_id + i};
+        const uint first_vert{mesh.first_vert + r.first_vert};
+        const uint* const obj_indices{indices + r.first_idx};
+        // Upload all levels of detail
+        uint n_indices{0};
+        for (int l = 0; l < N_LODS; ++l) {
+            n_indices += r.n_indices[l];
+        }
+        // Use 16-bit indices (relative to the first vertex) where they fit
+        const bool use_16bit{r.n_verts <= USHRT_MAX + 1u};
+        if (use_16bit) {
+            mesh.ebo16.loadData(n_indices, obj_indices, 0);
+            m_objects.emplace_back(mat_id, true, n_indices16, r.n_indices, r.lod_error,
+                                   first_vert, r.n_verts);
+            n_indices16 += n_indices;
+        } else {
+            mesh.ebo.loadData(n_indices, obj_indices, 0);
+            m_objects.emplace_back(mat_id, false, n_indices32, r.n_indices, r.lod_error,
+                                   first_vert, r.n_verts);
+            n_indices32 += n_indices;
+        }
+        BBox& obj_bbox = m_objects.back().bbox;
+        for (uint v = first_vert, n = first_vert + r.n_verts; v < n; ++v) {
+            obj_bbox.extend(m_vertices[v]);
+        }
+        mesh.bbox.extend(obj_bbox);
+        // Create triangles for raytracing (at full detail)
+        for (uint k = 0; k < r.n_indices[0]; k += 3) {
+            const uvec3 vert = {first_vert + obj_indices[k],
+                                first_vert + obj_indices[k + 1],
+                                first_vert + obj_indices[k + 2]};
+            mesh.triangles.emplace_back(vert, m_materials.get(mat_id));
+        }
+    }
+    mesh.ebo.buffer();
+    mesh.ebo16.buffer();
+}
+
+void Scene::updateInstanceData() {
+    // Each object is drawn once per instance of its mesh; per-instance attributes
+    // are replicated for every object, and draws select them using the base instance
+    // Levels of detail of an object share its per-instance attributes
+    if (m_objects.empty()) return;
+    std::vector<GLfloat> mat_ids, columns[4], norm_columns[3];
+    m_draw_cmd_buf = std::make_unique<GLPDIB>(N_LODS * m_objects.size() *
+                                              sizeof(GLElementBuffer::IndirectCmd));
+    auto cmds = static_cast<GLElementBuffer::IndirectCmd*>(m_draw_cmd_buf->data());
+    uint n_cmds{0}, n_attr_elems{0};
+    for (auto mesh = m_meshes.begin(); mesh != m_meshes.end(); ++mesh) {
+        mesh->first_cmd = n_cmds;
+        mesh->n_cmds16  = mesh->n_cmds32 = 0;
+        const uint n_instances{static_cast<uint>(mesh->instances.size())};
+        if (0 == n_instances) continue;
+        // Write draw commands: those using 16-bit indices first, followed by 32-bit ones
+        for (uint lod = 0; lod < N_LODS; ++lod) {
+            uint base_instance{n_attr_elems};
+            for (const bool is_16bit : {true, false}) {
+                for (uint i = mesh->first_obj, n = i + mesh->n_objs; i < n; ++i) {
+                    const Object& obj = m_objects[i];
+                    if (obj.is_16bit != is_16bit) continue;
+                    cmds[n_cmds].count          = obj.n_indices[lod];
+                    cmds[n_cmds].instance_count = n_instances;
+                    cmds[n_cmds].first_idx      = obj.first_idx[lod];
+                    cmds[n_cmds].base_vert      = static_cast<GLint>(obj.first_vert);
+                    cmds[n_cmds].base_instance  = base_instance;
+                    ++n_cmds;
+                    base_instance += n_instances;
+                    if (lod > 0) continue;
+                    ++(is_16bit ? mesh->n_cmds16 : mesh->n_cmds32);
+                    // Replicate per-instance attributes
+                    mat_ids.insert(mat_ids.end(), n_instances,
+                                   static_cast<GLfloat>(obj.mat_id));
+                    for (auto t = mesh->instances.begin(); t != mesh->instances.end(); ++t) {
+                        for (int c = 0; c < 4; ++c) {
+                            columns[c].insert(columns[c].end(), &(*t)[c][0], &(*t)[c][0] + 4);
+                        }
+                        // Avoid inverting the matrix for every vertex
+                        const mat3 norm_mat{glm::transpose(glm::inverse(mat3{*t}))};
+                        for (int c = 0; c < 3; ++c) {
+                            norm_columns[c].insert(norm_columns[c].end(), &norm_mat[c][0],
+                                                   &norm_mat[c][0] + 3);
                         }
-                        break;
                     }
                 }
-                vec3 vertices[3];
-                for (auto k = 0; k < 3; ++k) {
-                    vertices[k] = vec3{s->mesh.positions[3 * indices[k]],
-                        s->mesh.positions[3 * indices[k] + 1],
-                        s->mesh.positions[3 * indices[k] + 2]};
-                }
-                const vec3 normal{glm::triangleNormal(vertices[0], vertices[1], vertices[2])};
-                for (auto k = 0; k < 3; ++k) {
-                    s->mesh.normals.emplace_back(normal[k]);
-                }
             }
         }
-        if (!curr_mat_name || *curr_mat_name != s->material.name) {
-            // New material => new object
-            if (curr_mat_name) {
-                ++curr_mat_id;
-                // Buffer the previous object
-                m_objects.back().va.buffer();
-                m_objects.back().ebo.buffer();
-            }
-            curr_mat_name = &s->material.name;
-            // Create a new object
-            GLVertArray		va{n_mesh_attr, mesh_attr_lengths};
-            GLElementBuffer ebo{};
-            m_objects.emplace_back(curr_mat_id, std::move(va), std::move(ebo));
-            curr_object = &m_objects[m_objects.size() - 1];
-            object_vert_offset = 0;
-            // Set material properties
-            vec3 rho_d{s->material.diffuse[0], s->material.diffuse[1], s->material.diffuse[2]};
-            vec3 rho_s{s->material.specular[0], s->material.specular[1], s->material.specular[2]};
-            // Normalize s.t. rho_d + rho_s <= vec3(1.0f)
-            const vec3 sum{rho_d + rho_s};
-            if (sum.r > 1.0f || sum.g > 1.0f || sum.b > 1.0f) {
-                rho_d /= sum;
-                rho_s /= sum;
+        n_attr_elems += mesh->n_objs * n_instances;
+        // Compute the bounds of the instances of each object (for the selection of the LOD)
+        for (uint o = mesh->first_obj, n = o + mesh->n_objs; o < n; ++o) {
+            Object& obj = m_objects[o];
+            const vec3 pts[2] = {obj.bbox.minPt(), obj.bbox.maxPt()};
+            obj.w_bbox = BBox{};
+            for (auto t = mesh->instances.begin(); t != mesh->instances.end(); ++t) {
+                for (uint i = 0; i < 8; ++i) {
+                    const vec3 corner{pts[i & 1].x, pts[(i >> 1) & 1].y, pts[i >> 2].z};
+                    obj.w_bbox.extend(vec3{*t * glm::vec4{corner, 1.0f}});
+                }
             }
-            const vec3    k_d{rho_d * INV_PI};
-            const GLfloat n_s{s->material.shininess};
-            const vec3    k_s{rho_s * (n_s + 2.0f) * 0.5f * INV_PI};
-            const vec3    k_e{s->material.emission[0], s->material.emission[1],
-                              s->material.emission[2]};
-            // Store material coefficients
-            auto* materials = static_cast<rt::PhongMaterial*>(m_material_pbo.data());
-            materials[curr_mat_id] = rt::PhongMaterial{k_d, k_s, n_s, k_e};
-        }
-        auto& object_va  = curr_object->va;
-        auto& object_ebo = curr_object->ebo;
-        // Load mesh
-        object_va.loadData(0, s->mesh.positions);
-        m_geom_va.loadData(0, s->mesh.positions);
-        object_va.loadData(1, s->mesh.normals);
-        // Load indexing information
-        object_ebo.loadData(s->mesh.indices, object_vert_offset);
-        m_geom_ebo.loadData(s->mesh.indices, global_vert_offset);
-        if (shapes.end() == s + 1) {
-            // Don't forget to buffer after the last shape
-            object_va.buffer();
-            m_geom_va.buffer();
-            object_ebo.buffer();
-            m_geom_ebo.buffer();
         }
-        // Fill vectors for raytracing
-        const uint start_idx{static_cast<uint>(m_vertices.size())};
-        for (size_t k = 0, e = s->mesh.positions.size(); k < e; k += 3) {
-            m_vertices.emplace_back(s->mesh.positions[k],
-                                    s->mesh.positions[k + 1],
-                                    s->mesh.positions[k + 2]);
+        mesh->max_scale = 0.0f;
+        for (auto t = mesh->instances.begin(); t != mesh->instances.end(); ++t) {
+            for (int c = 0; c < 3; ++c) {
+                mesh->max_scale = std::max(mesh->max_scale, glm::length(vec3{(*t)[c]}));
+            }
         }
-        for (size_t k = 0, e = s->mesh.normals.size(); k < e; k += 3) {
-            m_normals.emplace_back(s->mesh.normals[k],
-                                   s->mesh.normals[k + 1],
-                                   s->mesh.normals[k + 2]);
+    }
+    m_geom_va.loadData(2, mat_ids);
+    for (GLuint c = 0; c < 4; ++c) {
+        m_geom_va.loadData(3 + c, columns[c]);
+    }
+    for (GLuint c = 0; c < 3; ++c) {
+        m_geom_va.loadData(7 + c, norm_columns[c]);
+    }
+    m_geom_va.buffer();
+}
+
+bool Scene::readCache(MeshData& parsed) {
+    const char* const cache_file_name{parsed.cache_file_name.c_str()};
+    auto cache = std::make_unique<MappedFile>(cache_file_name);
+    if (!cache->isMapped() || cache->size() < sizeof(CacheHeader)) return false;
+    const char* data{cache->data()};
+    const CacheHeader& key = parsed.key;
+    CacheHeader header;
+    memcpy(&header, data, sizeof(CacheHeader));
+    if (header.magic    != key.magic    || header.src_size != key.src_size ||
+        header.src_time != key.src_time || header.src_hash != key.src_hash ||
+        0 == header.n_objects || header.n_objects > MAX_MATERIALS ||
+        cache->size() != cacheSize(header.n_objects, header.n_verts, header.n_indices,
+                                   header.kd_tree_sz)) {
+        printInfo("Scene cache %s is out of date.", cache_file_name);
+        return false;
+    }
+    data += sizeof(CacheHeader);
+    // Load materials
+    const auto* const materials = reinterpret_cast<const rt::PhongMaterial*>(data);
+    data += header.n_objects * sizeof(rt::PhongMaterial);
+    // Load object ranges
+    const ObjectRange* const range_data{reinterpret_cast<const ObjectRange*>(data)};
+    const std::vector<ObjectRange> ranges(range_data, range_data + header.n_objects);
+    data += header.n_objects * sizeof(ObjectRange);
+    static_assert(sizeof(ObjectRange) == (3 + 2 * N_LODS) * sizeof(uint),
+                  "The size of ObjectRange does not match the cache format.");
+    for (auto r = ranges.begin(); r != ranges.end(); ++r) {
+        uint n_indices{0};
+        for (int l = 0; l < N_LODS; ++l) {
+            n_indices += r->n_indices[l];
         }
-        // Create triangles
-        for (size_t k = 0, e = s->mesh.indices.size(); k < e; k += 3) {
-            const uvec3 vert = {start_idx + s->mesh.indices[k],
-                                start_idx + s->mesh.indices[k + 1],
-                                start_idx + s->mesh.indices[k + 2]};
-            m_triangles.emplace_back(vert, curr_mat_id);
+        if (r->first_vert + r->n_verts > header.n_verts ||
+            r->first_idx  + n_indices > header.n_indices) {
+            printError("Scene cache %s is corrupted.", cache_file_name);
+            return false;
         }
-        object_vert_offset += vert_count;
-        global_vert_offset += vert_count;
     }
-    // Build acceleration structure
-    m_kd_tree = std::make_unique<rt::KdTri>(m_triangles, 10, 1, 30, 2);
+    parsed.materials.assign(materials, materials + header.n_objects);
+    parsed.ranges = ranges;
+    // Vertices, normals, indices and the k-d tree are used directly from the mapped file
+    parsed.vertices = reinterpret_cast<const vec3*>(data);
+    parsed.normals  = parsed.vertices + header.n_verts;
+    parsed.n_verts  = header.n_verts;
+    data += 2 * static_cast<size_t>(header.n_verts) * sizeof(vec3);
+    parsed.indices   = reinterpret_cast<const uint*>(data);
+    parsed.n_indices = header.n_indices;
+    data += static_cast<size_t>(header.n_indices) * sizeof(uint);
+    parsed.kd_tree_data = data;
+    parsed.cache = std::move(cache);
+    printInfo("Scene loaded from cache %s.", cache_file_name);
+    return true;
 }
 
-Scene::Object::Object(const uint material_id, GLVertArray&& va, GLElementBuffer&& ebo):
-               mat_id{material_id}, va{va}, ebo{ebo} {}
+void Scene::writeCache(const MeshData& parsed, const rt::KdTri& kd_tree) {
+    const char* const cache_file_name{parsed.cache_file_name.c_str()};
+    // Write to a temporary file, so that a failed write never leaves a corrupt cache behind
+    const std::string tmp_file_name{parsed.cache_file_name + ".tmp"};
+    // Open file
+    auto file = fopen(tmp_file_name.c_str(), "wb");
+    if (!file) {
+        // Something went wrong
+        printError("Failed to open scene cache file %s for writing.", tmp_file_name.c_str());
+        return;
+    }
+    CacheHeader header = parsed.key;
+    header.n_objects  = static_cast<uint32_t>(parsed.ranges.size());
+    header.n_verts    = parsed.n_verts;
+    header.n_indices  = parsed.n_indices;
+    header.kd_tree_sz = static_cast<uint32_t>(kd_tree.serializedSize());
+    std::vector<char> kd_tree_data(header.kd_tree_sz);
+    kd_tree.serialize(kd_tree_data.data());
+    // Writes 'count' elements of 'size' bytes each; returns 'false' on failure
+    const auto write = [file](const void* const data, const size_t size, const size_t count) {
+        return count == fwrite(data, size, count, file);
+    };
+    // Write header
+    bool is_ok{write(&header, sizeof(CacheHeader), 1)};
+    // Write materials and object ranges
+    is_ok = is_ok && write(parsed.materials.data(), sizeof(rt::PhongMaterial), header.n_objects);
+    is_ok = is_ok && write(parsed.ranges.data(), sizeof(ObjectRange), header.n_objects);
+    // Write vertices, normals and indices
+    is_ok = is_ok && write(parsed.vertices, sizeof(vec3), header.n_verts);
+    is_ok = is_ok && write(parsed.normals, sizeof(vec3), header.n_verts);
+    is_ok = is_ok && write(parsed.indices, sizeof(uint), header.n_indices);
+    // Write acceleration structure
+    is_ok = is_ok && write(kd_tree_data.data(), 1, header.kd_tree_sz);
+    // Close file
+    is_ok = (0 == fclose(file)) && is_ok;
+    if (!is_ok) {
+        printError("Failed to write scene cache file %s.", tmp_file_name.c_str());
+        remove(tmp_file_name.c_str());
+        return;
+    }
+    // Replace the old cache; rename() does not overwrite existing files on Windows
+    // If interrupted in between, the cache is merely missing, and is rebuilt on the next run
+    remove(cache_file_name);
+    if (0 != rename(tmp_file_name.c_str(), cache_file_name)) {
+        printError("Failed to rename scene cache file %s to %s.", tmp_file_name.c_str(),
+                   cache_file_name);
+        remove(tmp_file_name.c_str());
+    }
+}
+
+Scene::Object::Object(const uint material_id, const bool use_16bit_indices,
+                      const uint first_index, const uint (&index_counts)[N_LODS],
+                      const float (&lod_errors)[N_LODS],
+                      const uint first_vertex, const uint vertex_count): mat_id{material_id},
+                      is_16bit{use_16bit_indices}, first_vert{first_vertex},
+                      n_verts{vertex_count} {
+    for (uint l = 0, first = first_index; l < N_LODS; first += index_counts[l++]) {
+        first_idx[l] = first;
+        n_indices[l] = index_counts[l];
+        lod_error[l] = lod_errors[l];
+    }
+}
 
 void Scene::addFog(const char* const dens_file_name, const char* const pi_dens_file_name,
                    const float maj_ext_k, const float abs_k, const float sca_k,
@@ -178,14 +701,17 @@ void Scene::addFog(const char* const dens_file_name, const char* const pi_dens_f
     }
     if (file_exists) {
         // Load fog info from disk
-        m_fog_vol = std::make_unique<FogVolume>(DensityField{bb, dens_file_name, pi_dens_file_name},
+        m_fog_vol = std::make_unique<FogVolume>(DensityField{bb, dens_file_name,
+                                                             pi_dens_file_name, cam},
                                                 maj_ext_k, abs_k, sca_k);
     } else {
         // Generate new fog from scratch
         static const int res[3] = {64, 64, 64};
         static const float freq = 12.0f;
         static const float ampl = 1.0f;
-        m_fog_vol = std::make_unique<FogVolume>(DensityField{bb, res, freq, ampl, cam, *this},
+        // Use a new seed every time
+        const uint seed{UnitRNG::generateUint()};
+        m_fog_vol = std::make_unique<FogVolume>(DensityField{bb, res, freq, ampl, seed, cam, *this},
                                                 maj_ext_k, abs_k, sca_k);
     }
     m_fog_enabled = true;
@@ -193,8 +719,10 @@ void Scene::addFog(const char* const dens_file_name, const char* const pi_dens_f
 
 void Scene::updateFogCoeffs(const float maj_ext_k, const float abs_k,
                             const float sca_k) {
-    assert(m_fog_vol);
-    m_fog_vol->setCoeffs(maj_ext_k, abs_k, sca_k);
+    // Fog is only added once the scene has been loaded
+    if (m_fog_vol) {
+        m_fog_vol->setCoeffs(maj_ext_k, abs_k, sca_k);
+    }
 }
 
 const vec3& Scene::getVertex(const uint index) const {
@@ -202,8 +730,11 @@ const vec3& Scene::getVertex(const uint index) const {
 }
 
 const rt::PhongMaterial* Scene::getMaterial(const uint index) const {
-    const auto* materials = static_cast<const rt::PhongMaterial*>(m_material_pbo.data());
-    return &materials[index];
+    return m_materials.get(index);
+}
+
+uint Scene::addMaterial(const rt::PhongMaterial& material) {
+    return m_materials.add(material);
 }
 
 float Scene::sampleScaK(const vec3& pos) const {
@@ -218,6 +749,10 @@ float Scene::getMajExtK() const {
     return m_fog_vol->getMajExtK();
 }
 
+float Scene::sampleMajExtK(const vec3& p0, const vec3& p1) const {
+    return m_fog_vol->sampleMajExtK(p0, p1);
+}
+
 float Scene::getScaAlbedo() const {
     return m_fog_vol->getScaAlbedo();
 }
@@ -227,11 +762,33 @@ const BBox& Scene::getFogBounds() const {
 }
 
 void Scene::toggleFog() {
+    m_fog_enabled = m_fog_vol && !m_fog_enabled;
+}
+
+#ifndef GPU_PI_DENSITY
+void Scene::invalidateFogPiDens() {
+    assert(m_fog_vol);
+    m_fog_vol->invalidatePiDensity();
+}
+
+bool Scene::updateFogPiDens(const PerspectiveCamera& cam, const uint budget_ms) {
+    if (m_fog_vol) {
+        return m_fog_vol->updatePiDensity(cam, *this, budget_ms);
+    } else {
+        return true;
+    }
+}
+#endif
+
+#if defined(GPU_PI_DENSITY) && !defined(NDEBUG)
+void Scene::validateFogPiDens(const PerspectiveCamera& cam) const {
     assert(m_fog_vol);
-    m_fog_enabled = !m_fog_enabled;
+    m_fog_vol->validatePiDensity(cam, *this);
 }
+#endif
 
 bool Scene::trace(rt::Ray& ray, const bool is_vis_ray) const {
+    assert(isTraceable());
     // Traverse the tree
     if (m_kd_tree->intersect(ray, is_vis_ray)) {
         if (is_vis_ray) { return true; }
@@ -250,13 +807,64 @@ BBox::IntDist Scene::traceFog(const rt::Ray& ray) const {
     }
 }
 
-void Scene::render(const bool ignore_materials) const {
-    if (ignore_materials) {
-        m_geom_ebo.draw(m_geom_va);
-    } else {
-        for (const auto& obj : m_objects) {
-            gl::Uniform1i(UL_GB_MAT_ID, obj.mat_id);
-            obj.ebo.draw(obj.va);
+void Scene::render() const {
+    if (!m_draw_cmd_buf) return;
+    m_draw_cmd_buf->bind();
+    for (auto mesh = m_meshes.begin(); mesh != m_meshes.end(); ++mesh) {
+        drawMesh(*mesh, 0);
+    }
+}
+
+void Scene::render(const vec3& w_pos, const float texel_angle) const {
+    if (!m_draw_cmd_buf) return;
+    m_draw_cmd_buf->bind();
+    const size_t cmd_sz{sizeof(GLElementBuffer::IndirectCmd)};
+    for (auto mesh = m_meshes.begin(); mesh != m_meshes.end(); ++mesh) {
+        const uint n_cmds{mesh->n_cmds16 + mesh->n_cmds32};
+        if (0 == n_cmds) continue;
+        // Visit the objects in the order of their draw commands (16-bit ones first),
+        // and draw consecutive objects sharing the level of detail together
+        uint cmd{0};
+        for (const bool is_16bit : {true, false}) {
+            const GLElementBuffer& ebo = is_16bit ? mesh->ebo16 : mesh->ebo;
+            uint first_cmd{0}, n_draws{0}, draw_lod{0};
+            for (uint i = mesh->first_obj, n = i + mesh->n_objs; i < n; ++i) {
+                const Object& obj = m_objects[i];
+                if (obj.is_16bit != is_16bit) continue;
+                // The error of the LOD must not exceed the size of a texel at the closest
+                // instance of the object
+                const vec3  closest_pt{glm::clamp(w_pos, obj.w_bbox.minPt(),
+                                                  obj.w_bbox.maxPt())};
+                const float max_error{glm::distance(w_pos, closest_pt) * texel_angle /
+                                      mesh->max_scale};
+                uint lod{0};
+                while (lod + 1 < N_LODS && obj.lod_error[lod + 1] <= max_error) ++lod;
+                if (n_draws > 0 && lod != draw_lod) {
+                    ebo.drawIndirect(m_geom_va, first_cmd * cmd_sz, n_draws);
+                    n_draws = 0;
+                }
+                if (0 == n_draws) {
+                    first_cmd = mesh->first_cmd + lod * n_cmds + cmd;
+                    draw_lod  = lod;
+                }
+                ++n_draws;
+                ++cmd;
+            }
+            if (n_draws > 0) {
+                ebo.drawIndirect(m_geom_va, first_cmd * cmd_sz, n_draws);
+            }
         }
     }
 }
+
+void Scene::drawMesh(const Mesh& mesh, const uint lod) const {
+    const size_t cmd_sz{sizeof(GLElementBuffer::IndirectCmd)};
+    const uint   first_cmd{mesh.first_cmd + lod * (mesh.n_cmds16 + mesh.n_cmds32)};
+    if (mesh.n_cmds16 > 0) {
+        mesh.ebo16.drawIndirect(m_geom_va, first_cmd * cmd_sz, mesh.n_cmds16);
+    }
+    if (mesh.n_cmds32 > 0) {
+        const size_t cmd_offset{(first_cmd + mesh.n_cmds16) * cmd_sz};
+        mesh.ebo.drawIndirect(m_geom_va, cmd_offset, mesh.n_cmds32);
+    }
+}
@@ -1,20 +1,46 @@
 #pragma once
 
+#include <list>
+#include <deque>
 #include <vector>
 #include <memory>
+#include <future>
 #include "..\Fog\FogVolume.h"
 #include "..\RT\RTBase.h"
 #include "..\RT\KdTree.h"
 #include "..\GL\GLVertArray.h"
 #include "..\GL\GLElementBuffer.h"
 #include "..\GL\GLPersistentBuffer.h"
+#include "MaterialTable.h"
+#include "Constants.h"
 
 class Scene {
 public:
     Scene();
     RULE_OF_ZERO_NO_COPY(Scene);
-    // Loads objects from *.obj file
+    // Loads a mesh from *.obj file; returns its index
+    // The mesh is neither rendered nor raytraced until it is instanced
+    // Must not be called while asynchronous loads are in progress (see finishLoading())
+    uint loadMesh(const char* const file_name);
+    // Starts loading a mesh from *.obj file asynchronously; returns its index immediately
+    // Parsing and k-d tree construction are performed by worker threads; the mesh is
+    // rendered once its geometry is resident, and raytraced once its k-d tree is built
+    uint loadMeshAsync(const char* const file_name);
+    // Integrates the results of asynchronous loading; must be called by the OpenGL thread
+    // Returns 'true' if the rendered or raytraced geometry has changed
+    bool update();
+    // Blocks until all asynchronous loads are complete
+    void finishLoading();
+    // Returns 'true' if the scene can be raytraced (at least one instance has a k-d tree)
+    bool isTraceable() const;
+    // Adds instances of the mesh with the specified object-to-world transformations
+    // Rebuilds the top-level acceleration structure and the per-instance data
+    // Instances of meshes still being loaded are added once the data becomes available
+    void addInstances(const uint mesh_id, const std::vector<glm::mat4>& obj_to_world);
+    // Loads objects from *.obj file as a single (untransformed) instance of a new mesh
     void loadObjects(const char* const file_name);
+    // Asynchronous version of loadObjects()
+    void loadObjectsAsync(const char* const file_name);
     // Creates fog around the whole scene
     // Loads volume density and preintegrated density data from the specified files,
     // and augments them with the specified coefficients
@@ -27,46 +53,142 @@ public:
                          const float sca_k);
     // Returns vertex from vector of vertices at specified index
     const glm::vec3& getVertex(const uint index) const;
-    // Returns material from vector of materials at specified index
+    // Returns material from the material table at specified index
     const rt::PhongMaterial* getMaterial(const uint index) const;
+    // Adds a material to the material table (possibly at run time); returns its index
+    uint addMaterial(const rt::PhongMaterial& material);
     // Returns extinction coefficient at a given position
     float sampleScaK(const glm::vec3& pos) const;
     // Returns majorant (maximal) extinction coefficient of the fog
     float sampleExtK(const glm::vec3& pos) const;
     // Returns scattering coefficient at a given position
     float getMajExtK() const;
+    // Returns majorant extinction coefficient of the fog along a line segment
+    float sampleMajExtK(const glm::vec3& p0, const glm::vec3& p1) const;
     // Returns scattering albedo - probability of scattering event
     float getScaAlbedo() const;
     // Returns fog bounds
     const BBox& getFogBounds() const;
     // Toggles fog within the scene on and off
     void toggleFog();
+    #ifndef GPU_PI_DENSITY
+        // Marks all preintegrated fog density values as out of date (e.g. after camera motion)
+        void invalidateFogPiDens();
+        // Progressively recomputes out of date preintegrated fog density values,
+        // spending at most (approximately) 'budget_ms' milliseconds
+        // Returns 'true' if preintegrated fog density is up to date
+        bool updateFogPiDens(const PerspectiveCamera& cam, const uint budget_ms);
+    #endif
+    #if defined(GPU_PI_DENSITY) && !defined(NDEBUG)
+        // Compares preintegrated fog density values computed on the GPU with the CPU reference
+        void validateFogPiDens(const PerspectiveCamera& cam) const;
+    #endif
     // Traces ray thorough the scene
     bool trace(rt::Ray& ray, const bool is_vis_ray = false) const;
     // Traces ray through fog returning entry and exit distances
     BBox::IntDist traceFog(const rt::Ray& ray) const;
-    // Renders scene; if materials are ignored, the whole scene is rendered in one draw call
-    void render(const bool ignore_materials = false) const;
+    // Renders scene using (at most) 2 instanced indirect multi-draw calls per mesh,
+    // one per index type; per-instance attributes are the material index (location 2),
+    // the object-to-world transformation matrix (locations 3..6)
+    // and the object-to-world normal transformation matrix (locations 7..9)
+    void render() const;
+    // Renders scene as seen from the specified position with texels subtending 'texel_angle'
+    // radians, using the coarsest level of detail of each object with sub-texel error
+    void render(const glm::vec3& w_pos, const float texel_angle) const;
 private:
-    /* OpenGL representation of a scene object */
+    /* Scene object: range of triangles sharing a material */
     struct Object {
         Object() = delete;
         RULE_OF_ZERO(Object);
-        explicit Object(const uint material_id, GLVertArray&& va, GLElementBuffer&& ebo);
+        // Levels of detail are stored consecutively, starting from 'first_index'
+        explicit Object(const uint material_id, const bool use_16bit_indices,
+                        const uint first_index, const uint (&index_counts)[N_LODS],
+                        const float (&lod_errors)[N_LODS],
+                        const uint first_vertex, const uint vertex_count);
         // Public data members
-        uint            mat_id;                 // Material index
-        GLVertArray     va;                     // OpenGL vertex array
-        GLElementBuffer ebo;                    // OpenGL element buffer for indexed drawing
+        uint  mat_id;                           // Material index
+        bool  is_16bit;                         // Whether the indices are 16-bit
+        uint  first_idx[N_LODS];                // Ranges of levels of detail
+        uint  n_indices[N_LODS];                // within the mesh element buffer
+        float lod_error[N_LODS];                // Geometric errors of LODs in object space
+        uint  first_vert, n_verts;              // Range of vertices (indices are relative)
+        BBox  bbox;                             // Bounding box in object space
+        BBox  w_bbox;                           // Bounding box of all instances in world space
     };
+    /* Mesh: objects sharing a bottom-level acceleration structure; can be instanced */
+    struct Mesh {
+        Mesh();
+        RULE_OF_ZERO_NO_COPY(Mesh);
+        // Public data members
+        uint first_obj, n_objs;                 // Range within objects
+        uint first_vert;                        // Index of the first vertex
+        GLElementBuffer ebo;                    // Contains objects with 32-bit indices
+        GLElementBuffer ebo16;                  // Contains objects with 16-bit indices
+        std::vector<rt::Triangle>  triangles;   // Triangles for raytracing
+        std::unique_ptr<rt::KdTri> kd_tree;     // Bottom-level k-d tree
+        std::vector<glm::mat4>     instances;   // Object-to-world transformations of instances
+        uint first_cmd, n_cmds16, n_cmds32;     // Indirect draw commands (16-bit ones first),
+                                                // repeated for every level of detail
+        BBox  bbox;                             // Bounding box in object space
+        float max_scale;                        // Max. scaling factor of instances
+    };
+    /* Vertex and index ranges of a scene object */
+    struct ObjectRange {
+        uint  first_vert, n_verts;              // Range within vertices and normals
+        uint  first_idx;                        // Offset within object-relative indices
+        uint  n_indices[N_LODS];                // Index counts of LODs (stored consecutively)
+        float lod_error[N_LODS];                // Geometric errors of LODs in object space
+    };
+    /* Header of the binary scene cache */
+    struct CacheHeader;
+    /* Parsed mesh data (CPU only) */
+    struct MeshData;
+    /* Mesh being loaded asynchronously */
+    struct PendingLoad {
+        uint                                    mesh_id;    // Index of the mesh
+        std::future<std::shared_ptr<MeshData>>  parsed;     // Valid until the mesh is created
+        std::shared_ptr<MeshData>               data;       // Kept until the k-d tree is built
+        std::future<std::unique_ptr<rt::KdTri>> kd_tree;    // Valid while the tree is built
+    };
+    // Parses the mesh (or reads it from the cache); safe to call from any thread
+    static std::shared_ptr<MeshData> parseMesh(const char* const file_name);
+    // Adds the materials and the vertices of the parsed mesh to the scene, and creates
+    // its objects and triangles
+    void createMesh(const MeshData& parsed, Mesh& mesh);
+    // Builds (or deserializes) the k-d tree of the mesh, and updates the cache
+    // Safe to call from any thread as long as no vertices are being added to the scene
+    static std::unique_ptr<rt::KdTri> buildKdTree(const MeshData& parsed, const Mesh& mesh);
+    // Buffers the loaded vertices and normals, and creates objects (one per material) and
+    // triangles of the mesh from object-relative indices; vertex ranges are relative to the
+    // first vertex of the mesh; objects use the materials last added to the table
+    // (one per range, in order)
+    void createObjects(Mesh& mesh, const std::vector<ObjectRange>& ranges,
+                       const uint* const indices);
+    // Adds instances of the mesh (starting from 'first_instance') to the top-level
+    // acceleration structure; the mesh must have a k-d tree
+    void traceInstances(const Mesh& mesh, const size_t first_instance);
+    // Rebuilds per-instance vertex attributes and indirect draw commands
+    void updateInstanceData();
+    // Draws all instances of the mesh at the specified level of detail
+    void drawMesh(const Mesh& mesh, const uint lod) const;
+    // Maps the binary cache file if it matches the key of the parsed mesh
+    // Returns 'false' if the cache is absent or out of date
+    static bool readCache(MeshData& parsed);
+    // Writes the parsed mesh and its k-d tree to the binary cache file
+    static void writeCache(const MeshData& parsed, const rt::KdTri& kd_tree);
     GLVertArray                m_geom_va;       // Contains vertices of the entire scene
-    GLElementBuffer            m_geom_ebo;      // Contains triangles of the entire scene
-    GLPUB140                   m_material_pbo;  // Contains all scene materials
-    std::vector<Object>        m_objects;       // All objects, combined by material
+    MaterialTable              m_materials;     // Contains all scene materials
+    std::unique_ptr<GLPDIB>    m_draw_cmd_buf;  // Contains indirect draw commands (1 per object)
+    std::vector<Object>        m_objects;       // All objects, combined by material (per mesh)
+    std::deque<Mesh>           m_meshes;        // All meshes (addresses remain valid)
     std::unique_ptr<FogVolume> m_fog_vol;       // Heterogeneous fog (if present)
     bool                       m_fog_enabled;   // Flag to toggle fog on/off
     // Raytracing specifics
-    std::unique_ptr<rt::KdTri> m_kd_tree;       // K-d tree spatial accel. structure
-    std::vector<glm::vec3>     m_vertices;      // Vertices for raytracing
-    std::vector<glm::vec3>     m_normals;       // Normals for raytracing
-    std::vector<rt::Triangle>  m_triangles;     // Triangles for raytracing
+    std::unique_ptr<rt::KdInst> m_kd_tree;      // Top-level k-d tree (over instances)
+    std::vector<rt::Instance>  m_instances;     // Instances of all meshes
+    std::vector<glm::vec3>     m_vertices;      // Vertices of all meshes (shared with OpenGL)
+    std::vector<glm::vec3>     m_normals;       // Normals of all meshes (shared with OpenGL)
+    // Asynchronous loading; declared last s.t. worker threads finish before anything else
+    // is destroyed
+    std::list<PendingLoad>     m_pending;       // Meshes being loaded (in order)
 };
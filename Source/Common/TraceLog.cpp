@@ -0,0 +1,171 @@
+#include "TraceLog.h"
+#include <atomic>
+#include <string>
+#include <cstdio>
+#include "Timer.h"
+#include "Utility.hpp"
+
+CONSTEXPR uint TRACE_BUF_SZ = 1 << 16;      // Capacity of an event buffer
+CONSTEXPR uint GPU_TID      = 0;            // Thread id of GPU events
+
+/* Complete event of a single thread */
+struct TraceEvent {
+    const char* name;                       // Name (string literal)
+    int64_t     begin_us, end_us;           // Start and end times in microseconds
+};
+
+/* Event buffer written by a single thread, and read by the thread writing the trace */
+struct ThreadBuffer {
+    TraceEvent                events[TRACE_BUF_SZ];
+    std::atomic<uint>         n_events;     // Number of published events
+    std::atomic<const char*>  name;         // Name of the thread (may be null)
+    uint                      tid;          // Thread id
+    ThreadBuffer*             next;         // Next buffer within the list of all buffers
+};
+
+static std::atomic<bool>          is_recording;     // Whether events are being recorded
+static std::atomic<ThreadBuffer*> all_buffers;      // Lock-free list of all buffers
+static std::atomic<uint>          n_threads;        // Number of thread ids handed out
+static THREAD_LOCAL ThreadBuffer* thread_buffer;    // Buffer of the calling thread
+static ThreadBuffer*              gpu_buffer;       // Buffer of GPU events
+static std::string                trace_file_name;  // Name of the trace file
+static uint  curr_frame, first_frame, last_frame;   // Recorded frames: [first, last)
+static int64_t start_us;                            // Start time of the trace
+
+// Returns the current time in microseconds
+static inline int64_t timeNow() {
+    return HighResTimer::now().time_since_epoch().count();
+}
+
+// Creates a buffer with the specified thread id, and inserts it into the list of all buffers
+static ThreadBuffer* createBuffer(const uint tid) {
+    ThreadBuffer* const buf{new ThreadBuffer};
+    buf->n_events.store(0);
+    buf->name.store(nullptr);
+    buf->tid  = tid;
+    buf->next = all_buffers.load();
+    while (!all_buffers.compare_exchange_weak(buf->next, buf)) {}
+    return buf;
+}
+
+// Returns the buffer of the calling thread; creates it on first use
+static ThreadBuffer* threadBuffer() {
+    if (!thread_buffer) {
+        // Thread id 0 is reserved for the GPU
+        thread_buffer = createBuffer(GPU_TID + 1 + n_threads++);
+    }
+    return thread_buffer;
+}
+
+// Appends the event to the buffer; drops it if the buffer is full
+static inline void record(ThreadBuffer* const buf, const char* const name,
+                          const int64_t begin_us, const int64_t end_us) {
+    // Only the owning thread writes to the buffer
+    const uint n{buf->n_events.load(std::memory_order_relaxed)};
+    if (n < TRACE_BUF_SZ) {
+        buf->events[n].name     = name;
+        buf->events[n].begin_us = begin_us;
+        buf->events[n].end_us   = end_us;
+        // Publish the event
+        buf->n_events.store(n + 1, std::memory_order_release);
+    }
+}
+
+void TraceLog::init(const char* const file_name, const uint first, const uint n_frames) {
+    trace_file_name = file_name;
+    curr_frame  = 0;
+    first_frame = first;
+    last_frame  = first + n_frames;
+    if (!gpu_buffer) {
+        gpu_buffer = createBuffer(GPU_TID);
+        gpu_buffer->name.store("GPU");
+    }
+    if (0 == first_frame && n_frames > 0) {
+        start_us = timeNow();
+        is_recording.store(true);
+    }
+}
+
+void TraceLog::nextFrame() {
+    if (trace_file_name.empty()) return;
+    ++curr_frame;
+    if (curr_frame == first_frame) {
+        start_us = timeNow();
+        is_recording.store(true);
+    } else if (curr_frame == last_frame) {
+        is_recording.store(false);
+        write();
+    }
+}
+
+bool TraceLog::isRecording() {
+    return is_recording.load(std::memory_order_relaxed);
+}
+
+void TraceLog::setThreadName(const char* const name) {
+    // Only allocate the buffer of the thread if a trace will be written
+    if (trace_file_name.empty()) return;
+    threadBuffer()->name.store(name);
+}
+
+void TraceLog::addEvent(const char* const name, const int64_t begin_us, const int64_t end_us) {
+    if (isRecording()) {
+        record(threadBuffer(), name, begin_us, end_us);
+    }
+}
+
+void TraceLog::addGPUEvent(const char* const name, const int64_t begin_us,
+                           const int64_t end_us) {
+    if (isRecording()) {
+        record(gpu_buffer, name, begin_us, end_us);
+    }
+}
+
+void TraceLog::write() {
+    // Open file
+    auto file = fopen(trace_file_name.c_str(), "w");
+    if (!file) {
+        printError("Failed to open trace file %s for writing.", trace_file_name.c_str());
+        return;
+    }
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+    bool is_first{true};
+    for (ThreadBuffer* buf = all_buffers.load(); buf; buf = buf->next) {
+        // Threads may still be recording events; only read the published ones
+        const uint n{buf->n_events.load(std::memory_order_acquire)};
+        const char* const name{buf->name.load()};
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,"
+                      "\"args\":{\"name\":\"", is_first ? "" : ",\n", buf->tid);
+        if (name) {
+            fputs(name, file);
+        } else {
+            fprintf(file, "Thread %u", buf->tid);
+        }
+        fputs("\"}}", file);
+        is_first = false;
+        for (uint i = 0; i < n; ++i) {
+            const TraceEvent& e = buf->events[i];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,"
+                          "\"ts\":%lld,\"dur\":%lld}", e.name, buf->tid,
+                    static_cast<long long>(e.begin_us - start_us),
+                    static_cast<long long>(e.end_us - e.begin_us));
+        }
+    }
+    fputs("\n]}\n", file);
+    // Close file
+    if (0 != fclose(file)) {
+        printError("Failed to write trace file %s.", trace_file_name.c_str());
+    } else {
+        printInfo("Trace of frames %u..%u written to %s.", first_frame, last_frame - 1,
+                  trace_file_name.c_str());
+    }
+}
+
+TraceLog::Zone::Zone(const char* const name): m_name{name},
+                                              m_begin_us{isRecording() ? timeNow() : -1} {}
+
+TraceLog::Zone::~Zone() {
+    if (m_begin_us >= 0) {
+        addEvent(m_name, m_begin_us, timeNow());
+    }
+}
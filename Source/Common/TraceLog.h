@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include "Definitions.h"
+
+/* Static class recording a timeline of CPU zones (per thread) and GPU passes over a range
+   of frames, and writing it in the Chrome trace event format (chrome://tracing)
+   Every thread records into its own fixed-size buffer without locking */
+class TraceLog {
+public:
+    TraceLog() = delete;
+    RULE_OF_ZERO(TraceLog);
+    // Enables recording of 'n_frames' frames starting from frame 'first_frame'
+    // The trace is written to the specified file after the last frame
+    static void init(const char* const file_name, const uint first_frame, const uint n_frames);
+    // Ends the current frame; must be called by the main thread
+    static void nextFrame();
+    // Returns 'true' if events are being recorded
+    static bool isRecording();
+    // Names the calling thread in the trace; the name must be a string literal
+    // Has no effect (and allocates nothing) unless tracing has been enabled by init()
+    static void setThreadName(const char* const name);
+    // Records an event of the calling thread; the name must be a string literal
+    // Times are in microseconds (see HighResTimer)
+    static void addEvent(const char* const name, const int64_t begin_us, const int64_t end_us);
+    // Records a GPU event; must be called by the OpenGL thread
+    static void addGPUEvent(const char* const name, const int64_t begin_us,
+                            const int64_t end_us);
+    /* Scoped zone recorded as an event of the calling thread */
+    class Zone {
+    public:
+        Zone() = delete;
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+        // Starts the zone; the name must be a string literal
+        explicit Zone(const char* const name);
+        // Ends the zone
+        ~Zone();
+    private:
+        const char* m_name;                 // Name of the zone
+        int64_t     m_begin_us;             // Start time (negative if not recording)
+    };
+private:
+    // Writes the recorded events to the file
+    static void write();
+};
+
+// Records the enclosing scope as a zone (one per scope)
+#define TRACE_ZONE(name) const TraceLog::Zone trace_zone{name}
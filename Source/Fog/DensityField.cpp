@@ -1,11 +1,14 @@
 #include "DensityField.h"
-#include <GLM\gtc\noise.hpp>
+#include <emmintrin.h>
 #include <OpenGL\gl_core_4_4.hpp>
 #include "..\Common\Constants.h"
 #include "..\Common\Utility.hpp"
 #include "..\Common\Interpolation.hpp"
 #include "..\Common\Camera.h"
+#include "..\Common\Timer.h"
+#include "..\Common\TraceLog.h"
 #include "..\Common\Scene.h"
+#include "NoiseGenerator.h"
 
 using glm::ivec2;
 using glm::vec3;
@@ -16,95 +19,63 @@ using glm::ceil;
 using glm::floor;
 
 DensityField::DensityField(const BBox& bb, const int(&res)[3], const float freq, const float ampl,
-                           const PerspectiveCamera& cam, const Scene& scene):
+                           const uint seed, const PerspectiveCamera& cam, const Scene& scene):
                            m_bbox{bb}, m_res{res[0], res[1], res[2]},
                            m_data{new GLubyte[res[0] * res[1] * res[2]]},
-                           m_pi_dens_data{nullptr} {
+                           m_pi_dens_data{nullptr}, m_pi_dens_tex_handle{0},
+                           m_pi_dens_dirty{nullptr}, m_n_dirty_packets{0}, m_dirty_cursor{0} {
     // Validate parameters
     assert(m_res.x > 0 && m_res.y > 0 && m_res.z > 0);
     assert(freq > 0.0f && 0.0f < ampl && ampl <= 1.0f);
-    // Initialize maximal density
-    float max_dens{0.0f};
-    // Compute normalization factors
-    const float x_norm{1.0f / (m_res.x - 1)};
-    const float y_norm{1.0f / (m_res.y - 1)};
-    const float z_norm{1.0f / (m_res.z - 1)};
     printInfo("The renderer has been started for the first time.");
-    printInfo("Procedurally computing fog density values using simplex noise.");
-    // Compute per-pixel noise values
-    #pragma omp parallel for
-    for (int z = 0; z < m_res[2]; ++z)
-    for (int y = 0; y < m_res[1]; ++y)
-    for (int x = 0; x < m_res[0]; ++x) {
-        const vec3 norm_pos{x * x_norm, y * y_norm, z * z_norm};
-        float sum{0.0f};
-        float curr_freq{freq};
-        float curr_ampl{ampl};
-        // Compute value for each octave
-        for (int oct = 0; oct < N_OCTAVES; ++oct) {
-            // Value in range [-1, 1]
-            float val{glm::simplex(curr_freq * norm_pos)};
-            // Now mapped to [0, 0.5]
-            val = 0.25f * (val + 1.0f);
-            // curr_ampl <= 1
-            // Therefore, sum is range [0, 1): at most 0.5 + 0.25 + 0.125 + ...
-            sum += curr_ampl * val;
-            // Double the frequency, half the amplitude
-            curr_freq *= 2.0f;
-            curr_ampl /= 2.0f;
-        }
-        const float   dens_val{sum / N_OCTAVES};
-        const GLubyte byte_dens{static_cast<GLubyte>(255.0f * dens_val)};
-        max_dens = max(max_dens, dens_val);
-        m_data[x + y * m_res.x + z * m_res.x * m_res.y] = byte_dens;
-    }
-    const float inv_max_dens{1.0f / max_dens};
-    // Initialize minimal, average, maximal densities
-    float min_dens{FLT_MAX}, avg_dens{0.0f};
-    max_dens = 0.0f;
-    // Linearly rescale the values
-    for (int z = 0; z < m_res[2]; ++z)
-    for (int y = 0; y < m_res[1]; ++y)
-    for (int x = 0; x < m_res[0]; ++x) {
-        const GLubyte old_byte_dens{m_data[x + y * m_res.x + z * m_res.x * m_res.y]};
-        const float   new_dens{min(old_byte_dens * inv_max_dens / 255.0f, 1.0f)};
-        const GLubyte new_byte_dens{static_cast<GLubyte>(255.0f * new_dens)};
-        min_dens  = min(min_dens, new_dens);
-        max_dens  = max(max_dens, new_dens);
-        avg_dens += new_dens;
-        m_data[x + y * m_res.x + z * m_res.x * m_res.y] = new_byte_dens;
-    }
+    printInfo("Procedurally computing fog density values using gradient noise (seed: %u).", seed);
+    // Compute per-voxel noise values
+    const NoiseGenerator noise_gen{seed};
+    const auto stats = noise_gen.generate(m_res, freq, ampl, N_OCTAVES, m_data);
     #ifndef NDEBUG
-        printInfo("Minimal density: %.2f", min_dens);
-        printInfo("Maximal density: %.2f", max_dens);
-        printInfo("Average density: %.2f", avg_dens / static_cast<float>(m_res.x * m_res.y * m_res.z));
+        printInfo("Minimal density: %.2f", stats.min_val);
+        printInfo("Maximal density: %.2f", stats.max_val);
+        printInfo("Average density: %.2f", stats.avg_val);
     #endif
     // Save it to disk
     write("Assets\\df.3dt");
     // Load data into OpenGL texture
     createTex();
-    // Preintegrate density values along primary rays
-    computePiDensity(cam, scene);
+    #ifdef GPU_PI_DENSITY
+        // Density values will be preintegrated on the GPU
+        allocPiDensity(cam);
+    #else
+        // Preintegrate density values along primary rays
+        computePiDensity(cam, scene);
+    #endif
 }
 
 DensityField::DensityField(const BBox& bb, const char* const dens_file_name,
-                           const char* const pi_dens_file_name): m_bbox{bb} {
+                           const char* const pi_dens_file_name, const PerspectiveCamera& cam):
+                           m_bbox{bb}, m_pi_dens_data{nullptr}, m_pi_dens_tex_handle{0},
+                           m_pi_dens_dirty{nullptr}, m_n_dirty_packets{0}, m_dirty_cursor{0} {
     read(dens_file_name);
     createTex();
-    readPiDens(pi_dens_file_name);
-    createPiDensTex();
+    #ifdef GPU_PI_DENSITY
+        // Density values will be preintegrated on the GPU
+        allocPiDensity(cam);
+    #else
+        readPiDens(pi_dens_file_name);
+        createPiDensTex();
+    #endif
 }
 
 DensityField::DensityField(const DensityField& df): m_bbox{df.m_bbox}, m_res{df.m_res},
                                                     m_data{new GLubyte[df.size()]},
-                                                    m_pi_dens_res{df.m_pi_dens_res},
-                                                    m_pi_dens_data{df.m_pi_dens_data} {
+                                                    m_pi_dens_dirty{df.m_pi_dens_dirty},
+                                                    m_n_dirty_packets{df.m_n_dirty_packets},
+                                                    m_dirty_cursor{df.m_dirty_cursor} {
     memcpy(m_data, df.m_data, df.size() * sizeof(GLubyte));
     createTex();
-    if (m_pi_dens_data) {
-        m_pi_dens_data = new GLfloat[df.piDensSize()];
-        memcpy(m_pi_dens_data, df.m_pi_dens_data, df.piDensSize() * sizeof(GLfloat));
-        createPiDensTex();
+    copyPiDensity(df);
+    if (m_pi_dens_dirty) {
+        m_pi_dens_dirty = new GLubyte[df.numPiDensPackets()];
+        memcpy(m_pi_dens_dirty, df.m_pi_dens_dirty, df.numPiDensPackets() * sizeof(GLubyte));
     }
 }
 
@@ -116,25 +87,32 @@ DensityField& DensityField::operator=(const DensityField& df) {
         m_bbox = df.m_bbox;
         m_res  = df.m_res;
         m_data = new GLubyte[df.size()];
-        m_pi_dens_res = df.m_pi_dens_res;
         memcpy(m_data, df.m_data, df.size() * sizeof(GLubyte));
         createTex();
-        if (df.m_pi_dens_data) {
-            m_pi_dens_data = new GLfloat[df.piDensSize()];
-            memcpy(m_pi_dens_data, df.m_pi_dens_data, df.piDensSize() * sizeof(GLfloat));
-            createPiDensTex();
+        copyPiDensity(df);
+        if (df.m_pi_dens_dirty) {
+            m_pi_dens_dirty = new GLubyte[df.numPiDensPackets()];
+            memcpy(m_pi_dens_dirty, df.m_pi_dens_dirty, df.numPiDensPackets() * sizeof(GLubyte));
         } else {
-            m_pi_dens_data = nullptr;
+            m_pi_dens_dirty = nullptr;
         }
+        m_n_dirty_packets = df.m_n_dirty_packets;
+        m_dirty_cursor    = df.m_dirty_cursor;
     }
     return *this;
 }
 
 DensityField::DensityField(DensityField&& df): m_bbox{df.m_bbox}, m_res{df.m_res},
                                                m_data{df.m_data}, m_tex_handle{df.m_tex_handle},
+                                               m_n_levels{df.m_n_levels},
+                                               m_mip_data{df.m_mip_data},
                                                m_pi_dens_res{df.m_pi_dens_res},
                                                m_pi_dens_data{df.m_pi_dens_data},
-                                               m_pi_dens_tex_handle{df.m_pi_dens_tex_handle} {
+                                               m_pi_dens_tex_handle{df.m_pi_dens_tex_handle},
+                                               m_pi_dens_dirty{df.m_pi_dens_dirty},
+                                               m_n_dirty_packets{df.m_n_dirty_packets},
+                                               m_dirty_cursor{df.m_dirty_cursor} {
+    memcpy(m_mip_offsets, df.m_mip_offsets, sizeof(m_mip_offsets));
     // Mark as moved
     df.m_tex_handle = 0;
 }
@@ -160,10 +138,11 @@ DensityField::~DensityField() {
 void DensityField::destroy() {
     gl::DeleteTextures(1, &m_tex_handle);
     delete[] m_data;
-    if (m_pi_dens_data) {
-        gl::DeleteTextures(1, &m_pi_dens_tex_handle);
-        delete[] m_pi_dens_data;
-    };
+    delete[] m_mip_data;
+    // Preintegrated density values may only reside on the GPU
+    gl::DeleteTextures(1, &m_pi_dens_tex_handle);
+    delete[] m_pi_dens_data;
+    delete[] m_pi_dens_dirty;
 }
 
 const BBox& DensityField::bbox() const {
@@ -177,8 +156,57 @@ BBox::IntDist DensityField::intersect(const rt::Ray& ray) const {
 float DensityField::sampleDensity(const vec3& pos) const {
     // Compute normalized position [0..1]^3
     const vec3 n_pos{m_bbox.computeNormPos(pos)};
+    return sampleLevel(n_pos, 0, 0);
+}
+
+float DensityField::sampleDensity(const vec3& pos, const float lod) const {
+    // Compute normalized position [0..1]^3
+    const vec3  n_pos{m_bbox.computeNormPos(pos)};
+    const float c_lod{glm::clamp(lod, 0.0f, static_cast<float>(m_n_levels - 1))};
+    const int   lvl{static_cast<int>(c_lod)};
+    const float t{c_lod - lvl};
+    const float dens{sampleLevel(n_pos, lvl, 0)};
+    // Interpolate between the two closest MIP levels
+    return (t > 0.0f) ? lerp1D(dens, sampleLevel(n_pos, lvl + 1, 0), t) : dens;
+}
+
+float DensityField::sampleMaxDensity(const vec3& p0, const vec3& p1) const {
+    // Compute the half-extent of the segment in voxels
+    const vec3  texels_per_unit{vec3{m_res} / m_bbox.dimensions()};
+    const vec3  half_ext{0.5f * glm::abs(p1 - p0) * texels_per_unit};
+    // Trilinear interpolation reads voxels up to 1.5 voxels (to their far faces) away
+    const float radius{max(max(half_ext.x, half_ext.y), half_ext.z) + 1.5f};
+    // The 2x2x2 texels around a point extend at least half a texel beyond it
+    // (assuming power-of-two resolution); the coarsest level covers the entire volume
+    const int  lvl{min(static_cast<int>(ceil(glm::log2(2.0f * radius))), m_n_levels - 1)};
+    const vec3 n_pos{m_bbox.computeNormPos(0.5f * (p0 + p1))};
+    // Interpolation is not conservative; use the maximum of the neighbouring samples instead
+    const vec3 tex_coord{n_pos * vec3{mipRes(lvl)} - vec3{0.5f}};
+    const int  x{static_cast<int>(floor(tex_coord.x))};
+    const int  y{static_cast<int>(floor(tex_coord.y))};
+    const int  z{static_cast<int>(floor(tex_coord.z))};
+    float max_dens{0.0f};
+    for (int k = 0; k < 8; ++k) {
+        max_dens = max(max_dens, sample(x + (k & 1), y + ((k >> 1) & 1), z + (k >> 2), lvl, 1));
+    }
+    return max_dens;
+}
+
+float DensityField::computeLod(const float step) const {
+    // Use the largest texel footprint, just as OpenGL does
+    const vec3  texels_per_unit{vec3{m_res} / m_bbox.dimensions()};
+    const float texels_per_step{step * max(max(texels_per_unit.x, texels_per_unit.y),
+                                           texels_per_unit.z)};
+    if (texels_per_step > 1.0f) {
+        return min(glm::log2(texels_per_step), static_cast<float>(m_n_levels - 1));
+    } else {
+        return 0.0f;
+    }
+}
+
+float DensityField::sampleLevel(const vec3& n_pos, const int lvl, const int ch) const {
     // Compute texel coordinate
-    vec3 tex_coord{n_pos * vec3{m_res}};
+    vec3 tex_coord{n_pos * vec3{mipRes(lvl)}};
     // Use voxel centers as texel values, just as OpenGL does
     tex_coord -= vec3{0.5f};
     // Compute pixel coordinates
@@ -189,14 +217,14 @@ float DensityField::sampleDensity(const vec3& pos) const {
     const float tx{tex_coord.x - x[0]};
     const float ty{tex_coord.y - y[0]};
     const float tz{tex_coord.z - z[0]};
-    const float d000{sample(x[0], y[0], z[0])};
-    const float d100{sample(x[1], y[0], z[0])};
-    const float d010{sample(x[0], y[1], z[0])};
-    const float d110{sample(x[1], y[1], z[0])};
-    const float d001{sample(x[0], y[0], z[1])};
-    const float d101{sample(x[1], y[0], z[1])};
-    const float d011{sample(x[0], y[1], z[1])};
-    const float d111{sample(x[1], y[1], z[1])};
+    const float d000{sample(x[0], y[0], z[0], lvl, ch)};
+    const float d100{sample(x[1], y[0], z[0], lvl, ch)};
+    const float d010{sample(x[0], y[1], z[0], lvl, ch)};
+    const float d110{sample(x[1], y[1], z[0], lvl, ch)};
+    const float d001{sample(x[0], y[0], z[1], lvl, ch)};
+    const float d101{sample(x[1], y[0], z[1], lvl, ch)};
+    const float d011{sample(x[0], y[1], z[1], lvl, ch)};
+    const float d111{sample(x[1], y[1], z[1], lvl, ch)};
     // Perform trilinear interpolation
     return lerp3D(d000, d100, d010, d110, d001, d101, d011, d111, tx, ty, tz);
 }
@@ -210,6 +238,73 @@ float DensityField::sample(const GLsizei x, const GLsizei y, const GLsizei z) co
     return 0.0f;
 }
 
+float DensityField::sample(const GLsizei x, const GLsizei y, const GLsizei z,
+                           const int lvl, const int ch) const {
+    if (0 == lvl) {
+        // Both the average and the maximum are equal to the voxel value
+        return sample(x, y, z);
+    }
+    const ivec3 res{mipRes(lvl)};
+    if (x >= 0 && x < res.x &&
+        y >= 0 && y < res.y &&
+        z >= 0 && z < res.z ) {
+        return mipLevel(lvl)[2 * (x + y * res.x + z * res.x * res.y) + ch] / 255.0f;
+    }
+    return 0.0f;
+}
+
+ivec3 DensityField::mipRes(const int lvl) const {
+    return max(ivec3{m_res.x >> lvl, m_res.y >> lvl, m_res.z >> lvl}, ivec3{1});
+}
+
+const GLubyte* DensityField::mipLevel(const int lvl) const {
+    assert(0 < lvl && lvl < m_n_levels);
+    return m_mip_data + m_mip_offsets[lvl];
+}
+
+void DensityField::buildMipPyramid() {
+    // Use the same number of levels as a complete OpenGL MIP chain
+    m_n_levels = static_cast<int>(floor(glm::log2(static_cast<float>(
+                                  max(max(m_res.x, m_res.y), m_res.z))))) + 1;
+    assert(m_n_levels <= MAX_DENS_LVLS);
+    // Levels are stored consecutively
+    GLsizei mip_size{0};
+    for (int l = 1; l < m_n_levels; ++l) {
+        const ivec3 res{mipRes(l)};
+        m_mip_offsets[l] = mip_size;
+        mip_size += 2 * res.x * res.y * res.z;
+    }
+    m_mip_data = new GLubyte[max(mip_size, 1)];
+    for (int l = 1; l < m_n_levels; ++l) {
+        const ivec3    prev_res{mipRes(l - 1)};
+        const ivec3    res{mipRes(l)};
+        GLubyte* const dst{const_cast<GLubyte*>(mipLevel(l))};
+        // Combine 2x2x2 blocks of the previous level
+        #pragma omp parallel for
+        for (int z = 0; z < res.z; ++z)
+        for (int y = 0; y < res.y; ++y)
+        for (int x = 0; x < res.x; ++x) {
+            int     sum{0};
+            GLubyte max_val{0};
+            for (int k = 0; k < 8; ++k) {
+                // Clamp to the edge for odd resolutions
+                const int p_x{min(2 * x + (k & 1),        prev_res.x - 1)};
+                const int p_y{min(2 * y + ((k >> 1) & 1), prev_res.y - 1)};
+                const int p_z{min(2 * z + (k >> 2),       prev_res.z - 1)};
+                const int idx{p_x + p_y * prev_res.x + p_z * prev_res.x * prev_res.y};
+                const GLubyte avg_val{(1 == l) ? m_data[idx] : mipLevel(l - 1)[2 * idx]};
+                const GLubyte top_val{(1 == l) ? m_data[idx] : mipLevel(l - 1)[2 * idx + 1]};
+                sum    += avg_val;
+                max_val = max(max_val, top_val);
+            }
+            const int idx{x + y * res.x + z * res.x * res.y};
+            // Round to the nearest integer
+            dst[2 * idx]     = static_cast<GLubyte>((sum + 4) / 8);
+            dst[2 * idx + 1] = max_val;
+        }
+    }
+}
+
 void DensityField::read(const char* const file_name) {
     // Open file
     auto file = fopen(file_name, "rb");
@@ -250,22 +345,39 @@ GLsizei DensityField::size() const {
 }
 
 void DensityField::createTex() {
+    // Compute the MIP pyramid
+    buildMipPyramid();
     // Use texture unit 0
     gl::ActiveTexture(gl::TEXTURE0 + TEX_U_DENS_V);
     // Allocate texture storage
     gl::GenTextures(1, &m_tex_handle);
     gl::BindTexture(gl::TEXTURE_3D, m_tex_handle);
-    gl::TexStorage3D(gl::TEXTURE_3D, 1, gl::R8, m_res.x, m_res.y, m_res.z);
-    // Use trilinear texture filering
+    gl::TexStorage3D(gl::TEXTURE_3D, m_n_levels, gl::RG8, m_res.x, m_res.y, m_res.z);
+    // Use trilinear texture filering, and linearly interpolate between MIP levels
     gl::TexParameteri(gl::TEXTURE_3D, gl::TEXTURE_MAG_FILTER, gl::LINEAR);
-    gl::TexParameteri(gl::TEXTURE_3D, gl::TEXTURE_MIN_FILTER, gl::LINEAR);
+    gl::TexParameteri(gl::TEXTURE_3D, gl::TEXTURE_MIN_FILTER, gl::LINEAR_MIPMAP_LINEAR);
     // Use border-clamping for all 3 dimensions
     gl::TexParameteri(gl::TEXTURE_3D, gl::TEXTURE_WRAP_S, gl::CLAMP_TO_BORDER);
     gl::TexParameteri(gl::TEXTURE_3D, gl::TEXTURE_WRAP_T, gl::CLAMP_TO_BORDER);
     gl::TexParameteri(gl::TEXTURE_3D, gl::TEXTURE_WRAP_R, gl::CLAMP_TO_BORDER);
+    // Rows of coarse levels are not 4-byte aligned
+    gl::PixelStorei(gl::UNPACK_ALIGNMENT, 1);
+    // The base level has the same average and maximal density values
+    GLubyte* const base_lvl{new GLubyte[2 * size()]};
+    for (GLsizei i = 0, n = size(); i < n; ++i) {
+        base_lvl[2 * i] = base_lvl[2 * i + 1] = m_data[i];
+    }
     // Upload the density data
     gl::TexSubImage3D(gl::TEXTURE_3D, 0, 0, 0, 0, m_res.x, m_res.y, m_res.z,
-                      gl::RED, gl::UNSIGNED_BYTE, m_data);
+                      gl::RG, gl::UNSIGNED_BYTE, base_lvl);
+    delete[] base_lvl;
+    for (int l = 1; l < m_n_levels; ++l) {
+        const ivec3 res{mipRes(l)};
+        gl::TexSubImage3D(gl::TEXTURE_3D, l, 0, 0, 0, res.x, res.y, res.z,
+                          gl::RG, gl::UNSIGNED_BYTE, mipLevel(l));
+    }
+    // Restore the default pixel storage parameters
+    gl::PixelStorei(gl::UNPACK_ALIGNMENT, 4);
 }
 
 void DensityField::computePiDensity(const PerspectiveCamera& cam, const Scene& scene) {
@@ -277,55 +389,249 @@ void DensityField::computePiDensity(const PerspectiveCamera& cam, const Scene& s
     // Set up render loop
     assert(0 == res.x % PACKET_SZ && 0 == res.y % PACKET_SZ);
     const ivec2 n_packets{cam.resolution() / PACKET_SZ};
-    #pragma omp parallel for
-    for (int p_j = 0; p_j < n_packets.y; ++p_j)
-        for (int p_i = 0; p_i < n_packets.x; ++p_i)
-            for (int p_y = 0; p_y < PACKET_SZ; ++p_y)
-                for (int p_x = 0; p_x < PACKET_SZ; ++p_x) {
-                    const int x{p_x + p_i * PACKET_SZ};
-                    const int y{p_y + p_j * PACKET_SZ};
-                    // Use pixel center: offset by 0.5
-                    rt::Ray ray{cam.getPrimaryRay(x + 0.5f, y + 0.5f)};
-                    // Intersect the bounding volume of density field
-                    const auto is = m_bbox.intersect(ray);
-                    if (is) {
-                        // Determine distance to the geometry
-                        scene.trace(ray);
-                        // Compute parametric ray bounds
-                        const float t_min{max(is.entr, 0.0f)};
-                        const float t_max{min(is.exit, ray.inters.distance)};
-                        // Sample density at interval endpoints
-                        const int   n_intervals{res.z * 4};
-                        const float dt{(t_max - t_min) / n_intervals};
-                        // Perform ray marching
-                        float prev_dens{sampleDensity(ray.o + t_min * ray.d)};
-                        float dens{0.0f};
-                        for (int i = 1; i <= n_intervals; ++i) {
-                            // Distance to the end of the interval
-                            const float t{t_min + i * dt};
-                            const float curr_dens{sampleDensity(ray.o + t * ray.d)};
-                            // Use trapezoidal rule for integration
-                            dens += 0.5f * (curr_dens + prev_dens);
-                            prev_dens = curr_dens;
-                            if (2 == i % 4) {
-                                // We are in the middle of the camera-space voxel (froxel)
-                                const int z{i / 4};
-                                m_pi_dens_data[x + y * res.x + z * res.x * res.y] = dens * dt;
-                            }
-                        }     
-                    } else {
-                        // Set density to zero along the ray
-                        for (int z = 0; z < res.z; ++z) {
-                            m_pi_dens_data[x + y * res.x + z * res.x * res.y] = 0.0f;
-                        }
-                    }
-                }
+    const int   n_total_packets{n_packets.x * n_packets.y};
+    // Packets which miss the fog are much cheaper than the rest; balance the load dynamically
+    #pragma omp parallel for schedule(dynamic)
+    for (int p = 0; p < n_total_packets; ++p) {
+        integratePacket(p % n_packets.x, p / n_packets.x, cam, scene);
+    }
     // Save it to disk
     writePiDens("Assets\\pi_df.3dt");
     // Load data into OpenGL texture
     createPiDensTex();
 }
 
+void DensityField::integratePacket(const int p_i, const int p_j, const PerspectiveCamera& cam,
+                                   const Scene& scene) {
+    static_assert(0 == PACKET_SZ % 4, "Packet size must be a multiple of SIMD width.");
+    TRACE_ZONE("Fog packet");
+    CONSTEXPR int n_rays{PACKET_SZ * PACKET_SZ};
+    const auto& res = m_pi_dens_res;
+    const int   n_intervals{res.z * 4};
+    // Ray data in SoA layout
+    float o[3][n_rays], d[3][n_rays], t_min[n_rays], dt[n_rays], lod[n_rays];
+    bool  hit[n_rays];
+    // Set up rays
+    for (int p_y = 0; p_y < PACKET_SZ; ++p_y)
+    for (int p_x = 0; p_x < PACKET_SZ; ++p_x) {
+        const int r{p_x + p_y * PACKET_SZ};
+        const int x{p_x + p_i * PACKET_SZ};
+        const int y{p_y + p_j * PACKET_SZ};
+        // Use pixel center: offset by 0.5
+        rt::Ray ray{cam.getPrimaryRay(x + 0.5f, y + 0.5f)};
+        // Intersect the bounding volume of density field
+        const auto is = m_bbox.intersect(ray);
+        hit[r] = is;
+        if (is) {
+            // Determine distance to the geometry
+            scene.trace(ray);
+            // Compute parametric ray bounds
+            t_min[r] = max(is.entr, 0.0f);
+            const float t_max{min(is.exit, ray.inters.distance)};
+            // Sample density at interval endpoints
+            dt[r] = (t_max - t_min[r]) / n_intervals;
+        } else {
+            t_min[r] = 0.0f;
+            dt[r]    = 0.0f;
+        }
+        // Pick the MIP level based on the step size
+        lod[r] = computeLod(dt[r]);
+        for (int k = 0; k < 3; ++k) {
+            o[k][r] = ray.o[k];
+            d[k][r] = ray.d[k];
+        }
+    }
+    // Perform ray marching, 4 rays at a time
+    for (int r = 0; r < n_rays; r += 4) {
+        // Pixel coordinates of the first ray (the other 3 follow in X)
+        const int x{r % PACKET_SZ + p_i * PACKET_SZ};
+        const int y{r / PACKET_SZ + p_j * PACKET_SZ};
+        float* const dst{&m_pi_dens_data[x + y * res.x]};
+        if (!hit[r] && !hit[r + 1] && !hit[r + 2] && !hit[r + 3]) {
+            // Set density to zero along the rays
+            for (int z = 0; z < res.z; ++z) {
+                _mm_storeu_ps(dst + z * res.x * res.y, _mm_setzero_ps());
+            }
+            continue;
+        }
+        if (lod[r] > 0.0f || lod[r + 1] > 0.0f || lod[r + 2] > 0.0f || lod[r + 3] > 0.0f) {
+            // Steps are larger than voxels; march through coarser MIP levels one ray at a time
+            for (int l = 0; l < 4; ++l) {
+                if (!hit[r + l]) {
+                    // Set density to zero along the ray
+                    for (int z = 0; z < res.z; ++z) {
+                        dst[l + z * res.x * res.y] = 0.0f;
+                    }
+                    continue;
+                }
+                const vec3 ray_o{o[0][r + l], o[1][r + l], o[2][r + l]};
+                const vec3 ray_d{d[0][r + l], d[1][r + l], d[2][r + l]};
+                float prev_dens{sampleDensity(ray_o + t_min[r + l] * ray_d, lod[r + l])};
+                float dens{0.0f};
+                for (int i = 1; i <= n_intervals; ++i) {
+                    // Distance to the end of the interval
+                    const float t{t_min[r + l] + i * dt[r + l]};
+                    const float curr_dens{sampleDensity(ray_o + t * ray_d, lod[r + l])};
+                    // Use trapezoidal rule for integration
+                    dens += 0.5f * (curr_dens + prev_dens);
+                    prev_dens = curr_dens;
+                    if (2 == i % 4) {
+                        // We are in the middle of the camera-space voxel (froxel)
+                        dst[l + (i / 4) * res.x * res.y] = dens * dt[r + l];
+                    }
+                }
+            }
+            continue;
+        }
+        const __m128 ray_o[3] = {_mm_loadu_ps(&o[0][r]), _mm_loadu_ps(&o[1][r]),
+                                 _mm_loadu_ps(&o[2][r])};
+        const __m128 ray_d[3] = {_mm_loadu_ps(&d[0][r]), _mm_loadu_ps(&d[1][r]),
+                                 _mm_loadu_ps(&d[2][r])};
+        const __m128 ray_t_min{_mm_loadu_ps(&t_min[r])};
+        const __m128 ray_dt{_mm_loadu_ps(&dt[r])};
+        const __m128 half{_mm_set1_ps(0.5f)};
+        // Computes sample positions at the parametric distance t
+        auto rayPoints = [&](const __m128 t, __m128 (&pos)[3]) {
+            for (int k = 0; k < 3; ++k) {
+                pos[k] = _mm_add_ps(ray_o[k], _mm_mul_ps(t, ray_d[k]));
+            }
+        };
+        __m128 pos[3];
+        rayPoints(ray_t_min, pos);
+        __m128 prev_dens{sampleDensity4(pos)};
+        __m128 dens{_mm_setzero_ps()};
+        for (int i = 1; i <= n_intervals; ++i) {
+            // Distance to the end of the interval
+            const __m128 t{_mm_add_ps(ray_t_min, _mm_mul_ps(_mm_set1_ps(static_cast<float>(i)),
+                                                            ray_dt))};
+            rayPoints(t, pos);
+            const __m128 curr_dens{sampleDensity4(pos)};
+            // Use trapezoidal rule for integration
+            dens = _mm_add_ps(dens, _mm_mul_ps(half, _mm_add_ps(curr_dens, prev_dens)));
+            prev_dens = curr_dens;
+            if (2 == i % 4) {
+                // We are in the middle of the camera-space voxel (froxel)
+                const int z{i / 4};
+                _mm_storeu_ps(dst + z * res.x * res.y, _mm_mul_ps(dens, ray_dt));
+            }
+        }
+        // Rays which missed the fog have to be zeroed explicitly
+        for (int l = 0; l < 4; ++l) {
+            if (!hit[r + l]) {
+                for (int z = 0; z < res.z; ++z) {
+                    dst[l + z * res.x * res.y] = 0.0f;
+                }
+            }
+        }
+    }
+}
+
+__m128 DensityField::sampleDensity4(const __m128 (&pos)[3]) const {
+    const vec3& pt_min{m_bbox.minPt()};
+    const vec3  dims{m_bbox.dimensions()};
+    __m128 frac[3];
+    int    coord[3][4];
+    for (int k = 0; k < 3; ++k) {
+        // Compute normalized position [0..1]^3
+        const __m128 n_pos{_mm_div_ps(_mm_sub_ps(pos[k], _mm_set1_ps(pt_min[k])),
+                                      _mm_set1_ps(dims[k]))};
+        // Compute texel coordinate
+        // Use voxel centers as texel values, just as OpenGL does
+        const __m128 res_k{_mm_set1_ps(static_cast<float>(m_res[k]))};
+        const __m128 tex_coord{_mm_sub_ps(_mm_mul_ps(n_pos, res_k), _mm_set1_ps(0.5f))};
+        // Compute pixel coordinates: floor() using truncation with a fix-up for negatives
+        __m128i    i_coord{_mm_cvttps_epi32(tex_coord)};
+        const auto is_neg = _mm_castps_si128(_mm_cmplt_ps(tex_coord,
+                                                          _mm_cvtepi32_ps(i_coord)));
+        i_coord = _mm_add_epi32(i_coord, is_neg);
+        frac[k] = _mm_sub_ps(tex_coord, _mm_cvtepi32_ps(i_coord));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(coord[k]), i_coord);
+    }
+    // Obtain neighbouring samples
+    // If the coordinate is integral, the upper sample gets zero weight
+    float d[8][4];
+    for (int l = 0; l < 4; ++l) {
+        const int x{coord[0][l]}, y{coord[1][l]}, z{coord[2][l]};
+        d[0][l] = sample(x,     y,     z);
+        d[1][l] = sample(x + 1, y,     z);
+        d[2][l] = sample(x,     y + 1, z);
+        d[3][l] = sample(x + 1, y + 1, z);
+        d[4][l] = sample(x,     y,     z + 1);
+        d[5][l] = sample(x + 1, y,     z + 1);
+        d[6][l] = sample(x,     y + 1, z + 1);
+        d[7][l] = sample(x + 1, y + 1, z + 1);
+    }
+    // Perform trilinear interpolation
+    auto lerp = [](const __m128 v0, const __m128 v1, const __m128 t) {
+        return _mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.0f), t), v0), _mm_mul_ps(t, v1));
+    };
+    __m128 d_x[4];
+    for (int k = 0; k < 4; ++k) {
+        d_x[k] = lerp(_mm_loadu_ps(d[2 * k]), _mm_loadu_ps(d[2 * k + 1]), frac[0]);
+    }
+    const __m128 d_xy0{lerp(d_x[0], d_x[1], frac[1])};
+    const __m128 d_xy1{lerp(d_x[2], d_x[3], frac[1])};
+    return lerp(d_xy0, d_xy1, frac[2]);
+}
+
+#ifndef GPU_PI_DENSITY
+void DensityField::invalidatePiDensity() {
+    assert(m_pi_dens_data);
+    const int n_total_packets{numPiDensPackets()};
+    if (!m_pi_dens_dirty) {
+        m_pi_dens_dirty = new GLubyte[n_total_packets];
+    }
+    memset(m_pi_dens_dirty, 1, n_total_packets * sizeof(GLubyte));
+    m_n_dirty_packets = n_total_packets;
+    m_dirty_cursor    = 0;
+}
+
+bool DensityField::updatePiDensity(const PerspectiveCamera& cam, const Scene& scene,
+                                   const uint budget_ms) {
+    if (0 == m_n_dirty_packets) {
+        // Nothing to do
+        return true;
+    }
+    assert(cam.resolution() == ivec2(m_pi_dens_res));
+    const uint t_start{HighResTimer::time_ms()};
+    const int  n_total_packets{numPiDensPackets()};
+    const int  n_packets_x{m_pi_dens_res.x / PACKET_SZ};
+    // Packets are processed in parallel batches; the time budget is checked between batches
+    CONSTEXPR int batch_sz{32};
+    int batch[batch_sz];
+    do {
+        TRACE_ZONE("Fog batch");
+        // Collect a batch of out of date packets
+        int n_batch_packets{0};
+        while (n_batch_packets < batch_sz && m_n_dirty_packets > 0) {
+            if (m_pi_dens_dirty[m_dirty_cursor]) {
+                m_pi_dens_dirty[m_dirty_cursor] = 0;
+                --m_n_dirty_packets;
+                batch[n_batch_packets++] = m_dirty_cursor;
+            }
+            m_dirty_cursor = (m_dirty_cursor + 1) % n_total_packets;
+        }
+        // Recompute them
+        #pragma omp parallel for schedule(dynamic)
+        for (int b = 0; b < n_batch_packets; ++b) {
+            integratePacket(batch[b] % n_packets_x, batch[b] / n_packets_x, cam, scene);
+        }
+        // Stream the results into the texture
+        gl::ActiveTexture(gl::TEXTURE0 + TEX_U_PI_DENS);
+        gl::BindTexture(gl::TEXTURE_3D, m_pi_dens_tex_handle);
+        gl::PixelStorei(gl::UNPACK_ROW_LENGTH,   m_pi_dens_res.x);
+        gl::PixelStorei(gl::UNPACK_IMAGE_HEIGHT, m_pi_dens_res.y);
+        for (int b = 0; b < n_batch_packets; ++b) {
+            uploadPiDensPacket(batch[b] % n_packets_x, batch[b] / n_packets_x);
+        }
+        // Restore the default pixel storage parameters
+        gl::PixelStorei(gl::UNPACK_ROW_LENGTH,   0);
+        gl::PixelStorei(gl::UNPACK_IMAGE_HEIGHT, 0);
+    } while (m_n_dirty_packets > 0 && HighResTimer::time_ms() - t_start < budget_ms);
+    return 0 == m_n_dirty_packets;
+}
+#endif
+
 void DensityField::readPiDens(const char* const file_name) {
     // Open file
     auto file = fopen(file_name, "rb");
@@ -365,6 +671,32 @@ GLsizei DensityField::piDensSize() const {
     return m_pi_dens_res.x * m_pi_dens_res.y * m_pi_dens_res.z;
 }
 
+void DensityField::allocPiDensity(const PerspectiveCamera& cam) {
+    m_pi_dens_res  = ivec3{cam.resolution(), m_res.z};
+    m_pi_dens_data = nullptr;
+    createPiDensTex();
+}
+
+void DensityField::copyPiDensity(const DensityField& df) {
+    m_pi_dens_res = df.m_pi_dens_res;
+    if (df.m_pi_dens_data) {
+        m_pi_dens_data = new GLfloat[df.piDensSize()];
+        memcpy(m_pi_dens_data, df.m_pi_dens_data, df.piDensSize() * sizeof(GLfloat));
+        createPiDensTex();
+    } else {
+        m_pi_dens_data = nullptr;
+        createPiDensTex();
+        // Copy the values computed on the GPU
+        gl::CopyImageSubData(df.m_pi_dens_tex_handle, gl::TEXTURE_3D, 0, 0, 0, 0,
+                             m_pi_dens_tex_handle,    gl::TEXTURE_3D, 0, 0, 0, 0,
+                             m_pi_dens_res.x, m_pi_dens_res.y, m_pi_dens_res.z);
+    }
+}
+
+int DensityField::numPiDensPackets() const {
+    return (m_pi_dens_res.x / PACKET_SZ) * (m_pi_dens_res.y / PACKET_SZ);
+}
+
 void DensityField::createPiDensTex() {
     // Use texture unit 0
     gl::ActiveTexture(gl::TEXTURE0 + TEX_U_PI_DENS);
@@ -380,7 +712,67 @@ void DensityField::createPiDensTex() {
     gl::TexParameteri(gl::TEXTURE_3D, gl::TEXTURE_WRAP_S, gl::CLAMP_TO_EDGE);
     gl::TexParameteri(gl::TEXTURE_3D, gl::TEXTURE_WRAP_T, gl::CLAMP_TO_EDGE);
     gl::TexParameteri(gl::TEXTURE_3D, gl::TEXTURE_WRAP_R, gl::CLAMP_TO_EDGE);
-    // Upload the preintegrated density data
-    gl::TexSubImage3D(gl::TEXTURE_3D, 0, 0, 0, 0, m_pi_dens_res.x, m_pi_dens_res.y,
-                      m_pi_dens_res.z, gl::RED, gl::FLOAT, m_pi_dens_data);
+    if (m_pi_dens_data) {
+        // Upload the preintegrated density data
+        gl::TexSubImage3D(gl::TEXTURE_3D, 0, 0, 0, 0, m_pi_dens_res.x, m_pi_dens_res.y,
+                          m_pi_dens_res.z, gl::RED, gl::FLOAT, m_pi_dens_data);
+    }
+    #ifdef GPU_PI_DENSITY
+        // Bind all layers to the image unit for writing by the compute shader
+        gl::BindImageTexture(IMG_U_PI_DENS, m_pi_dens_tex_handle,
+                             0, true, 0, gl::WRITE_ONLY, gl::R32F);
+    #endif
+}
+
+void DensityField::uploadPiDensPacket(const int p_i, const int p_j) {
+    // Assumes that the texture is bound, and the pixel storage parameters are set
+    const int x{p_i * PACKET_SZ};
+    const int y{p_j * PACKET_SZ};
+    gl::TexSubImage3D(gl::TEXTURE_3D, 0, x, y, 0, PACKET_SZ, PACKET_SZ, m_pi_dens_res.z,
+                      gl::RED, gl::FLOAT, &m_pi_dens_data[x + y * m_pi_dens_res.x]);
+}
+
+#if defined(GPU_PI_DENSITY) && !defined(NDEBUG)
+void DensityField::validatePiDensity(const PerspectiveCamera& cam, const Scene& scene) {
+    assert(!m_pi_dens_data);
+    printInfo("Validating GPU density preintegration.");
+    // Read back the values computed on the GPU
+    const GLsizei n_values{piDensSize()};
+    GLfloat* const gpu_data{new GLfloat[n_values]};
+    gl::MemoryBarrier(gl::TEXTURE_UPDATE_BARRIER_BIT);
+    gl::ActiveTexture(gl::TEXTURE0 + TEX_U_PI_DENS);
+    gl::BindTexture(gl::TEXTURE_3D, m_pi_dens_tex_handle);
+    gl::GetTexImage(gl::TEXTURE_3D, 0, gl::RED, gl::FLOAT, gpu_data);
+    // Compute the CPU reference for every 16th packet in each dimension
+    CONSTEXPR int   packet_stride{16};
+    CONSTEXPR float tolerance{0.01f};
+    m_pi_dens_data = new GLfloat[n_values];
+    const ivec2 n_packets{cam.resolution() / PACKET_SZ};
+    int   n_tested{0}, n_failed{0};
+    float max_err{0.0f};
+    for (int p_j = 0; p_j < n_packets.y; p_j += packet_stride)
+    for (int p_i = 0; p_i < n_packets.x; p_i += packet_stride) {
+        integratePacket(p_i, p_j, cam, scene);
+        for (int z = 0; z < m_pi_dens_res.z; ++z)
+        for (int y = p_j * PACKET_SZ, y_e = y + PACKET_SZ; y < y_e; ++y)
+        for (int x = p_i * PACKET_SZ, x_e = x + PACKET_SZ; x < x_e; ++x) {
+            const int   idx{x + y * m_pi_dens_res.x + z * m_pi_dens_res.x * m_pi_dens_res.y};
+            const float cpu_val{m_pi_dens_data[idx]};
+            // Use relative error for large values, and absolute error for small ones
+            const float err{std::abs(gpu_data[idx] - cpu_val) / max(std::abs(cpu_val), 1.0f)};
+            max_err = max(max_err, err);
+            if (err > tolerance) ++n_failed;
+            ++n_tested;
+        }
+    }
+    delete[] m_pi_dens_data;
+    m_pi_dens_data = nullptr;
+    delete[] gpu_data;
+    // Geometric silhouettes are rasterized and raytraced slightly differently
+    // Therefore, tolerate a small fraction of outliers
+    printInfo("Max. error: %.4f, values out of tolerance: %d/%d.", max_err, n_failed, n_tested);
+    if (n_failed > n_tested / 100) {
+        printError("GPU density preintegration does not match the CPU reference.");
+    }
 }
+#endif
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <xmmintrin.h>
 #include <GLM\vec3.hpp>
 #include <OpenGL\gl_basic_typedefs.h>
 #include "..\Common\BBox.h"
+#include "..\Common\Constants.h"
 
 class Scene;
 class PerspectiveCamera;
@@ -12,40 +14,92 @@ class DensityField {
 public:
     DensityField() = delete;
     RULE_OF_FIVE(DensityField);
-    // Constructor that generates density field using simplex noise
+    // Constructor that generates density field using fractal gradient noise
     explicit DensityField(const BBox& bb, const int(&res)[3], const float freq, const float ampl,
-                          const PerspectiveCamera& cam, const Scene& scene);
+                          const uint seed, const PerspectiveCamera& cam, const Scene& scene);
     // Constructor that reads density field and preintegrated density values from .3dt files
+    // If GPU_PI_DENSITY is defined, preintegrated density values are not read
     explicit DensityField(const BBox& bb, const char* const dens_file_name,
-                          const char* const pi_dens_file_name);
+                          const char* const pi_dens_file_name, const PerspectiveCamera& cam);
     // Returns bounding box/volume
     const BBox& bbox() const;
     // Returns bounding volume entry and exit distances
     BBox::IntDist intersect(const rt::Ray& ray) const;
     // Samples density at a given spatial position
     float sampleDensity(const glm::vec3& pos) const;
+    // Samples (average) density at a given spatial position using a fractional MIP level
+    float sampleDensity(const glm::vec3& pos, const float lod) const;
+    // Returns a conservative estimate of maximal density along a line segment
+    // The estimate is valid for density sampled at the base level (and all coarser levels)
+    float sampleMaxDensity(const glm::vec3& p0, const glm::vec3& p1) const;
+    // Computes the MIP level appropriate for ray marching with the specified step size
+    float computeLod(const float step) const;
+    // Progressive updates are only performed by the CPU path
+    // (the GPU path preintegrates density again using the compute shader)
+    #ifndef GPU_PI_DENSITY
+        // Marks preintegrated density of all packets as out of date (e.g. after camera motion)
+        void invalidatePiDensity();
+        // Recomputes out of date packets for (approximately) at most 'budget_ms' milliseconds,
+        // and streams them into the preintegrated density texture
+        // Returns 'true' if preintegrated density is up to date
+        bool updatePiDensity(const PerspectiveCamera& cam, const Scene& scene,
+                             const uint budget_ms);
+    #endif
+    #if defined(GPU_PI_DENSITY) && !defined(NDEBUG)
+        // Compares preintegrated density values computed on the GPU with the CPU reference
+        // Only a subset of packets is verified
+        void validatePiDensity(const PerspectiveCamera& cam, const Scene& scene);
+    #endif
 private:
     // Returns a density sample
     float sample(const GLsizei x, const GLsizei y, const GLsizei z) const;
+    // Returns a density sample of the specified MIP level
+    // Channel 0 contains average density, channel 1 contains maximal density
+    float sample(const GLsizei x, const GLsizei y, const GLsizei z,
+                 const int lvl, const int ch) const;
+    // Samples a single MIP level at a normalized position using trilinear interpolation
+    float sampleLevel(const glm::vec3& n_pos, const int lvl, const int ch) const;
+    // Returns the resolution of the specified MIP level
+    glm::ivec3 mipRes(const int lvl) const;
+    // Returns average and maximal density values (interleaved) of the specified MIP level > 0
+    const GLubyte* mipLevel(const int lvl) const;
+    // Computes MIP levels 1 and higher, storing both average and maximal density values
+    void buildMipPyramid();
+    // Samples density at 4 spatial positions at once (SoA layout: X, Y, Z)
+    __m128 sampleDensity4(const __m128 (&pos)[3]) const;
     // Reads density values from file
     void read(const char* const file_name);
     // Writes density values to file
     void write(const char* const file_name) const;
     // Returns the size of the field, e.i. the number of stored density values
     GLsizei size() const;
-    // Creates a density texture in OpenGL
+    // Creates a mipmapped density texture in OpenGL (and computes the MIP pyramid)
+    // The red channel contains average density, the green channel contains maximal density
     void createTex();
     // Computes a 3D-texture with preintegrated camera-space density values
     // Numerically valuate e ^ (Int{0..d}(density(t))dt)
     void computePiDensity(const PerspectiveCamera& cam, const Scene& scene);
+    // Preintegrates density along the primary rays of a single PACKET_SZ x PACKET_SZ packet
+    // Rays are marched 4 at a time using SSE
+    void integratePacket(const int p_i, const int p_j, const PerspectiveCamera& cam,
+                         const Scene& scene);
     // Reads preintegrated density values from file
     void readPiDens(const char* const file_name);
     // Writes preintegrated density values to file
     void writePiDens(const char* const file_name) const;
     // Returns the size of preintegrated density data
     GLsizei piDensSize() const;
+    // Allocates (but does not compute) preintegrated density values on the GPU
+    void allocPiDensity(const PerspectiveCamera& cam);
+    // Copies preintegrated density values (and the texture) of another density field
+    void copyPiDensity(const DensityField& df);
     // Creates a preintegrated density texture in OpenGL
+    // If GPU_PI_DENSITY is defined, the texture is also bound to image unit IMG_U_PI_DENS
     void createPiDensTex();
+    // Uploads preintegrated density values of a single packet into OpenGL texture
+    void uploadPiDensPacket(const int p_i, const int p_j);
+    // Returns the total number of packets of preintegrated density
+    int numPiDensPackets() const;
     // Performs object destruction
     void destroy();
     // Private data members
@@ -53,7 +107,13 @@ private:
     glm::ivec3 m_res;                   // Resolution in X-Y-Z
     GLubyte*   m_data;                  // Scalar density data
     GLuint     m_tex_handle;            // Density texture OpenGL handle
+    int        m_n_levels;              // Number of MIP levels, including the base level
+    GLubyte*   m_mip_data;              // Avg. and max. density of MIP levels 1, 2, ...
+    GLsizei    m_mip_offsets[MAX_DENS_LVLS];    // Offsets of MIP levels within m_mip_data
     glm::ivec3 m_pi_dens_res;           // Resolution of preintegrated density in X-Y-Z
     GLfloat*   m_pi_dens_data;          // Preintegrated density data
     GLuint     m_pi_dens_tex_handle;    // Preintegrated density texture OpenGL handle
+    GLubyte*   m_pi_dens_dirty;         // Per-packet flags of out of date preintegrated density
+    int        m_n_dirty_packets;       // Number of out of date packets
+    int        m_dirty_cursor;          // Index of the packet to be checked for update next
 };
@@ -1,13 +1,14 @@
 #include "FogVolume.h"
 #include <utility>
+#include <GLM\common.hpp>
 
 using glm::vec3;
 
 
 FogVolume::FogVolume(const BBox& bb, const int (&res)[3], const float freq, const float ampl,
-                     const float maj_ext_k, const float abs_k, const float sca_k,
+                     const uint seed, const float maj_ext_k, const float abs_k, const float sca_k,
                      const PerspectiveCamera& cam, const Scene& scene):
-                     m_df{bb, res, freq, ampl, cam, scene}, m_abs_k{abs_k}, m_sca_k{sca_k},
+                     m_df{bb, res, freq, ampl, seed, cam, scene}, m_abs_k{abs_k}, m_sca_k{sca_k},
                      m_maj_ext_k{maj_ext_k} {}
 
 FogVolume::FogVolume(DensityField&& df, const float maj_ext_k, const float abs_k,
@@ -35,6 +36,13 @@ float FogVolume::sampleExtK(const vec3& pos) const {
     return ext_k * dens;
 }
 
+float FogVolume::sampleMajExtK(const vec3& p0, const vec3& p1) const {
+    const float max_dens{m_df.sampleMaxDensity(p0, p1)};
+    const float ext_k{m_abs_k + m_sca_k};
+    // The local majorant never exceeds the global one
+    return glm::min(ext_k * max_dens, m_maj_ext_k);
+}
+
 float FogVolume::sampleScaK(const vec3& pos) const {
     const float dens{m_df.sampleDensity(pos)};
     return m_sca_k * dens;
@@ -48,3 +56,20 @@ float FogVolume::getScaAlbedo() const {
 BBox::IntDist FogVolume::intersect(const rt::Ray& ray) const {
     return m_df.intersect(ray);
 }
+
+#ifndef GPU_PI_DENSITY
+void FogVolume::invalidatePiDensity() {
+    m_df.invalidatePiDensity();
+}
+
+bool FogVolume::updatePiDensity(const PerspectiveCamera& cam, const Scene& scene,
+                                const uint budget_ms) {
+    return m_df.updatePiDensity(cam, scene, budget_ms);
+}
+#endif
+
+#if defined(GPU_PI_DENSITY) && !defined(NDEBUG)
+void FogVolume::validatePiDensity(const PerspectiveCamera& cam, const Scene& scene) {
+    m_df.validatePiDensity(cam, scene);
+}
+#endif
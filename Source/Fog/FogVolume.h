@@ -11,7 +11,7 @@ public:
     RULE_OF_ZERO(FogVolume);
     // Constructor, computes the values of density field
     explicit FogVolume(const BBox& bb, const int(&res)[3], const float freq, const float ampl,
-                       const float maj_ext_k, const float abs_k,
+                       const uint seed, const float maj_ext_k, const float abs_k,
                        const float sca_k, const PerspectiveCamera& cam, const Scene& scene);
     // Constructor, uses the supplied density field
     explicit FogVolume(DensityField&& df, const float maj_ext_k,
@@ -24,12 +24,26 @@ public:
     float getMajExtK() const;
     // Samples extinction coefficient at a given position
     float sampleExtK(const glm::vec3& pos) const;
+    // Returns a majorant of extinction coefficient along a line segment
+    float sampleMajExtK(const glm::vec3& p0, const glm::vec3& p1) const;
     // Samples scattering coefficient at a given position
     float sampleScaK(const glm::vec3& pos) const;
     // Returns scattering albedo (constant across the entire volume)
     float getScaAlbedo() const;
     // Returns volume entry and exit distances
     BBox::IntDist intersect(const rt::Ray& ray) const;
+    #ifndef GPU_PI_DENSITY
+        // Marks all preintegrated density values as out of date
+        void invalidatePiDensity();
+        // Progressively updates out of date preintegrated density values within a time budget
+        // Returns 'true' if preintegrated density is up to date
+        bool updatePiDensity(const PerspectiveCamera& cam, const Scene& scene,
+                             const uint budget_ms);
+    #endif
+    #if defined(GPU_PI_DENSITY) && !defined(NDEBUG)
+        // Compares preintegrated density values computed on the GPU with the CPU reference
+        void validatePiDensity(const PerspectiveCamera& cam, const Scene& scene);
+    #endif
 private:
     // Private data members
     DensityField m_df;          // Scalar-valued particle density field
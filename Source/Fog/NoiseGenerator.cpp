@@ -0,0 +1,192 @@
+#include "NoiseGenerator.h"
+#include <cassert>
+#include <cfloat>
+#include <climits>
+#include <random>
+#include <algorithm>
+#include <emmintrin.h>
+#include <GLM\common.hpp>
+
+using glm::vec3;
+using glm::ivec3;
+using glm::min;
+using glm::max;
+
+// Returns a if mask is set, and b otherwise
+static inline __m128 select4(const __m128 mask, const __m128 a, const __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Computes floor(x) of 4 values using truncation with a fix-up for negatives
+static inline __m128i floor4(const __m128 x) {
+    const __m128i i{_mm_cvttps_epi32(x)};
+    const __m128i is_neg{_mm_castps_si128(_mm_cmplt_ps(x, _mm_cvtepi32_ps(i)))};
+    return _mm_add_epi32(i, is_neg);
+}
+
+// Evaluates the quintic fade curve: 6 * t^5 - 15 * t^4 + 10 * t^3
+static inline __m128 fade4(const __m128 t) {
+    const __m128 t_cb{_mm_mul_ps(_mm_mul_ps(t, t), t)};
+    const __m128 poly{_mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)),
+                                                          _mm_set1_ps(15.0f))),
+                                 _mm_set1_ps(10.0f))};
+    return _mm_mul_ps(t_cb, poly);
+}
+
+// Performs linear interpolation of 4 values
+static inline __m128 lerp4(const __m128 a, const __m128 b, const __m128 t) {
+    return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+// Computes dot products of (x, y, z) with one of 12 gradients (cube edge midpoints)
+// The gradients are selected using hash values
+static inline __m128 grad4(const __m128i hash, const __m128 x, const __m128 y, const __m128 z) {
+    const __m128i h{_mm_and_si128(hash, _mm_set1_epi32(15))};
+    const __m128  h_lt_8{_mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(8)))};
+    const __m128  h_lt_4{_mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)))};
+    const __m128  h_12_14{_mm_castsi128_ps(_mm_or_si128(_mm_cmpeq_epi32(h, _mm_set1_epi32(12)),
+                                                        _mm_cmpeq_epi32(h, _mm_set1_epi32(14))))};
+    const __m128  u{select4(h_lt_8, x, y)};
+    const __m128  v{select4(h_lt_4, y, select4(h_12_14, x, z))};
+    // The 2 lowest bits of the hash determine the signs
+    const __m128  sign_u{_mm_castsi128_ps(_mm_slli_epi32(h, 31))};
+    const __m128  sign_v{_mm_castsi128_ps(_mm_and_si128(_mm_slli_epi32(h, 30),
+                                                        _mm_set1_epi32(INT_MIN)))};
+    return _mm_add_ps(_mm_xor_ps(u, sign_u), _mm_xor_ps(v, sign_v));
+}
+
+NoiseGenerator::NoiseGenerator(const uint seed) {
+    // Generate a random permutation of [0, 255]
+    for (int i = 0; i < 256; ++i) {
+        m_perm[i] = i;
+    }
+    std::shuffle(m_perm, m_perm + 256, std::mt19937{seed});
+    // Duplicate it
+    std::copy(m_perm, m_perm + 256, m_perm + 256);
+}
+
+__m128 NoiseGenerator::eval4(const __m128 x, const __m128 y, const __m128 z) const {
+    // Find the unit cube containing the point
+    const __m128i cell[3] = {floor4(x), floor4(y), floor4(z)};
+    // Compute relative positions within the cube
+    const __m128 fx{_mm_sub_ps(x, _mm_cvtepi32_ps(cell[0]))};
+    const __m128 fy{_mm_sub_ps(y, _mm_cvtepi32_ps(cell[1]))};
+    const __m128 fz{_mm_sub_ps(z, _mm_cvtepi32_ps(cell[2]))};
+    // Wrap the lattice coordinates
+    int c[3][4];
+    for (int k = 0; k < 3; ++k) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(c[k]),
+                         _mm_and_si128(cell[k], _mm_set1_epi32(255)));
+    }
+    // Hash the coordinates of the 8 cube corners
+    int h[8][4];
+    for (int l = 0; l < 4; ++l) {
+        const int a{m_perm[c[0][l]] + c[1][l]};
+        const int b{m_perm[c[0][l] + 1] + c[1][l]};
+        const int aa{m_perm[a] + c[2][l]}, ab{m_perm[a + 1] + c[2][l]};
+        const int ba{m_perm[b] + c[2][l]}, bb{m_perm[b + 1] + c[2][l]};
+        h[0][l] = m_perm[aa];     h[1][l] = m_perm[ba];
+        h[2][l] = m_perm[ab];     h[3][l] = m_perm[bb];
+        h[4][l] = m_perm[aa + 1]; h[5][l] = m_perm[ba + 1];
+        h[6][l] = m_perm[ab + 1]; h[7][l] = m_perm[bb + 1];
+    }
+    auto hash = [&h](const int corner) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(h[corner]));
+    };
+    // Blend the gradient contributions of the corners
+    const __m128 one{_mm_set1_ps(1.0f)};
+    const __m128 fx1{_mm_sub_ps(fx, one)}, fy1{_mm_sub_ps(fy, one)}, fz1{_mm_sub_ps(fz, one)};
+    const __m128 u{fade4(fx)}, v{fade4(fy)}, w{fade4(fz)};
+    const __m128 n00{lerp4(grad4(hash(0), fx, fy,  fz),  grad4(hash(1), fx1, fy,  fz),  u)};
+    const __m128 n10{lerp4(grad4(hash(2), fx, fy1, fz),  grad4(hash(3), fx1, fy1, fz),  u)};
+    const __m128 n01{lerp4(grad4(hash(4), fx, fy,  fz1), grad4(hash(5), fx1, fy,  fz1), u)};
+    const __m128 n11{lerp4(grad4(hash(6), fx, fy1, fz1), grad4(hash(7), fx1, fy1, fz1), u)};
+    const __m128 n{lerp4(lerp4(n00, n10, v), lerp4(n01, n11, v), w)};
+    // Clamp the result to [-1, 1]
+    return _mm_min_ps(_mm_max_ps(n, _mm_set1_ps(-1.0f)), one);
+}
+
+NoiseGenerator::Stats NoiseGenerator::generate(const ivec3& res, const float freq,
+                                               const float ampl, const int n_octaves,
+                                               GLubyte* const data) const {
+    // Validate parameters
+    assert(res.x > 1 && res.y > 1 && res.z > 1);
+    assert(freq > 0.0f && 0.0f < ampl && ampl <= 1.0f && n_octaves > 0);
+    // Compute normalization factors
+    const vec3 norm{1.0f / vec3{res - 1}};
+    // Voxels are processed in groups of 4 along the X axis
+    const int n_groups_x{(res.x + 3) / 4};
+    // Compute per-voxel noise values
+    float max_val{0.0f};
+    #pragma omp parallel
+    {
+        float thread_max_val{0.0f};
+        #pragma omp for
+        for (int z = 0; z < res.z; ++z)
+        for (int y = 0; y < res.y; ++y)
+        for (int g = 0; g < n_groups_x; ++g) {
+            const int    x{4 * g};
+            const __m128 pos_x{_mm_mul_ps(_mm_setr_ps(static_cast<float>(x),
+                                                      static_cast<float>(x + 1),
+                                                      static_cast<float>(x + 2),
+                                                      static_cast<float>(x + 3)),
+                                          _mm_set1_ps(norm.x))};
+            const __m128 pos_y{_mm_set1_ps(y * norm.y)};
+            const __m128 pos_z{_mm_set1_ps(z * norm.z)};
+            __m128 sum{_mm_setzero_ps()};
+            float  curr_freq{freq};
+            float  curr_ampl{ampl};
+            // Compute value for each octave
+            for (int oct = 0; oct < n_octaves; ++oct) {
+                const __m128 f{_mm_set1_ps(curr_freq)};
+                // Value in range [-1, 1]
+                __m128 val{eval4(_mm_mul_ps(f, pos_x), _mm_mul_ps(f, pos_y),
+                                 _mm_mul_ps(f, pos_z))};
+                // Now mapped to [0, 0.5]
+                val = _mm_mul_ps(_mm_set1_ps(0.25f), _mm_add_ps(val, _mm_set1_ps(1.0f)));
+                // curr_ampl <= 1
+                // Therefore, sum is range [0, 1): at most 0.5 + 0.25 + 0.125 + ...
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(curr_ampl), val));
+                // Double the frequency, half the amplitude
+                curr_freq *= 2.0f;
+                curr_ampl /= 2.0f;
+            }
+            float vals[4];
+            _mm_storeu_ps(vals, _mm_div_ps(sum, _mm_set1_ps(static_cast<float>(n_octaves))));
+            // Store the values inside the volume
+            for (int l = 0, n = min(4, res.x - x); l < n; ++l) {
+                thread_max_val = max(thread_max_val, vals[l]);
+                const GLubyte byte_val{static_cast<GLubyte>(255.0f * vals[l])};
+                data[x + l + y * res.x + z * res.x * res.y] = byte_val;
+            }
+        }
+        #pragma omp critical
+        max_val = max(max_val, thread_max_val);
+    }
+    // Linearly rescale the values s.t. the maximum is 1
+    const float inv_max_val{1.0f / max_val};
+    const int   n_values{res.x * res.y * res.z};
+    Stats  stats{FLT_MAX, 0.0f, 0.0f};
+    double sum{0.0};
+    #pragma omp parallel
+    {
+        float  thread_min_val{FLT_MAX}, thread_max_val{0.0f};
+        double thread_sum{0.0};
+        #pragma omp for
+        for (int i = 0; i < n_values; ++i) {
+            const float new_val{min(data[i] * inv_max_val / 255.0f, 1.0f)};
+            thread_min_val = min(thread_min_val, new_val);
+            thread_max_val = max(thread_max_val, new_val);
+            thread_sum    += new_val;
+            data[i] = static_cast<GLubyte>(255.0f * new_val);
+        }
+        #pragma omp critical
+        {
+            stats.min_val = min(stats.min_val, thread_min_val);
+            stats.max_val = max(stats.max_val, thread_max_val);
+            sum += thread_sum;
+        }
+    }
+    stats.avg_val = static_cast<float>(sum / n_values);
+    return stats;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <xmmintrin.h>
+#include <GLM\vec3.hpp>
+#include <OpenGL\gl_basic_typedefs.h>
+#include "..\Common\Definitions.h"
+
+/* Vectorized (SSE) fractal gradient noise generator for volumetric data */
+class NoiseGenerator {
+public:
+    NoiseGenerator() = delete;
+    RULE_OF_ZERO(NoiseGenerator);
+    // Constructor; the seed determines the permutation of lattice gradients
+    explicit NoiseGenerator(const uint seed);
+    /* Statistics of generated values */
+    struct Stats {
+        float min_val, max_val, avg_val;
+    };
+    // Evaluates gradient noise (in range [-1, 1]) at 4 positions at once
+    __m128 eval4(const __m128 x, const __m128 y, const __m128 z) const;
+    // Fills the volume of the specified resolution with fractal noise, normalized s.t.
+    // its maximal value is 1; the first octave has frequency 'freq' (periods per volume)
+    // and amplitude 'ampl'; values are quantized to bytes and stored in X-Y-Z order
+    Stats generate(const glm::ivec3& res, const float freq, const float ampl,
+                   const int n_octaves, GLubyte* const data) const;
+private:
+    int m_perm[512];    // Permutation table (duplicated to avoid index wrapping)
+};
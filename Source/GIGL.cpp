@@ -1,7 +1,14 @@
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <GLM\matrix.hpp>
 #include "UI\Window.h"
 #include "UI\InputHandler.h"
+#include "UI\ScriptHandler.h"
 #include "Common\Constants.h"
 #include "Common\Timer.h"
+#include "Common\TraceLog.h"
 #include "Common\Utility.hpp"
 #include "Common\Random.h"
 #include "Common\Camera.h"
@@ -9,6 +16,7 @@
 #include "Common\Scene.h"
 #include "GL\GLShader.hpp"
 #include "GL\GLRTBLockMngr.h"
+#include "GL\GLTextureReadback.h"
 #include "VPL\PointLight.hpp"
 #include "VPL\LightArray.hpp"
 
@@ -24,11 +32,31 @@ Scene* scene;
 //*  system		   Z = up       *
 //*******************************
 
-int main(int, char**) {
-    // Randomize
-    UnitRNG::init();
-    // Create a window
-    Window window{WINDOW_RES, WINDOW_RES};
+int main(int argc, char** argv) {
+    // Parse the command line: "-trace <first frame> <number of frames>" records a trace,
+    // "-script <file>" renders offscreen (without user input) as specified by the script
+    const char* script_file{nullptr};
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-trace") && i + 2 < argc) {
+            const uint first_frame{static_cast<uint>(atoi(argv[i + 1]))};
+            const uint n_frames{static_cast<uint>(atoi(argv[i + 2]))};
+            TraceLog::init("trace.json", first_frame, n_frames);
+            i += 2;
+        } else if (0 == strcmp(argv[i], "-script") && i + 1 < argc) {
+            script_file = argv[++i];
+        }
+    }
+    const bool is_headless{nullptr != script_file};
+    TraceLog::setThreadName("Main");
+    // Randomize (reproducibly if rendering a script)
+    if (is_headless) {
+        UnitRNG::init(SCRIPT_SEED);
+    } else {
+        UnitRNG::init();
+    }
+    // Create a window (a hidden one only provides the OpenGL context)
+    // GLFW cannot create a surfaceless context, so headless rendering still requires a display
+    Window window{WINDOW_RES, WINDOW_RES, !is_headless};
     if (!window.isOpen()) return -1;
     // Set up the renderer
     DeferredRenderer engine{WINDOW_RES, WINDOW_RES};
@@ -44,16 +72,15 @@ int main(int, char**) {
     const mat4 model_view{cam.computeModelView(model_mat)};	// Model to Camera space
     const mat4 MVP{cam.computeMVP(model_view)};			    // Model-view-projection matrix
     const mat3 norm_mat{cam.computeNormXForm(model_mat)};	// Matrix transforming normals
-    // Load the scene
+    // Start loading the scene; fog is added once the scene can be raytraced
     scene = new Scene;
-    scene->loadObjects("Assets\\cornell_box.obj");
-    // Set up fog
-    scene->addFog("Assets\\df.3dt", "Assets\\pi_df.3dt", MAJ_EXT_K, ABS_K, SCA_K, cam);
-    const BBox& fog_box{scene->getFogBounds()};
-    const vec3 fog_pt_min{fog_box.minPt()};
-    const vec3 fog_pt_max{fog_box.maxPt()};
-    const vec3 box_top_mid{fog_pt_max - 0.5f * vec3{fog_pt_max.x - fog_pt_min.x, 0.0f,
-                                                    fog_pt_max.z - fog_pt_min.z}};
+    scene->loadObjectsAsync("Assets\\cornell_box.obj");
+    if (is_headless) {
+        // Frames must not depend on the loading speed
+        scene->finishLoading();
+    }
+    bool is_fog_ready{false};
+    vec3 box_top_mid{0.0f};
     // Set up lights
     LightArray<PPL> ppls{1};
     LightArray<VPL> vpls{MAX_N_VPLS};
@@ -72,74 +99,201 @@ int main(int, char**) {
         engine.surfaceSP().setUniformValue("ppl_shadow_cube", TEX_U_PPL_SM);
         engine.surfaceSP().setUniformValue("vpl_shadow_cube", TEX_U_VPL_SM);
         engine.surfaceSP().setUniformValue("pi_dens",         TEX_U_PI_DENS);
+        engine.surfaceSP().setUniformValue("ppl_dens",        TEX_U_PPL_DENS);
         engine.surfaceSP().setUniformValue("w_positions",     TEX_U_W_POS);
         engine.surfaceSP().setUniformValue("enc_w_normals",   TEX_U_W_NORM);
         engine.surfaceSP().setUniformValue("material_ids",    TEX_U_MAT_ID);
         engine.surfaceSP().setUniformValue("accum_buffer",    IMG_U_ACCUM);
         engine.surfaceSP().setUniformValue("fog_dist",        IMG_U_FOG_DIST);
+        engine.surfaceSP().setUniformValue("vpl_contrib",     IMG_U_VPL_CONT);
+        engine.surfaceSP().setUniformValue("history",         IMG_U_HISTORY);
+        engine.surfaceSP().setUniformValue("direct_rad",      IMG_U_DIRECT);
         engine.surfaceSP().setUniformValue("inv_max_dist_sq", invSq(MAX_DIST));
-        engine.surfaceSP().setUniformValue("fog_bounds[0]",   fog_pt_min);
-        engine.surfaceSP().setUniformValue("fog_bounds[1]",   fog_pt_max);
-        engine.surfaceSP().setUniformValue("inv_fog_dims",    1.0f / (fog_pt_max - fog_pt_min));
         engine.volumeSP().use();
         engine.volumeSP().setUniformValue("cam_w_pos",        cam.worldPos());
         engine.volumeSP().setUniformValue("vol_dens",         TEX_U_DENS_V);
         engine.volumeSP().setUniformValue("ppl_shadow_cube",  TEX_U_PPL_SM);
         engine.volumeSP().setUniformValue("vpl_shadow_cube",  TEX_U_VPL_SM);
         engine.volumeSP().setUniformValue("pi_dens",          TEX_U_PI_DENS);
+        engine.volumeSP().setUniformValue("ppl_dens",         TEX_U_PPL_DENS);
         engine.volumeSP().setUniformValue("halton_seq",       TEX_U_HALTON);
         engine.volumeSP().setUniformValue("w_positions",      TEX_U_W_POS);
         engine.volumeSP().setUniformValue("rnd_offsets",      TEX_U_RND_OFF);
         engine.volumeSP().setUniformValue("fog_dist",         IMG_U_FOG_DIST);
         engine.volumeSP().setUniformValue("inv_max_dist_sq",  invSq(MAX_DIST));
-        engine.volumeSP().setUniformValue("fog_bounds[0]",    fog_pt_min);
-        engine.volumeSP().setUniformValue("fog_bounds[1]",    fog_pt_max);
-        engine.volumeSP().setUniformValue("inv_fog_dims",     1.0f / (fog_pt_max - fog_pt_min));
         engine.combineSP().use();
         engine.combineSP().setUniformValue("accum_buffer",    IMG_U_ACCUM);
+        engine.combineSP().setUniformValue("moments",         IMG_U_MOMENTS);
+        engine.combineSP().setUniformValue("history",         IMG_U_HISTORY);
+        engine.combineSP().setUniformValue("direct_rad",      IMG_U_DIRECT);
         engine.combineSP().setUniformValue("vol_comp",        TEX_U_VOL_COMP);
         engine.combineSP().setUniformValue("depth_buf",       TEX_U_DEPTH);
+        engine.combineSP().setUniformValue("display",         IMG_U_DISPLAY);
+        engine.piDensitySP().use();
+        engine.piDensitySP().setUniformValue("w_positions",   TEX_U_W_POS);
+        engine.piDensitySP().setUniformValue("depth_buf",     TEX_U_DEPTH);
+        engine.piDensitySP().setUniformValue("vol_dens",      TEX_U_DENS_V);
+        engine.piDensitySP().setUniformValue("pi_dens",       IMG_U_PI_DENS);
+        engine.piDensitySP().setUniformValue("cam_w_pos",     cam.worldPos());
+        engine.piDensitySP().setUniformValue("inv_view_proj", glm::inverse(cam.projMat() *
+                                                                           cam.viewMat()));
+        engine.cullVPLsSP().use();
+        engine.cullVPLsSP().setUniformValue("w_positions",    TEX_U_W_POS);
+        engine.cullVPLsSP().setUniformValue("material_ids",   TEX_U_MAT_ID);
+        engine.interleaveSP().use();
+        engine.interleaveSP().setUniformValue("w_positions",   TEX_U_W_POS);
+        engine.interleaveSP().setUniformValue("enc_w_normals", TEX_U_W_NORM);
+        engine.interleaveSP().setUniformValue("vpl_contrib",   IMG_U_VPL_CONT);
+        engine.interleaveSP().setUniformValue("accum_buffer",  IMG_U_ACCUM);
+        engine.pplTransmSP().use();
+        engine.pplTransmSP().setUniformValue("vol_dens",       TEX_U_DENS_V);
+        engine.pplTransmSP().setUniformValue("ppl_dens",       IMG_U_PPL_DENS);
+        engine.convergenceSP().use();
+        engine.convergenceSP().setUniformValue("moments",      IMG_U_MOMENTS);
     }
     // Init dynamic uniforms
     InputHandler::init(&engine.settings);
+    std::unique_ptr<GLTextureReadback> readback;
+    if (is_headless) {
+        ScriptHandler::init(&engine.settings, script_file);
+        readback = std::make_unique<GLTextureReadback>(WINDOW_RES, WINDOW_RES);
+    }
     // Create a ring-triple-buffer lock manager
     GLRTBLockMngr rtb_lock_mngr;
+    #ifdef GPU_PI_DENSITY
+        // The camera is static, so fog density only has to be preintegrated once
+        bool is_pi_dens_valid{false};
+    #endif
+    // Total number of rendered frames
+    uint n_frames{0};
     /* Rendering loop */
     while (!window.shouldClose()) {
-        // Start frame timing
+        // Start timing CPU work (the GPU passes are timed by the renderer)
         const uint t0{HighResTimer::time_ms()};
         // Process input
-        InputHandler::updateParams(window.get());
+        if (!is_headless) {
+            InputHandler::updateParams(window.get());
+        } else if (!ScriptHandler::updateParams()) {
+            // The script is complete
+            break;
+        }
         // Wait for buffer write access
         rtb_lock_mngr.waitForLockExpiration();
+        // Integrate the geometry loaded in the background
+        if (scene->update()) {
+            // Restart progressive rendering
+            engine.settings.frame_num    = 0;
+            engine.settings.keep_history = false;
+            #ifdef GPU_PI_DENSITY
+                // Preintegrate fog density on the GPU again (there is no CPU data to update)
+                is_pi_dens_valid = false;
+            #else
+                if (is_fog_ready) scene->invalidateFogPiDens();
+            #endif
+        }
+        if (!is_fog_ready && scene->isTraceable()) {
+            // Set up fog around the scene
+            // Use the current coefficients, since they may have been changed during loading
+            const RenderSettings& rs = engine.settings;
+            scene->addFog("Assets\\df.3dt", "Assets\\pi_df.3dt", rs.maj_ext_k, rs.abs_k, rs.sca_k,
+                          cam);
+            const BBox& fog_box{scene->getFogBounds()};
+            const vec3 fog_pt_min{fog_box.minPt()};
+            const vec3 fog_pt_max{fog_box.maxPt()};
+            box_top_mid = fog_pt_max - 0.5f * vec3{fog_pt_max.x - fog_pt_min.x, 0.0f,
+                                                   fog_pt_max.z - fog_pt_min.z};
+            const vec3 inv_fog_dims{1.0f / (fog_pt_max - fog_pt_min)};
+            engine.surfaceSP().use();
+            engine.surfaceSP().setUniformValue("fog_bounds[0]",   fog_pt_min);
+            engine.surfaceSP().setUniformValue("fog_bounds[1]",   fog_pt_max);
+            engine.surfaceSP().setUniformValue("inv_fog_dims",    inv_fog_dims);
+            engine.volumeSP().use();
+            engine.volumeSP().setUniformValue("fog_bounds[0]",    fog_pt_min);
+            engine.volumeSP().setUniformValue("fog_bounds[1]",    fog_pt_max);
+            engine.volumeSP().setUniformValue("inv_fog_dims",     inv_fog_dims);
+            engine.piDensitySP().use();
+            engine.piDensitySP().setUniformValue("fog_bounds[0]", fog_pt_min);
+            engine.piDensitySP().setUniformValue("fog_bounds[1]", fog_pt_max);
+            engine.piDensitySP().setUniformValue("inv_fog_dims",  inv_fog_dims);
+            engine.pplTransmSP().use();
+            engine.pplTransmSP().setUniformValue("fog_bounds[0]", fog_pt_min);
+            engine.pplTransmSP().setUniformValue("fog_bounds[1]", fog_pt_max);
+            engine.pplTransmSP().setUniformValue("inv_fog_dims",  inv_fog_dims);
+            // Integrate fog density towards the primary light
+            engine.invalidatePplTransm();
+            is_fog_ready = true;
+        }
+        #ifndef GPU_PI_DENSITY
+            // Progressively update preintegrated fog density (if it is out of date)
+            // Scripted frames must not depend on timing, so the update is never split
+            if (!scene->updateFogPiDens(cam, is_headless ? UINT_MAX : PI_DENS_BUDGET)) {
+                // Restart progressive rendering
+                engine.settings.frame_num    = 0;
+                engine.settings.keep_history = false;
+            }
+        #endif
         // Update the lights
         engine.updateLights(*scene, box_top_mid, ppls, vpls);
-        // Generate shadow maps
         const uint t1{HighResTimer::time_ms()};
+        // Generate shadow maps
         engine.generateShadowMaps(*scene, model_mat, ppls, vpls);
         // Generate a G-buffer
-        const uint t2{HighResTimer::time_ms()};
         engine.generateGBuffer(*scene);
+        #ifdef GPU_PI_DENSITY
+            if (is_fog_ready && !is_pi_dens_valid) {
+                // Preintegrate fog density using the G-buffer
+                engine.preintegrateDensity();
+                #ifndef NDEBUG
+                    scene->validateFogPiDens(cam);
+                #endif
+                is_pi_dens_valid = true;
+            }
+        #endif
         // Perform shading
-        const uint t3{HighResTimer::time_ms()};
         engine.shade(rtb_lock_mngr.getActiveBufIdx());
+        if (is_headless) {
+            // Save the image at the end of the step
+            if (const char* const output_file = ScriptHandler::outputFile()) {
+                // The accumulated radiance is normalized by the per-pixel number of frames
+                readback->request(engine.accumBuffer().id(), output_file);
+            }
+            readback->complete(false);
+            ScriptHandler::nextFrame();
+        }
         // Switch to the next buffer
         rtb_lock_mngr.lockBuffer();
         ppls.switchToNextBuffer();
         vpls.switchToNextBuffer();
         // Prepare to draw the next frame
         engine.settings.frame_num++;
+        // The history is only blended into the first frame after the light moves
+        engine.settings.keep_history = false;
         window.refresh();
-        // Display frame time
-        const uint t4{HighResTimer::time_ms()};
+        // Display mean GPU times of the passes (and the CPU time of photon tracing)
         char title[TITLE_LEN];
         if (engine.settings.frame_num <= MAX_FRAMES) {
-            sprintf_s(title, TITLE_LEN, "GLGI (Shade: %u ms | GBuf: %u ms | SM: %u ms | PT: %u ms)",
-                      t4 - t3, t3 - t2, t2 - t1, t1 - t0);
+            const float shade_ms{engine.computeGPUStats(GPU_PASS_VPL_CULL).mean +
+                                 engine.computeGPUStats(GPU_PASS_SURFACE).mean +
+                                 engine.computeGPUStats(GPU_PASS_VPL_FILTER).mean +
+                                 engine.computeGPUStats(GPU_PASS_VOLUME).mean +
+                                 engine.computeGPUStats(GPU_PASS_COMBINE).mean +
+                                 engine.computeGPUStats(GPU_PASS_CONVERGE).mean};
+            const float gbuf_ms{engine.computeGPUStats(GPU_PASS_GBUF).mean};
+            const float sm_ms{engine.computeGPUStats(GPU_PASS_PPL_SM).mean +
+                              engine.computeGPUStats(GPU_PASS_VPL_SM).mean};
+            sprintf_s(title, TITLE_LEN,
+                      "GLGI (Shade: %.2f ms | GBuf: %.2f ms | SM: %.2f ms | PT: %u ms)",
+                      shade_ms, gbuf_ms, sm_ms, t1 - t0);
         } else {
             sprintf_s(title, TITLE_LEN, "GLGI (done)");
         }
         window.setTitle(title);
+        // Periodically report detailed GPU timing statistics
+        if (0 == ++n_frames % PROF_N_SAMPLES) {
+            engine.printGPUStats();
+        }
+        // Write the trace after the last recorded frame
+        TraceLog::nextFrame();
     }
     delete scene;
     return 0;
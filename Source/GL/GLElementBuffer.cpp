@@ -1,21 +1,26 @@
 #include "GLElementBuffer.h"
 #include <cassert>
 #include <OpenGL\gl_core_4_4.hpp>
-#include <GLM\detail\func_common.hpp>
+#include <GLM\common.hpp>
 #include "GLVertArray.h"
 
 using glm::min;
 using glm::max;
 
-GLElementBuffer::GLElementBuffer(): m_min_idx{UINT_MAX}, m_max_idx{0}, m_is_buffered{false} {
+GLElementBuffer::GLElementBuffer(): GLElementBuffer(gl::UNSIGNED_INT) {}
+
+GLElementBuffer::GLElementBuffer(const GLenum index_type): m_type{index_type},
+                 m_min_idx{UINT_MAX}, m_max_idx{0}, m_n_elems{0}, m_is_buffered{false} {
+    assert(gl::UNSIGNED_SHORT == m_type || gl::UNSIGNED_INT == m_type);
     gl::GenBuffers(1, &m_handle);
 }
 
-GLElementBuffer::GLElementBuffer(const GLElementBuffer& ebo): m_min_idx{ebo.m_min_idx},
-                 m_max_idx{ebo.m_max_idx}, m_is_buffered{ebo.m_is_buffered},
+GLElementBuffer::GLElementBuffer(const GLElementBuffer& ebo): m_type{ebo.m_type},
+                 m_min_idx{ebo.m_min_idx},
+                 m_max_idx{ebo.m_max_idx}, m_n_elems{0}, m_is_buffered{ebo.m_is_buffered},
                  m_data_vec(ebo.m_data_vec) {
     gl::GenBuffers(1, &m_handle);
-    if (ebo.m_is_buffered) { buffer(); }
+    copyData(ebo);
 }
 
 GLElementBuffer& GLElementBuffer::operator=(const GLElementBuffer& ebo) {
@@ -25,17 +30,19 @@ GLElementBuffer& GLElementBuffer::operator=(const GLElementBuffer& ebo) {
         // Generate a new buffer
         gl::GenBuffers(1, &m_handle);
         // Copy the data
+        m_type        = ebo.m_type;
         m_min_idx     = ebo.m_min_idx;
         m_max_idx     = ebo.m_max_idx;
         m_is_buffered = ebo.m_is_buffered;
         m_data_vec    = ebo.m_data_vec;
-        if (ebo.m_is_buffered) { buffer(); }
+        copyData(ebo);
     }
     return *this;
 }
 
 GLElementBuffer::GLElementBuffer(GLElementBuffer&& ebo): m_handle{ebo.m_handle},
-                 m_min_idx{ebo.m_min_idx}, m_max_idx{ebo.m_max_idx},
+                 m_type{ebo.m_type}, m_min_idx{ebo.m_min_idx}, m_max_idx{ebo.m_max_idx},
+                 m_n_elems{ebo.m_n_elems},
                  m_is_buffered{ebo.m_is_buffered}, m_data_vec(std::move(ebo.m_data_vec)) {
     // Mark as moved
     ebo.m_handle = 0;
@@ -59,10 +66,32 @@ GLElementBuffer::~GLElementBuffer() {
     }
 }
 
+void GLElementBuffer::copyData(const GLElementBuffer& ebo) {
+    m_n_elems = ebo.m_n_elems;
+    if (m_n_elems > 0) {
+        // The CPU copy has been released; copy on the GPU
+        const auto byte_sz = m_n_elems * indexSize();
+        gl::BindBuffer(gl::COPY_WRITE_BUFFER, m_handle);
+        gl::BufferData(gl::COPY_WRITE_BUFFER, byte_sz, nullptr, gl::STATIC_DRAW);
+        gl::BindBuffer(gl::COPY_READ_BUFFER, ebo.m_handle);
+        gl::CopyBufferSubData(gl::COPY_READ_BUFFER, gl::COPY_WRITE_BUFFER, 0, 0, byte_sz);
+    }
+}
+
 void GLElementBuffer::buffer() {
     gl::BindBuffer(gl::ELEMENT_ARRAY_BUFFER, m_handle);
-    const auto byte_sz = m_data_vec.size() * sizeof(GLuint);
-    gl::BufferData(gl::ELEMENT_ARRAY_BUFFER, byte_sz, m_data_vec.data(), gl::STATIC_DRAW);
+    m_n_elems = static_cast<GLsizei>(m_data_vec.size());
+    const auto byte_sz = m_data_vec.size() * indexSize();
+    if (gl::UNSIGNED_SHORT == m_type) {
+        // Convert to 16-bit indices
+        assert(m_data_vec.empty() || m_max_idx <= USHRT_MAX);
+        const std::vector<GLushort> data_vec(m_data_vec.begin(), m_data_vec.end());
+        gl::BufferData(gl::ELEMENT_ARRAY_BUFFER, byte_sz, data_vec.data(), gl::STATIC_DRAW);
+    } else {
+        gl::BufferData(gl::ELEMENT_ARRAY_BUFFER, byte_sz, m_data_vec.data(), gl::STATIC_DRAW);
+    }
+    // Release the staging storage
+    std::vector<GLuint>().swap(m_data_vec);
     m_is_buffered = true;
 }
 
@@ -72,6 +101,11 @@ void GLElementBuffer::loadData(const std::vector<GLuint>& data_vec, const GLuint
 
 void GLElementBuffer::loadData(const size_t n_elems, const GLuint* const data,
                                const GLuint offset) {
+    if (m_is_buffered) {
+        // Start a new data set
+        m_min_idx = UINT_MAX;
+        m_max_idx = 0;
+    }
     m_data_vec.reserve(m_data_vec.size() + n_elems);
     for (auto i = 0; i < n_elems; ++i) {
         const GLuint idx{offset + data[i]};
@@ -83,8 +117,29 @@ void GLElementBuffer::loadData(const size_t n_elems, const GLuint* const data,
 }
 
 void GLElementBuffer::draw(const GLVertArray& va) const {
+    draw(va, 0, m_n_elems, m_min_idx, m_max_idx);
+}
+
+void GLElementBuffer::draw(const GLVertArray& va, const GLuint first_elem, const GLsizei n_elems,
+                           const GLuint min_idx, const GLuint max_idx,
+                           const GLint base_vert) const {
+    assert(m_is_buffered && first_elem + n_elems <= static_cast<GLuint>(m_n_elems));
     gl::BindVertexArray(va.id());
     gl::BindBuffer(gl::ELEMENT_ARRAY_BUFFER, m_handle);
-    const auto n_elems = static_cast<GLsizei>(m_data_vec.size());
-    gl::DrawRangeElements(gl::TRIANGLES, m_min_idx, m_max_idx, n_elems, gl::UNSIGNED_INT, nullptr);
+    const auto offset = reinterpret_cast<const GLvoid*>(first_elem * indexSize());
+    gl::DrawRangeElementsBaseVertex(gl::TRIANGLES, min_idx, max_idx, n_elems, m_type, offset,
+                                    base_vert);
+}
+
+void GLElementBuffer::drawIndirect(const GLVertArray& va, const size_t cmd_offset,
+                                   const GLsizei n_draws) const {
+    assert(m_is_buffered);
+    gl::BindVertexArray(va.id());
+    gl::BindBuffer(gl::ELEMENT_ARRAY_BUFFER, m_handle);
+    const GLvoid* const offset{reinterpret_cast<const GLvoid*>(cmd_offset)};
+    gl::MultiDrawElementsIndirect(gl::TRIANGLES, m_type, offset, n_draws, sizeof(IndirectCmd));
+}
+
+size_t GLElementBuffer::indexSize() const {
+    return (gl::UNSIGNED_SHORT == m_type) ? sizeof(GLushort) : sizeof(GLuint);
 }
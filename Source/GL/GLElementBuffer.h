@@ -9,9 +9,21 @@ class GLVertArray;
 /* OpenGL element (index) buffer */
 class GLElementBuffer {
 public:
+    /* Indirect indexed draw command (layout defined by OpenGL) */
+    struct IndirectCmd {
+        GLuint count;                   // Number of indices
+        GLuint instance_count;          // Number of instances
+        GLuint first_idx;               // Index of the first index
+        GLint  base_vert;               // Value added to each index
+        GLuint base_instance;           // Value added to the instance index of attributes
+    };
+    // Creates a buffer of 32-bit indices
     GLElementBuffer();
     RULE_OF_FIVE(GLElementBuffer);
-    // Copies preloaded data to GPU
+    // Creates a buffer of indices of the specified type (gl::UNSIGNED_SHORT or gl::UNSIGNED_INT)
+    explicit GLElementBuffer(const GLenum index_type);
+    // Copies preloaded data to GPU and releases the CPU copy
+    // Data loaded afterwards replaces the buffered data once buffer() is called again
     void buffer();
     // Load indexing information from std::vector
     void loadData(const std::vector<GLuint>& data_vec, const GLuint offset);
@@ -19,9 +31,23 @@ public:
     void loadData(const size_t n_elems, const GLuint* const data, const GLuint offset);
     // Draws indexed vertex array
     void draw(const GLVertArray& va) const;
+    // Draws 'n_elems' indices starting with 'first_elem' which reference vertices
+    // within the range [min_idx, max_idx]; 'base_vert' is added to each index
+    void draw(const GLVertArray& va, const GLuint first_elem, const GLsizei n_elems,
+              const GLuint min_idx, const GLuint max_idx, const GLint base_vert = 0) const;
+    // Draws indexed vertex array using 'n_draws' commands (IndirectCmd) stored within
+    // the buffer bound to gl::DRAW_INDIRECT_BUFFER, starting at the specified byte offset
+    void drawIndirect(const GLVertArray& va, const size_t cmd_offset, const GLsizei n_draws) const;
 private:
-    GLuint m_handle;                    // OpenGL handle
-    GLuint m_min_idx, m_max_idx;        // Minimal and maximal indices
-    bool   m_is_buffered;               // Flag indicating whether data is buffered on GPU
-    std::vector<GLuint> m_data_vec;     // Storage
+    // Returns the size of an index in bytes
+    size_t indexSize() const;
+    // Copies the (staged and buffered) data of another element buffer
+    void copyData(const GLElementBuffer& ebo);
+    // Private data members
+    GLuint  m_handle;                   // OpenGL handle
+    GLenum  m_type;                     // Index type
+    GLuint  m_min_idx, m_max_idx;       // Minimal and maximal indices
+    GLsizei m_n_elems;                  // Number of indices buffered on GPU
+    bool    m_is_buffered;              // Flag indicating whether data is buffered on GPU
+    std::vector<GLuint> m_data_vec;     // Staging storage (until buffered)
 };
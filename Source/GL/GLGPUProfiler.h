@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <OpenGL\gl_basic_typedefs.h>
+#include "..\Common\Constants.h"
+
+/* GPU profiler measuring N (non-nested) intervals of GPU execution using timestamp queries
+   Queries of several frames are kept in flight, so collecting the results never stalls
+   While the TraceLog is recording, the collected intervals are also added to the trace */
+template <uint N>
+class GLGPUProfiler {
+public:
+    GLGPUProfiler() = delete;
+    RULE_OF_FIVE_NO_COPY(GLGPUProfiler);
+    // Creates a profiler of intervals with the specified names (string literals)
+    explicit GLGPUProfiler(const char* const (&names)[N]);
+    // Records the start of the specified interval (within the current frame)
+    void begin(const uint timer_id);
+    // Records the end of the specified interval (within the current frame)
+    void end(const uint timer_id);
+    // Collects the results of the oldest frame in flight (if available), and starts a new frame
+    void nextFrame();
+    /* Rolling statistics of the last (up to) PROF_N_SAMPLES intervals (in milliseconds) */
+    struct Stats {
+        float min, mean, p99;
+    };
+    // Computes the statistics of the specified interval
+    Stats computeStats(const uint timer_id) const;
+    // Returns the name of the specified interval
+    const char* name(const uint timer_id) const;
+private:
+    // Private data members
+    std::array<GLuint, 2 * N * PROF_N_FRAMES> m_queries;    // Begin/end timestamp queries
+    std::array<bool, N * PROF_N_FRAMES>       m_is_issued;  // Whether the queries are issued
+    std::array<float, N * PROF_N_SAMPLES>     m_samples;    // Ring buffers of durations
+    std::array<uint, N>                       m_n_samples;  // Total numbers of samples
+    uint                                      m_frame;      // Index of the ring frame
+    std::array<const char*, N>                m_names;      // Names of intervals
+    int64_t                                   m_cpu_off_us; // Offset from GPU to CPU time
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "GLGPUProfiler.h"
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <OpenGL\gl_core_4_4.hpp>
+#include "..\Common\Timer.h"
+#include "..\Common\TraceLog.h"
+
+template <uint N>
+GLGPUProfiler<N>::GLGPUProfiler(const char* const (&names)[N]): m_is_issued(), m_samples(),
+                                                                m_n_samples(), m_frame{0} {
+    gl::GenQueries(static_cast<GLsizei>(m_queries.size()), m_queries.data());
+    std::copy(names, names + N, m_names.begin());
+    // Match the GPU clock with the CPU one (to microsecond precision)
+    GLint64 gpu_time_ns;
+    gl::GetInteger64v(gl::TIMESTAMP, &gpu_time_ns);
+    const int64_t cpu_time_us{HighResTimer::now().time_since_epoch().count()};
+    m_cpu_off_us = cpu_time_us - gpu_time_ns / 1000;
+}
+
+template <uint N>
+GLGPUProfiler<N>::GLGPUProfiler(GLGPUProfiler&& prof) {
+    // Copy the data
+    memcpy(this, &prof, sizeof(*this));
+    // Mark as moved
+    prof.m_queries[0] = 0;
+}
+
+template <uint N>
+GLGPUProfiler<N>& GLGPUProfiler<N>::operator=(GLGPUProfiler&& prof) {
+    assert(this != &prof);
+    // Free memory
+    gl::DeleteQueries(static_cast<GLsizei>(m_queries.size()), m_queries.data());
+    // Now copy the data
+    memcpy(this, &prof, sizeof(*this));
+    // Mark as moved
+    prof.m_queries[0] = 0;
+    return *this;
+}
+
+template <uint N>
+GLGPUProfiler<N>::~GLGPUProfiler() {
+    // Check if it was moved
+    if (m_queries[0]) {
+        gl::DeleteQueries(static_cast<GLsizei>(m_queries.size()), m_queries.data());
+    }
+}
+
+template <uint N>
+void GLGPUProfiler<N>::begin(const uint timer_id) {
+    assert(timer_id < N);
+    gl::QueryCounter(m_queries[2 * (m_frame * N + timer_id)], gl::TIMESTAMP);
+}
+
+template <uint N>
+void GLGPUProfiler<N>::end(const uint timer_id) {
+    assert(timer_id < N);
+    gl::QueryCounter(m_queries[2 * (m_frame * N + timer_id) + 1], gl::TIMESTAMP);
+    m_is_issued[m_frame * N + timer_id] = true;
+}
+
+template <uint N>
+void GLGPUProfiler<N>::nextFrame() {
+    // The next frame reuses the queries of the oldest frame in flight
+    m_frame = (m_frame + 1) % PROF_N_FRAMES;
+    for (uint t = 0; t < N; ++t) {
+        const uint i{m_frame * N + t};
+        if (!m_is_issued[i]) continue;
+        m_is_issued[i] = false;
+        // The timestamps are recorded in order, so the end implies the beginning
+        GLuint is_available;
+        gl::GetQueryObjectuiv(m_queries[2 * i + 1], gl::QUERY_RESULT_AVAILABLE, &is_available);
+        if (!is_available) {
+            // The GPU is too far behind; drop the sample rather than wait
+            continue;
+        }
+        GLuint64 t_begin, t_end;
+        gl::GetQueryObjectui64v(m_queries[2 * i],     gl::QUERY_RESULT, &t_begin);
+        gl::GetQueryObjectui64v(m_queries[2 * i + 1], gl::QUERY_RESULT, &t_end);
+        // Convert nanoseconds to milliseconds
+        m_samples[t * PROF_N_SAMPLES + m_n_samples[t] % PROF_N_SAMPLES] = 1e-6f * (t_end - t_begin);
+        ++m_n_samples[t];
+        if (TraceLog::isRecording()) {
+            // The interval belongs to a frame (PROF_N_FRAMES - 1) frames ago
+            TraceLog::addGPUEvent(m_names[t], static_cast<int64_t>(t_begin / 1000) + m_cpu_off_us,
+                                  static_cast<int64_t>(t_end / 1000)   + m_cpu_off_us);
+        }
+    }
+}
+
+template <uint N>
+auto GLGPUProfiler<N>::computeStats(const uint timer_id) const -> Stats {
+    assert(timer_id < N);
+    const uint n{std::min(m_n_samples[timer_id], static_cast<uint>(PROF_N_SAMPLES))};
+    Stats stats = {0.0f, 0.0f, 0.0f};
+    if (0 == n) return stats;
+    std::array<float, PROF_N_SAMPLES> sorted;
+    const float* const samples{&m_samples[timer_id * PROF_N_SAMPLES]};
+    std::copy(samples, samples + n, sorted.begin());
+    std::sort(sorted.begin(), sorted.begin() + n);
+    stats.min = sorted[0];
+    for (uint i = 0; i < n; ++i) {
+        stats.mean += sorted[i];
+    }
+    stats.mean /= n;
+    // Use the nearest-rank method
+    stats.p99 = sorted[(99 * n + 99) / 100 - 1];
+    return stats;
+}
+
+template <uint N>
+const char* GLGPUProfiler<N>::name(const uint timer_id) const {
+    assert(timer_id < N);
+    return m_names[timer_id];
+}
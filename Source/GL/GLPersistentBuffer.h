@@ -18,6 +18,8 @@ public:
     const void* data() const;
     // Binds buffer to buffer binding point
     void bind(const GLuint bind_idx) const;
+    // Binds buffer to its target (for non-indexed targets)
+    void bind() const;
 private:
     // Performs buffer initialization
     void init();
@@ -31,3 +33,4 @@ private:
 
 using GLPUB140 = GLPersistentBuffer<gl::UNIFORM_BUFFER>;
 using GLPSB430 = GLPersistentBuffer<gl::SHADER_STORAGE_BUFFER>;
+using GLPDIB   = GLPersistentBuffer<gl::DRAW_INDIRECT_BUFFER>;
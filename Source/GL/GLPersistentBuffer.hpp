@@ -97,3 +97,8 @@ template <GLenum T>
 void GLPersistentBuffer<T>::bind(const GLuint bind_idx) const {
     gl::BindBufferBase(T, bind_idx, m_handle);
 }
+
+template <GLenum T>
+void GLPersistentBuffer<T>::bind() const {
+    gl::BindBuffer(T, m_handle);
+}
@@ -1,6 +1,7 @@
 #include "GLRTBLockMngr.h"
 #include <cassert>
 #include <OpenGL\gl_core_4_4.hpp>
+#include "..\Common\TraceLog.h"
 
 GLRTBLockMngr::GLRingTripleBufferLockManager(): m_buf_idx{0}, m_fences{} {}
 
@@ -45,6 +46,7 @@ void GLRTBLockMngr::lockBuffer() {
 }
 
 void GLRTBLockMngr::waitForLockExpiration() {
+    TRACE_ZONE("Wait for buffer");
     const auto& curr_fence = m_fences[m_buf_idx];
     if (curr_fence) {
         GLbitfield wait_flags   = 0;
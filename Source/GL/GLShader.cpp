@@ -27,7 +27,8 @@ CONSTEXPR std::map<const char*, GLenum, CStrCmp> file_exts = {{".vs",   gl::VERT
                                                               {".tes",  gl::TESS_EVALUATION_SHADER},
                                                               {".fs",   gl::FRAGMENT_SHADER},
                                                               {".frag", gl::FRAGMENT_SHADER},
-                                                              {".cs",   gl::COMPUTE_SHADER}};
+                                                              {".cs",   gl::COMPUTE_SHADER},
+                                                              {".comp", gl::COMPUTE_SHADER}};
 
 // Returns file extension with a dot prefix
 static inline const char* getDotExt(const char* const file_name) {
@@ -18,10 +18,12 @@ private:
     GLuint m_handle;   // OpenGL handle
 };
 
-using GLTex2D_3x8   = GLTexture2D<gl::RGB8>;
-using GLTex2D_1x8UI = GLTexture2D<gl::R8UI>;
-using GLTex2D_1x32F = GLTexture2D<gl::R32F>;
-using GLTex2D_2x32F = GLTexture2D<gl::RG32F>;
-using GLTex2D_3x32F = GLTexture2D<gl::RGB32F>;
-using GLTex2D_4x32F = GLTexture2D<gl::RGBA32F>;
-using GLTex2D_Depth = GLTexture2D<gl::DEPTH_COMPONENT24>;
+using GLTex2D_3x8    = GLTexture2D<gl::RGB8>;
+using GLTex2D_1x8UI  = GLTexture2D<gl::R8UI>;
+using GLTex2D_1x16UI = GLTexture2D<gl::R16UI>;
+using GLTex2D_1x32F  = GLTexture2D<gl::R32F>;
+using GLTex2D_2x32F  = GLTexture2D<gl::RG32F>;
+using GLTex2D_3x32F  = GLTexture2D<gl::RGB32F>;
+using GLTex2D_4x16F  = GLTexture2D<gl::RGBA16F>;
+using GLTex2D_4x32F  = GLTexture2D<gl::RGBA32F>;
+using GLTex2D_Depth  = GLTexture2D<gl::DEPTH_COMPONENT24>;
@@ -1,5 +1,5 @@
 #include "GLTexture2D.h"
-#include <GLM\detail\func_common.hpp>
+#include <GLM\common.hpp>
 
 // Computes the number of MIP-map levels given the texture dimensions
 static inline GLsizei computeMipLvlCnt(const GLsizei width, const GLsizei height) {
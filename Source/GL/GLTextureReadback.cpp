@@ -0,0 +1,126 @@
+#include "GLTextureReadback.h"
+#include <cassert>
+#include <cstring>
+#include <vector>
+#include <OpenGL\gl_core_4_4.hpp>
+#include "..\Common\Utility.hpp"
+
+GLTextureReadback::GLTextureReadback(const GLsizei res_x, const GLsizei res_y):
+                                     m_fence{nullptr}, m_res_x{res_x}, m_res_y{res_y},
+                                     m_file_name{} {
+    gl::GenBuffers(1, &m_pbo);
+    gl::BindBuffer(gl::PIXEL_PACK_BUFFER, m_pbo);
+    gl::BufferData(gl::PIXEL_PACK_BUFFER, 4 * sizeof(GLfloat) * res_x * res_y, nullptr,
+                   gl::STREAM_READ);
+    gl::BindBuffer(gl::PIXEL_PACK_BUFFER, 0);
+}
+
+GLTextureReadback::GLTextureReadback(GLTextureReadback&& tr) {
+    // Copy the data
+    memcpy(this, &tr, sizeof(*this));
+    // Mark as moved
+    tr.m_pbo   = 0;
+    tr.m_fence = nullptr;
+}
+
+GLTextureReadback& GLTextureReadback::operator=(GLTextureReadback&& tr) {
+    assert(this != &tr);
+    // Free memory
+    gl::DeleteSync(m_fence);
+    gl::DeleteBuffers(1, &m_pbo);
+    // Now copy the data
+    memcpy(this, &tr, sizeof(*this));
+    // Mark as moved
+    tr.m_pbo   = 0;
+    tr.m_fence = nullptr;
+    return *this;
+}
+
+GLTextureReadback::~GLTextureReadback() {
+    // Check if it was moved
+    if (m_pbo) {
+        // Do not lose the last image
+        complete(true);
+        gl::DeleteBuffers(1, &m_pbo);
+    }
+}
+
+void GLTextureReadback::request(const GLuint tex_handle, const char* const file_name) {
+    // The buffer holds a single image
+    complete(true);
+    strncpy(m_file_name, file_name, FILENAME_MAX - 1);
+    // Make preceding image stores visible to the copy
+    gl::MemoryBarrier(gl::TEXTURE_UPDATE_BARRIER_BIT | gl::PIXEL_BUFFER_BARRIER_BIT);
+    // Copy the texture into the buffer; the call returns immediately
+    // Textures are bound to fixed texture units; restore the binding of the active one
+    GLint prev_tex_handle;
+    gl::GetIntegerv(gl::TEXTURE_BINDING_2D, &prev_tex_handle);
+    gl::BindBuffer(gl::PIXEL_PACK_BUFFER, m_pbo);
+    gl::BindTexture(gl::TEXTURE_2D, tex_handle);
+    gl::GetTexImage(gl::TEXTURE_2D, 0, gl::RGBA, gl::FLOAT, nullptr);
+    gl::BindTexture(gl::TEXTURE_2D, prev_tex_handle);
+    gl::BindBuffer(gl::PIXEL_PACK_BUFFER, 0);
+    m_fence = gl::FenceSync(gl::SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool GLTextureReadback::complete(const bool wait) {
+    if (!m_fence) return true;
+    GLbitfield wait_flags   = 0;
+    GLuint64   wait_nanosec = 0;
+    GLenum     wait_status;
+    do {
+        wait_status = gl::ClientWaitSync(m_fence, wait_flags, wait_nanosec);
+        if (!wait) break;
+        // If wait_status is no good, we have to flush the command buffer
+        wait_flags   = gl::SYNC_FLUSH_COMMANDS_BIT;
+        wait_nanosec = 1000;
+    } while (wait_status != gl::ALREADY_SIGNALED &&
+             wait_status != gl::CONDITION_SATISFIED);
+    if (wait_status != gl::ALREADY_SIGNALED && wait_status != gl::CONDITION_SATISFIED) {
+        // The copy is still in progress
+        return false;
+    }
+    gl::DeleteSync(m_fence);
+    m_fence = nullptr;
+    writePFM();
+    return true;
+}
+
+void GLTextureReadback::writePFM() const {
+    // Map the buffer
+    gl::BindBuffer(gl::PIXEL_PACK_BUFFER, m_pbo);
+    const auto rgba = static_cast<const GLfloat*>(gl::MapBufferRange(gl::PIXEL_PACK_BUFFER, 0,
+                      4 * sizeof(GLfloat) * m_res_x * m_res_y, gl::MAP_READ_BIT));
+    if (!rgba) {
+        gl::BindBuffer(gl::PIXEL_PACK_BUFFER, 0);
+        printError("Failed to map the readback buffer of image %s.", m_file_name);
+        return;
+    }
+    // Open file
+    auto file = fopen(m_file_name, "wb");
+    if (!file) {
+        gl::UnmapBuffer(gl::PIXEL_PACK_BUFFER);
+        gl::BindBuffer(gl::PIXEL_PACK_BUFFER, 0);
+        printError("Failed to open image file %s for writing.", m_file_name);
+        return;
+    }
+    // Write the header: color image, resolution, little-endian byte order (negative scale)
+    fprintf(file, "PF\n%d %d\n-1.0\n", m_res_x, m_res_y);
+    // Rows are stored bottom-to-top, same as in OpenGL
+    std::vector<GLfloat> row(3 * m_res_x);
+    for (GLsizei y = 0; y < m_res_y; ++y) {
+        for (GLsizei x = 0; x < m_res_x; ++x) {
+            const GLfloat* const texel{&rgba[4 * (y * m_res_x + x)]};
+            const GLfloat        inv_a{(texel[3] > 0.0f) ? 1.0f / texel[3] : 0.0f};
+            for (int c = 0; c < 3; ++c) {
+                row[3 * x + c] = inv_a * texel[c];
+            }
+        }
+        fwrite(row.data(), sizeof(GLfloat), row.size(), file);
+    }
+    gl::UnmapBuffer(gl::PIXEL_PACK_BUFFER);
+    gl::BindBuffer(gl::PIXEL_PACK_BUFFER, 0);
+    // Close file
+    fclose(file);
+    printInfo("Image written to %s.", m_file_name);
+}
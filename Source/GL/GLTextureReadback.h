@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdio>
+#include <OpenGL\gl_basic_typedefs.h>
+#include "..\Common\Definitions.h"
+
+/* Asynchronous readback of RGBA32F 2D textures into PFM image files
+   The texture is copied into a pixel pack buffer; the file is written once the copy completes */
+class GLTextureReadback {
+public:
+    GLTextureReadback() = delete;
+    RULE_OF_FIVE_NO_COPY(GLTextureReadback);
+    // Creates a pixel pack buffer for textures of the specified resolution
+    explicit GLTextureReadback(const GLsizei res_x, const GLsizei res_y);
+    // Starts copying the texture; after completion, its RGB values (divided by alpha, e.g. the
+    // number of accumulated frames) are written to the specified file
+    // Waits for the previous readback if it is pending
+    void request(const GLuint tex_handle, const char* const file_name);
+    // Writes the file if the copy is complete; returns 'true' if no readback is pending
+    // If 'wait' is set, waits for the copy to complete
+    bool complete(const bool wait);
+private:
+    // Writes the contents of the pixel pack buffer to the file
+    void writePFM() const;
+    // Private data members
+    GLuint  m_pbo;                          // Pixel pack buffer handle
+    GLsync  m_fence;                        // Signaled once the copy is complete; null if idle
+    GLsizei m_res_x, m_res_y;               // Resolution in x, y
+    char    m_file_name[FILENAME_MAX];      // Output file of the pending readback
+};
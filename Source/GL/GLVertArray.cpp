@@ -5,63 +5,22 @@
 
 GLVertArray::GLVertArray(const GLsizei n_attr, const GLsizei* const component_counts):
                          m_n_vbos{n_attr}, m_vbos{new VertBuffer[n_attr]}, m_is_buffered{false} {
-    // Create vertex array object
-    gl::GenVertexArrays(1, &m_handle);
-    gl::BindVertexArray(m_handle);
-    // Create buffer objects
-    GLuint buffer_handles[MAX_N_VBOS];
-    gl::GenBuffers(m_n_vbos, buffer_handles);
+    create(component_counts);
     for (auto i = 0; i < m_n_vbos; ++i) {
-        // Assign handles
-        m_vbos[i].handle = buffer_handles[i];
-        // Assign strides
-        m_vbos[i].n_components = component_counts[i];
         // Reserve a bit of memory
         m_vbos[i].data_vec.reserve(12);
     }
-    // Map attribute incides to buffers
-    for (GLuint i = 0; i < static_cast<GLuint>(m_n_vbos); ++i) {
-        gl::EnableVertexAttribArray(i);
-        #ifdef OLD_STYLE_BINDING
-            gl::BindBuffer(gl::ARRAY_BUFFER, m_vbos[i].handle);
-            gl::VertexAttribPointer(i, m_vbos[i].n_components, gl::FLOAT, GL_FALSE, 0, nullptr);
-        #else
-            gl::BindVertexBuffer(i, m_vbos[i].handle, 0, m_vbos[i].n_components * sizeof(GLfloat));
-            gl::VertexAttribFormat(i, m_vbos[i].n_components, gl::FLOAT, GL_FALSE, 0);
-            gl::VertexAttribBinding(i, i);
-        #endif
-    }
 }
 
 GLVertArray::GLVertArray(const GLVertArray& va): m_n_vbos{va.m_n_vbos},
                                                  m_vbos{new VertBuffer[m_n_vbos]},
                                                  m_is_buffered{va.m_is_buffered} {
-    // Create vertex array object
-    gl::GenVertexArrays(1, &m_handle);
-    gl::BindVertexArray(m_handle);
-    // Create buffer objects
-    GLuint buffer_handles[MAX_N_VBOS];
-    gl::GenBuffers(m_n_vbos, buffer_handles);
+    GLsizei component_counts[MAX_N_VBOS];
     for (auto i = 0; i < m_n_vbos; ++i) {
-        // Use the new handles...
-        m_vbos[i].handle = buffer_handles[i];
-        // ... and copy the rest
-        m_vbos[i].n_components = va.m_vbos[i].n_components;
-        m_vbos[i].data_vec     = va.m_vbos[i].data_vec;
-    }
-    // Map attribute incides to buffers
-    for (GLuint i = 0; i < static_cast<GLuint>(m_n_vbos); ++i) {
-        gl::EnableVertexAttribArray(i);
-        #ifdef OLD_STYLE_BINDING
-             gl::BindBuffer(gl::ARRAY_BUFFER, m_vbos[i].handle);
-             gl::VertexAttribPointer(i, m_vbos[i].n_components, gl::FLOAT, GL_FALSE, 0, nullptr);
-        #else
-             gl::BindVertexBuffer(i, m_vbos[i].handle, 0, m_vbos[i].n_components * sizeof(GLfloat));
-             gl::VertexAttribFormat(i, m_vbos[i].n_components, gl::FLOAT, GL_FALSE, 0);
-             gl::VertexAttribBinding(i, i);
-        #endif
+        component_counts[i] = va.m_vbos[i].n_components;
     }
-    if (va.m_is_buffered) { buffer(); }
+    create(component_counts);
+    copyData(va);
 }
 
 GLVertArray& GLVertArray::operator=(const GLVertArray& va) {
@@ -74,32 +33,12 @@ GLVertArray& GLVertArray::operator=(const GLVertArray& va) {
         m_n_vbos      = va.m_n_vbos;
         m_vbos        = new VertBuffer[m_n_vbos];
         m_is_buffered = va.m_is_buffered;
-        // Create vertex array object
-        gl::GenVertexArrays(1, &m_handle);
-        gl::BindVertexArray(m_handle);
-        // Create buffer objects
-        GLuint buffer_handles[MAX_N_VBOS];
-        gl::GenBuffers(m_n_vbos, buffer_handles);
+        GLsizei component_counts[MAX_N_VBOS];
         for (auto i = 0; i < m_n_vbos; ++i) {
-            // Use the new handles...
-            m_vbos[i].handle = buffer_handles[i];
-            // ... and copy the rest
-            m_vbos[i].n_components = va.m_vbos[i].n_components;
-            m_vbos[i].data_vec     = va.m_vbos[i].data_vec;
+            component_counts[i] = va.m_vbos[i].n_components;
         }
-        // Map attribute incides to buffers
-        for (GLuint i = 0; i < static_cast<GLuint>(m_n_vbos); ++i) {
-            gl::EnableVertexAttribArray(i);
-            #ifdef OLD_STYLE_BINDING
-                gl::BindBuffer(gl::ARRAY_BUFFER, m_vbos[i].handle);
-                gl::VertexAttribPointer(i, m_vbos[i].n_components, gl::FLOAT, GL_FALSE, 0, nullptr);
-            #else
-                gl::BindVertexBuffer(i, m_vbos[i].handle, 0, m_vbos[i].n_components * sizeof(GLfloat));
-                gl::VertexAttribFormat(i, m_vbos[i].n_components, gl::FLOAT, GL_FALSE, 0);
-                gl::VertexAttribBinding(i, i);
-            #endif
-        }
-        if (va.m_is_buffered) { buffer(); }
+        create(component_counts);
+        copyData(va);
     }
     return *this;
 }
@@ -130,6 +69,53 @@ GLVertArray::~GLVertArray() {
     }
 }
 
+void GLVertArray::create(const GLsizei* const component_counts) {
+    // Create vertex array object
+    gl::GenVertexArrays(1, &m_handle);
+    gl::BindVertexArray(m_handle);
+    // Create buffer objects
+    GLuint buffer_handles[MAX_N_VBOS];
+    gl::GenBuffers(m_n_vbos, buffer_handles);
+    for (auto i = 0; i < m_n_vbos; ++i) {
+        // Assign handles
+        m_vbos[i].handle = buffer_handles[i];
+        // Assign strides
+        m_vbos[i].n_components = component_counts[i];
+        // Nothing is buffered yet
+        m_vbos[i].byte_sz = 0;
+        // Advance per vertex
+        m_vbos[i].divisor = 0;
+    }
+    // Map attribute incides to buffers
+    for (GLuint i = 0; i < static_cast<GLuint>(m_n_vbos); ++i) {
+        gl::EnableVertexAttribArray(i);
+        #ifdef OLD_STYLE_BINDING
+            gl::BindBuffer(gl::ARRAY_BUFFER, m_vbos[i].handle);
+            gl::VertexAttribPointer(i, m_vbos[i].n_components, gl::FLOAT, GL_FALSE, 0, nullptr);
+        #else
+            gl::BindVertexBuffer(i, m_vbos[i].handle, 0, m_vbos[i].n_components * sizeof(GLfloat));
+            gl::VertexAttribFormat(i, m_vbos[i].n_components, gl::FLOAT, GL_FALSE, 0);
+            gl::VertexAttribBinding(i, i);
+        #endif
+    }
+}
+
+void GLVertArray::copyData(const GLVertArray& va) {
+    for (auto i = 0; i < m_n_vbos; ++i) {
+        m_vbos[i].data_vec = va.m_vbos[i].data_vec;
+        m_vbos[i].byte_sz  = va.m_vbos[i].byte_sz;
+        if (va.m_vbos[i].divisor) { setDivisor(i, va.m_vbos[i].divisor); }
+        if (m_vbos[i].byte_sz > 0) {
+            // The CPU copy has been released; copy on the GPU
+            gl::BindBuffer(gl::COPY_WRITE_BUFFER, m_vbos[i].handle);
+            gl::BufferData(gl::COPY_WRITE_BUFFER, m_vbos[i].byte_sz, nullptr, gl::STATIC_DRAW);
+            gl::BindBuffer(gl::COPY_READ_BUFFER, va.m_vbos[i].handle);
+            gl::CopyBufferSubData(gl::COPY_READ_BUFFER, gl::COPY_WRITE_BUFFER, 0, 0,
+                                  m_vbos[i].byte_sz);
+        }
+    }
+}
+
 void GLVertArray::destroy() {
     GLuint buffer_handles[MAX_N_VBOS];
     for (auto i = 0; i < m_n_vbos; ++i) {
@@ -156,11 +142,25 @@ void GLVertArray::loadData(const GLuint attr_id, const size_t n_elems,
     m_is_buffered = false;
 }
 
+void GLVertArray::setDivisor(const GLuint attr_id, const GLuint divisor) {
+    gl::BindVertexArray(m_handle);
+    #ifdef OLD_STYLE_BINDING
+        gl::VertexAttribDivisor(attr_id, divisor);
+    #else
+        gl::VertexBindingDivisor(attr_id, divisor);
+    #endif
+    m_vbos[attr_id].divisor = divisor;
+}
+
 void GLVertArray::buffer() {
     for (auto i = 0; i < m_n_vbos; ++i) {
+        if (m_vbos[i].data_vec.empty()) continue;
         gl::BindBuffer(gl::ARRAY_BUFFER, m_vbos[i].handle);
-        const auto byte_sz = m_vbos[i].data_vec.size() * sizeof(GLfloat);
-        gl::BufferData(gl::ARRAY_BUFFER, byte_sz, m_vbos[i].data_vec.data(), gl::STATIC_DRAW);
+        m_vbos[i].byte_sz = m_vbos[i].data_vec.size() * sizeof(GLfloat);
+        gl::BufferData(gl::ARRAY_BUFFER, m_vbos[i].byte_sz, m_vbos[i].data_vec.data(),
+                       gl::STATIC_DRAW);
+        // Release the staging storage
+        std::vector<GLfloat>().swap(m_vbos[i].data_vec);
     }
     m_is_buffered = true;
 }
@@ -170,6 +170,7 @@ void GLVertArray::draw(const GLenum mode) const {
     assert(m_is_buffered);
     gl::BindVertexArray(m_handle);
     // The size of the first buffer determines the number of vertices
-    const auto n_vert = static_cast<GLsizei>(m_vbos[0].data_vec.size() / 3);
+    const auto n_vert = static_cast<GLsizei>(m_vbos[0].byte_sz /
+                                             (m_vbos[0].n_components * sizeof(GLfloat)));
     gl::DrawArrays(mode, 0, n_vert);
 }
@@ -19,7 +19,11 @@ public:
     void loadData(const GLuint attr_id, const std::vector<GLfloat>& data_vec);
     // Loads data for specified attribute from an array
     void loadData(const GLuint attr_id, const size_t n_elems, const GLfloat* const data);
-    // Copies preloaded data to GPU
+    // Sets the number of instances per advance of the attribute (0 = advance per vertex)
+    void setDivisor(const GLuint attr_id, const GLuint divisor);
+    // Copies preloaded data to GPU and releases the CPU copy
+    // Data loaded afterwards replaces the buffered data once buffer() is called again;
+    // attributes without newly loaded data retain their buffered data
     void buffer();
     // Draws vertex array in specified a mode (such as gl::TRIANGLES)
     void draw(const GLenum mode) const;
@@ -28,10 +32,16 @@ private:
     struct VertBuffer {
         VertBuffer() = default;
         RULE_OF_ZERO(VertBuffer);
-        GLuint  handle;                 // OpenGL handle
-        GLsizei n_components;           // Number of FP components per element
-        std::vector<GLfloat> data_vec;  // Storage
+        GLuint     handle;              // OpenGL handle
+        GLsizei    n_components;        // Number of FP components per element
+        GLsizeiptr byte_sz;             // Size of the data buffered on GPU
+        GLuint     divisor;             // Instanced attribute divisor
+        std::vector<GLfloat> data_vec;  // Staging storage (until buffered)
     };
+    // Creates the vertex array object and the vertex buffer objects
+    void create(const GLsizei* const component_counts);
+    // Copies the (staged and buffered) data of another vertex array
+    void copyData(const GLVertArray& va);
     // Performs array destruction
     void destroy();
     // Private data members
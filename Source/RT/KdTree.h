@@ -14,10 +14,17 @@ namespace rt {
         explicit KdTree(const std::vector<Primitive>& primitives, const int inters_cost,
                         const int trav_cost, const int max_depth, const uint min_num_prims,
                         const float empty_bonus = 0.25f);
+        // Reconstructs k-d tree from the data produced by serialize()
+        // The primitives must be identical to the ones used to build the original tree
+        explicit KdTree(const std::vector<Primitive>& primitives, const char* const data);
         // Returns bounding box encompassing all primitives
         const BBox& bbox() const;
         // Front-to-back traversal algorithm
         bool intersect(Ray& ray, const bool is_vis_ray = false) const;
+        // Returns the size of the serialized tree in bytes
+        size_t serializedSize() const;
+        // Writes the tree to the buffer of serializedSize() bytes
+        void serialize(char* const data) const;
     private:
         // 8 byte node
         class Node {
@@ -75,6 +82,18 @@ namespace rt {
             uint   prim_id;                 // Triangle index within "m_prims" vector
             Type   type;                    // Bounding edge type
         };
+        /* Fixed-size part of the serialized tree */
+        struct SerialInfo {
+            int   max_depth, actual_depth;  // Max. possible and actual tree depth
+            uint  min_num_prims;            // Min. number of prims for instant leaf creation
+            float avg_prims_per_leaf;       // Average number of primitives per leaf
+            int   inters_cost, trav_cost;   // Intersection and traversal costs
+            float empty_bonus;              // Cost reduction bonus for empty nodes
+            uint  leaf_count;               // Number of leaf nodes
+            uint  n_nodes;                  // Number of nodes
+            uint  n_leaf_prim_ids;          // Number of primitive indices contained by leaves
+            float box_pts[2][3];            // Bounding points of the tree
+        };
         /* Element of k-d tree traversal stack */
         struct TraceNode {
             TraceNode() = default;
@@ -109,4 +128,6 @@ namespace rt {
 
     class Triangle;
     using KdTri = KdTree<Triangle>;
+    class Instance;
+    using KdInst = KdTree<Instance>;
 }
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "KdTree.h"
+#include <cstring>
 #include <algorithm>
+#include <GLM\gtc\type_ptr.hpp>
 #include "..\Common\Timer.h"
 #include "..\Common\Utility.hpp"
 
@@ -131,6 +133,55 @@ namespace rt {
         printInfo("k-d tree consists of %u nodes.", m_next_node_id);
     }
 
+    template <class Primitive>
+    KdTree<Primitive>::KdTree(const std::vector<Primitive>& primitives, const char* const data):
+                              m_prims{primitives.data()}, m_prim_boxes{nullptr} {
+        SerialInfo info;
+        memcpy(&info, data, sizeof(SerialInfo));
+        m_max_depth          = info.max_depth;
+        m_actual_depth       = info.actual_depth;
+        m_min_num_prims      = info.min_num_prims;
+        m_avg_prims_per_leaf = info.avg_prims_per_leaf;
+        m_inters_cost        = info.inters_cost;
+        m_trav_cost          = info.trav_cost;
+        m_empty_bonus        = info.empty_bonus;
+        m_tree_box           = BBox{glm::make_vec3(info.box_pts[0]),
+                                    glm::make_vec3(info.box_pts[1])};
+        m_next_node_id       = info.n_nodes;
+        m_n_alloc_nodes      = info.n_nodes;
+        m_leaf_count         = info.leaf_count;
+        for (auto axis = 0; axis < 3; ++axis) { m_edges[axis] = nullptr; }
+        // Copy the nodes and the primitive indices
+        const Node* const nodes{reinterpret_cast<const Node*>(data + sizeof(SerialInfo))};
+        m_nodes.assign(nodes, nodes + info.n_nodes);
+        const uint* const prim_ids{reinterpret_cast<const uint*>(nodes + info.n_nodes)};
+        m_leaf_prim_ids.assign(prim_ids, prim_ids + info.n_leaf_prim_ids);
+        printInfo("k-d tree with %u nodes loaded for %u primitives.", info.n_nodes,
+                  static_cast<uint>(primitives.size()));
+    }
+
+    template <class Primitive>
+    size_t KdTree<Primitive>::serializedSize() const {
+        return sizeof(SerialInfo) + m_nodes.size() * sizeof(Node) +
+               m_leaf_prim_ids.size() * sizeof(uint);
+    }
+
+    template <class Primitive>
+    void KdTree<Primitive>::serialize(char* const data) const {
+        const SerialInfo info = {
+            m_max_depth, m_actual_depth, m_min_num_prims, m_avg_prims_per_leaf,
+            m_inters_cost, m_trav_cost, m_empty_bonus, m_leaf_count,
+            static_cast<uint>(m_nodes.size()), static_cast<uint>(m_leaf_prim_ids.size()),
+            {{m_tree_box.minPt().x, m_tree_box.minPt().y, m_tree_box.minPt().z},
+             {m_tree_box.maxPt().x, m_tree_box.maxPt().y, m_tree_box.maxPt().z}}
+        };
+        memcpy(data, &info, sizeof(SerialInfo));
+        char* const nodes{data + sizeof(SerialInfo)};
+        memcpy(nodes, m_nodes.data(), m_nodes.size() * sizeof(Node));
+        memcpy(nodes + m_nodes.size() * sizeof(Node), m_leaf_prim_ids.data(),
+               m_leaf_prim_ids.size() * sizeof(uint));
+    }
+
     template <class Primitive>
     const BBox& KdTree<Primitive>::bbox() const {
         return m_tree_box;
@@ -315,7 +366,7 @@ namespace rt {
                 if (1u == n_prims) {
                     // Intersect this primitive
                     const Primitive& prim{m_prims[node->single_prim_id]};
-                    if (prim.intersect(ray)) {
+                    if (prim.intersect(ray, is_vis_ray)) {
                         // Intersection found
                         return true;
                     }
@@ -323,7 +374,7 @@ namespace rt {
                     bool hit{false};
                     for (uint i = 0; i < n_prims; ++i) {
                         const Primitive& prim{m_prims[m_leaf_prim_ids[node->prims_offset + i]]};
-                        if (prim.intersect(ray)) {
+                        if (prim.intersect(ray, is_vis_ray)) {
                             // Intersection found
                             if (is_vis_ray) { return true; }
                             hit = true;
@@ -3,6 +3,7 @@
 #include "..\Common\Constants.h"
 #include "..\Common\Random.h"
 #include "..\Common\Scene.h"
+#include "..\Common\TraceLog.h"
 #include "..\Common\Utility.hpp"
 #include "..\VPL\PointLight.hpp"
 #include "..\VPL\LightArray.hpp"
@@ -59,24 +60,39 @@ namespace rt {
     }
 
     // Calculates distance to next event within medium using Woodcock tracking algorithm
+    // The ray is split into segments, each tracked using its own (local) majorant
+    // Free path lengths are memoryless, so tracking can restart at the end of each segment
     static inline bool calcEventDistWT(const Scene& scene, const rt::Ray& ray,
                                        float& d_event, float& p_event) {
-        const float maj_ext_k{scene.getMajExtK()};
-        if (0.0f == maj_ext_k) { return false; }
-        d_event = ray.t_min;
+        if (0.0f == scene.getMajExtK()) { return false; }
+        const vec3  fog_dims{scene.getFogBounds().dimensions()};
+        const float seg_len{max(max(fog_dims.x, fog_dims.y), fog_dims.z) / WT_N_SEGMENTS};
         p_event = 0.0f;
-        while (d_event < ray.t_max && p_event < UnitRNG::generate()) {
-            const float dt{-log(1.0f - UnitRNG::generate()) / maj_ext_k};
-            d_event += dt;
-            const vec3  s_pos{ray.getPtAtDist(d_event)};
-            const float ext_k{scene.sampleExtK(s_pos)};
-            p_event = ext_k / maj_ext_k;
+        for (float t_start = ray.t_min; t_start < ray.t_max; t_start += seg_len) {
+            const float t_end{min(t_start + seg_len, ray.t_max)};
+            const float maj_ext_k{scene.sampleMajExtK(ray.getPtAtDist(t_start),
+                                                      ray.getPtAtDist(t_end))};
+            // Skip empty segments without sampling them
+            if (0.0f == maj_ext_k) continue;
+            d_event = t_start;
+            while (true) {
+                const float dt{-log(1.0f - UnitRNG::generate()) / maj_ext_k};
+                d_event += dt;
+                if (d_event >= t_end) break;
+                const vec3  s_pos{ray.getPtAtDist(d_event)};
+                const float ext_k{scene.sampleExtK(s_pos)};
+                p_event = ext_k / maj_ext_k;
+                // Accept a real collision; reject a null collision
+                if (p_event >= UnitRNG::generate()) return true;
+            }
         }
-        return d_event < ray.t_max;
+        d_event = ray.t_max;
+        return false;
     }
 
     void PhotonTracer::trace(const Scene& scene, const PPL& source, const glm::vec3& shoot_dir,
                              const int max_vpl_count, LightArray<VPL>& la) {
+        TRACE_ZONE("Photon tracing");
         la.clear();
         uint n_paths{0};    // Total number of paths traced
         do {
@@ -1,13 +1,17 @@
 #include "RTBase.h"
+#include <GLM\matrix.hpp>
 #include "..\Common\Constants.h"
 #include "..\Common\Utility.hpp"
 #include "..\Common\Random.h"
 #include "..\Common\Scene.h"
+#include "KdTree.hpp"
 
 using glm::vec2;
 using glm::vec3;
 using glm::uvec3;
+using glm::vec4;
 using glm::mat3;
+using glm::mat4;
 using glm::min;
 using glm::max;
 using glm::dot;
@@ -132,11 +136,11 @@ namespace rt {
 
     Ray::Intersection::Intersection(): material{nullptr}, distance{FLT_MAX}, normal{0.0f} {}
 
-    Triangle::Triangle(const uvec3& indices, const uint mat_id): m_indices{indices},
-                                                                 m_mat_id{mat_id} {}
+    Triangle::Triangle(const uvec3& indices, const PhongMaterial* const material):
+                       m_indices{indices}, m_material{material} {}
 
     const PhongMaterial* Triangle::material() const {
-        return scene->getMaterial(m_mat_id);
+        return m_material;
     }
 
     BBox Triangle::computeBBox() const {
@@ -147,7 +151,7 @@ namespace rt {
         return box;
     }
 
-    bool Triangle::intersect(Ray& ray) const {
+    bool Triangle::intersect(Ray& ray, const bool) const {
         const vec3& pt0{scene->getVertex(m_indices[0])};
         const vec3& pt1{scene->getVertex(m_indices[1])};
         const vec3& pt2{scene->getVertex(m_indices[2])};
@@ -175,4 +179,37 @@ namespace rt {
         }
         return false;
     }
+
+    Instance::Instance(const KdTri* const kd_tree, const mat4& obj_to_world): m_kd_tree{kd_tree},
+                       m_obj_to_world{obj_to_world}, m_world_to_obj{glm::inverse(obj_to_world)},
+                       m_norm_mat{glm::transpose(mat3{m_world_to_obj})} {}
+
+    BBox Instance::computeBBox() const {
+        const BBox& obj_box{m_kd_tree->bbox()};
+        const vec3  pts[2] = {obj_box.minPt(), obj_box.maxPt()};
+        // Transform the corners of the box
+        BBox box{};
+        for (uint i = 0; i < 8; ++i) {
+            const vec3 corner{pts[i & 1].x, pts[(i >> 1) & 1].y, pts[i >> 2].z};
+            box.extend(vec3{m_obj_to_world * vec4{corner, 1.0f}});
+        }
+        return box;
+    }
+
+    bool Instance::intersect(Ray& ray, const bool is_vis_ray) const {
+        // Transform the ray to object space; the direction is not normalized,
+        // so parametric distances (and the intersection distance) are preserved
+        Ray obj_ray{ray};
+        obj_ray.o     = vec3{m_world_to_obj * vec4{ray.o, 1.0f}};
+        obj_ray.d     = mat3{m_world_to_obj} * ray.d;
+        obj_ray.inv_d = 1.0f / obj_ray.d;
+        if (m_kd_tree->intersect(obj_ray, is_vis_ray)) {
+            // Intersection found
+            ray.inters.distance = obj_ray.inters.distance;
+            ray.inters.normal   = m_norm_mat * obj_ray.inters.normal;
+            ray.inters.material = obj_ray.inters.material;
+            return true;
+        }
+        return false;
+    }
 }
@@ -2,12 +2,15 @@
 
 #include <limits>
 #include <GLM\mat3x3.hpp>
+#include <GLM\mat4x4.hpp>
 #include <GLM\geometric.hpp>
 #include "..\Common\Definitions.h"
 
 class BBox;
 
 namespace rt {
+    template <class Primitive> class KdTree;
+
     // Difference between 1.0f and the next <float>
     CONSTEXPR float EPS{std::numeric_limits<float>::epsilon()};
 
@@ -109,17 +112,39 @@ namespace rt {
     public:
         Triangle() = delete;
         RULE_OF_ZERO(Triangle);
-        // Constructor, accepts indices of vert/norm/texcoords, and material index
-        explicit Triangle(const glm::uvec3& indices, const uint mat_id);
+        // Constructor, accepts indices of vert/norm/texcoords, and material
+        // The material must outlive the triangle
+        explicit Triangle(const glm::uvec3& indices, const PhongMaterial* const material);
         // Returns material associated with the triangle
         const PhongMaterial* material() const;
         // Computes BBox encompassing triangle
         BBox computeBBox() const;
         // Mller-Trumbore intersection algorithm (1997)
         // Returns true if ray intersects triangle, false otherwise
-        bool intersect(Ray& ray) const;
+        // The visibility ray flag is unused (a triangle has at most one intersection)
+        bool intersect(Ray& ray, const bool is_vis_ray) const;
+    private:
+        glm::uvec3           m_indices;     // Indices in vectors of vertices, normals, tex. coords
+        const PhongMaterial* m_material;    // Material (owned by the material table)
+    };
+
+    /* Instance primitive class: transformed reference to a mesh (and its k-d tree) */
+    class Instance {
+    public:
+        Instance() = delete;
+        RULE_OF_ZERO(Instance);
+        // Constructor, accepts the k-d tree of the mesh and the object-to-world transformation
+        // The k-d tree must outlive the instance
+        explicit Instance(const KdTree<Triangle>* const kd_tree, const glm::mat4& obj_to_world);
+        // Computes BBox encompassing the transformed mesh
+        BBox computeBBox() const;
+        // Returns true if ray intersects the transformed mesh, false otherwise
+        // Visibility rays terminate at the first intersection found within the mesh
+        bool intersect(Ray& ray, const bool is_vis_ray) const;
     private:
-        glm::uvec3 m_indices;       // Indices in vectors of vertices, normals and tex. coords
-        uint       m_mat_id;        // Index in vector of materials
+        const KdTree<Triangle>* m_kd_tree;  // Bottom-level acceleration structure
+        glm::mat4 m_obj_to_world;           // Object-to-world transformation matrix
+        glm::mat4 m_world_to_obj;           // World-to-object transformation matrix
+        glm::mat3 m_norm_mat;               // Object-to-world normal transformation matrix
     };
 }
@@ -9,7 +9,7 @@ layout (early_fragment_tests) in;           // Force early Z-test (prior to FS)
 smooth in vec3 w_pos;                       // Fragment position in world space
 smooth in vec3 w_norm;                      // Fragment normal in world space
 
-layout (location = 0) uniform int mat_id;   // Material index
+flat   in uint mat_id;                      // Material index
 
 // Vars OUT >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 
@@ -2,8 +2,11 @@
 
 // Vars IN >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 
-layout (location = 0) in vec3 vert_m_pos;   // Vertex position in model coordinates
-layout (location = 1) in vec3 vert_m_norm;  // Vertex normal in model coordinates
+layout (location = 0) in vec3 vert_o_pos;   // Vertex position in object coordinates
+layout (location = 1) in vec3 vert_o_norm;  // Vertex normal in object coordinates
+layout (location = 2) in float inst_mat_id; // Material index (per instance)
+layout (location = 3) in mat4  inst_mat;    // Object-to-model transformation matrix (per instance)
+layout (location = 7) in mat3  inst_nmat;   // Object-to-model normal transformation (per instance)
 
 uniform mat4 model_mat;                     // Model-to-world space transformation matrix
 uniform mat4 MVP;                           // Model-to-clip (homogeneous) space transformation matrix
@@ -13,14 +16,18 @@ uniform mat3 norm_mat;                      // Model-to-camera space normal vect
 
 smooth out vec3 w_pos;                      // Position in world space
 smooth out vec3 w_norm;                     // Normal in camera space
+flat   out uint mat_id;                     // Material index
 
 // Implementation >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 
 void main() {
-    const vec4 vert_m_pos4 = vec4(vert_m_pos, 1.0);
+    // Transform vertex position and normal from object to model space
+    const vec4 vert_m_pos4 = inst_mat * vec4(vert_o_pos, 1.0);
+    const vec3 vert_m_norm = inst_nmat * vert_o_norm;
     // Transform vertex position and normal to world space
     w_pos  = (model_mat * vert_m_pos4).xyz;
     w_norm = normalize(norm_mat * vert_m_norm);
+    mat_id = uint(inst_mat_id);
     // Transform vertex position to clip coordinates
     gl_Position = MVP * vert_m_pos4;
 }
@@ -2,10 +2,11 @@
 
 #define INV_PI        0.318309873       // 1 / π
 #define CAM_RES       1024              // Camera sensor resolution
+#define TILE_SZ       16                // Tile size used for VPL culling
+#define ILV_SZ        4                 // Size of pixel blocks used for interleaved sampling
 #define HG_G          0.25              // Henyey-Greenstein scattering asymmetry parameter
 #define R_M_INTERVALS 8                 // Number of ray marching intervals
 #define CLAMP_DIST_SQ 75.0 * 75.0       // Radius squared used for clamping
-#define MAX_MATERIALS 8                 // Max. number of materials
 #define MAX_PPLS      1                 // Max. number of primary lights
 #define MAX_VPLS      150               // Max. number of secondary lights
 #define MAX_FRAMES    30                // Max. number of frames before convergence is achieved
@@ -38,9 +39,9 @@ struct VirtualPointLight {
 
 // Vars IN >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 
-layout (std140, binding = 0)
-uniform Materials {
-    Material materials[MAX_MATERIALS];
+layout (std430, binding = 0)
+readonly buffer Materials {
+    Material materials[];
 };
 
 layout (std140, binding = 1)
@@ -53,8 +54,19 @@ uniform VPLs {
     VirtualPointLight vpls[3 * MAX_VPLS];
 };
 
+// For each tile: the number of VPLs, followed by their indices (within the active buffer)
+layout (std430, binding = 1)
+restrict readonly buffer TileVPLs {
+    uint tile_vpls[];
+};
+
+// For each tile: 1 if it has converged (and no longer has to be shaded), 0 otherwise
+layout (std430, binding = 2)
+restrict readonly buffer TileConv {
+    uint tile_conv[];
+};
+
 // Omnidirectional shadow mapping
-uniform int                    n_vpls;          // Number of active VPLs
 uniform samplerCubeArrayShadow ppl_shadow_cube; // Cubemap array of shadowmaps of PPLs
 uniform samplerCubeArrayShadow vpl_shadow_cube; // Cubemap array of shadowmaps of VPLs
 uniform float                  inv_max_dist_sq; // Inverse max. [shadow] distance squared
@@ -67,6 +79,7 @@ uniform usampler2D    material_ids;     // Per-fragment material indices
 // Fog
 uniform sampler3D     vol_dens;         // Normalized volume density (3D texture)
 uniform sampler3D     pi_dens;          // Preintegrated fog density values
+uniform sampler3D     ppl_dens;         // Fog density integrated towards the primary light
 uniform vec3          fog_bounds[2];    // Minimal and maximal bounding points of fog volume
 uniform vec3          inv_fog_dims;     // Inverse of fog dimensions
 uniform float         ext_k;            // Extinction coefficient per unit density
@@ -80,7 +93,12 @@ uniform int           frame_id;         // Frame index, is set to zero on reset
 uniform int           exposure;         // Exposure time
 uniform vec3          cam_w_pos;        // Camera position in world space
 uniform int           tri_buf_idx;      // Active buffer index within ring-triple-buffer
+uniform bool          interleaved;      // Determines whether VPLs are interleaved across pixels
+uniform bool          keep_history;     // Indicates whether the frame is blended with the history
 uniform SAFE layout(rgba32f) image2D accum_buffer;      // Accumulation buffer
+uniform SAFE writeonly layout(rgba32f) image2D vpl_contrib; // Unfiltered VPL contribution
+uniform SAFE writeonly layout(rgba32f) image2D history; // Mean indirect radiance and n. of frames
+uniform SAFE layout(rgba32f) image2D direct_rad;        // Direct lighting of the last shaded frame
 
 // Vars OUT >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 
@@ -125,14 +143,53 @@ void recordRayDist(in const float t_min, in const float t_max) {
     imageStore(fog_dist, ivec2(gl_FragCoord.xy), vec4(t_min, t_max, 0.0, 0.0));
 }
 
-// Returns the color value from the accumulation buffer
-vec3 readFromAccumBuffer() {
-    return imageLoad(accum_buffer, ivec2(gl_FragCoord.xy)).rgb;
+// Returns the value from the accumulation buffer
+// Alpha is the number of accumulated frames
+vec4 readFromAccumBuffer() {
+    return imageLoad(accum_buffer, ivec2(gl_FragCoord.xy));
 }
 
-// Writes the color value to the accumulation buffer
-void writeToAccumBuffer(in const vec3 color) {
-    imageStore(accum_buffer, ivec2(gl_FragCoord.xy), vec4(color, 1.0));
+// Writes the value to the accumulation buffer
+void writeToAccumBuffer(in const vec4 value) {
+    imageStore(accum_buffer, ivec2(gl_FragCoord.xy), value);
+}
+
+// Saves the history: the mean indirect (VPL and fog) radiance and the number of frames
+// Direct lighting is noise-free, so it is recomputed rather than reused
+void saveHistory() {
+    const ivec2 pixel  = ivec2(gl_FragCoord.xy);
+    const vec4  prev   = readFromAccumBuffer();
+    if (prev.a > 0.0) {
+        const vec3 direct = imageLoad(direct_rad, pixel).rgb;
+        imageStore(history, pixel, vec4(prev.rgb / prev.a - direct, prev.a));
+    } else {
+        // No frames have been accumulated; there is no history
+        imageStore(history, pixel, vec4(0.0));
+    }
+}
+
+// Saves direct lighting of the frame
+void recordDirect(in const vec3 color) {
+    imageStore(direct_rad, ivec2(gl_FragCoord.xy), vec4(color, 0.0));
+}
+
+// Saves the (interleaved) VPL contribution for filtering
+void recordVplContrib(in const vec3 color) {
+    imageStore(vpl_contrib, ivec2(gl_FragCoord.xy), vec4(color, 1.0));
+}
+
+// Returns the index of the subset of VPLs shaded by the fragment (using interleaved sampling)
+// The assignment of subsets to pixels of a block changes every frame
+int calcVplSubset() {
+    const ivec2 pos = ivec2(gl_FragCoord.xy) % ILV_SZ;
+    return (pos.y * ILV_SZ + pos.x + frame_id) % (ILV_SZ * ILV_SZ);
+}
+
+// Returns whether the tile containing the pixel has converged
+// The flags are out of date once progressive rendering restarts
+bool isTileConverged(in const ivec2 pixel) {
+    const ivec2 tile = pixel / TILE_SZ;
+    return frame_id > 0 && 0 != tile_conv[tile.y * (CAM_RES / TILE_SZ) + tile.x];
 }
 
 // Performs ray-BBox intersection
@@ -156,11 +213,25 @@ bool intersectBBox(in const vec3 bound_pts[2], in const vec3 ray_o, in const vec
     return t_max > max(t_min, 0.0) && t_min < max_dist;
 }
 
-// Computes fog density at the specified world position
-float calcFogDens(in const vec3 w_pos) {
+// Computes fog density at the specified world position using the specified MIP level
+float calcFogDens(in const vec3 w_pos, in const float lod) {
     const vec3 r_pos = w_pos - fog_bounds[0];
     const vec3 n_pos = r_pos * inv_fog_dims;
-    return texture(vol_dens, n_pos).r;
+    return textureLod(vol_dens, n_pos, lod).r;
+}
+
+// Computes fog density at the specified world position
+float calcFogDens(in const vec3 w_pos) {
+    return calcFogDens(w_pos, 0.0);
+}
+
+// Computes the MIP level of the density texture appropriate for the given ray marching step
+float calcDensLod(in const float step) {
+    const vec3  texels_per_unit = vec3(textureSize(vol_dens, 0)) * inv_fog_dims;
+    // Use the largest texel footprint, just as OpenGL does
+    const float texels_per_step = step * max(max(texels_per_unit.x, texels_per_unit.y),
+                                             texels_per_unit.z);
+    return log2(max(texels_per_step, 1.0));
 }
 
 // Returns the extinction coefficient at the specified world space position
@@ -168,16 +239,24 @@ float sampleExtK(in const vec3 w_pos) {
     return ext_k * calcFogDens(w_pos);
 }
 
+// Returns the extinction coefficient at the specified world space position
+// using the specified MIP level
+float sampleExtK(in const vec3 w_pos, in const float lod) {
+    return ext_k * calcFogDens(w_pos, lod);
+}
+
 // Performs ray marching
 float rayMarch(in const vec3 ray_o, in const vec3 ray_d,
                in const float t_min, in const float t_max) {
     const float dt    = (t_max - t_min) / R_M_INTERVALS;
-    float prev_ext_k  = sampleExtK(ray_o + t_min * ray_d);
+    // Large steps use coarse MIP levels to avoid aliasing
+    const float lod   = calcDensLod(dt);
+    float prev_ext_k  = sampleExtK(ray_o + t_min * ray_d, lod);
     float total_ext_k = 0.0;
     for (int i = 1; i <= R_M_INTERVALS; ++i) {
         // Distance to the end of the interval
         const float t = t_min + i * dt;
-        const float curr_ext_k = sampleExtK(ray_o + t * ray_d);
+        const float curr_ext_k = sampleExtK(ray_o + t * ray_d, lod);
         // Use trapezoidal rule for integration
         total_ext_k += 0.5 * (prev_ext_k + curr_ext_k);
         prev_ext_k = curr_ext_k;
@@ -202,6 +281,20 @@ float calcTransm(in const vec3 samp_pt, in const vec3 dir, in const float dist_s
     return transm;
 }
 
+// Calculates transmittance towards the primary light using the cached density integral
+// Falls back to ray marching for points outside of the fog volume
+float calcPplTransm(in const vec3 samp_pt, in const vec3 dir, in const float dist_sq) {
+    const vec3 n_pos = (samp_pt - fog_bounds[0]) * inv_fog_dims;
+    const bool in_fog = all(greaterThanEqual(n_pos, vec3(0.0))) &&
+                        all(lessThanEqual(n_pos, vec3(1.0)));
+    if (ext_k > 0.0 && in_fog) {
+        // Apply Beer's law
+        return exp(-ext_k * texture(ppl_dens, n_pos).r);
+    } else {
+        return calcTransm(samp_pt, dir, dist_sq);
+    }
+}
+
 // Evaluates the Phong BRDF
 vec3 phongBRDF(in const vec3 I, in const vec3 N, in const vec3 O,
                in const vec3 k_d, in const vec3 k_s, in const float n_s) {
@@ -253,7 +346,7 @@ vec3 calcPplContrib(in const int light_id, in const vec3 w_pos, in const vec3 N,
     if (visibility > 0.0) {
         // Light is visible from the fragment
         const vec3  I       = normalize(-d);
-        const float transm  = calcTransm(w_pos, I, dist_sq);
+        const float transm  = calcPplTransm(w_pos, I, dist_sq);
         const float falloff = 1.0 / dist_sq;
         const vec3  Li      = transm * ppls[light_id].intens * falloff;
         // Evaluate the rendering equation
@@ -289,8 +382,9 @@ vec3 calcVplContrib(in const int light_id, in const vec3 w_pos, in const vec3 N,
 
 void main() {
     frag_col = vec3(0.0);
-    if (frame_id < MAX_FRAMES) {
+    if (frame_id < MAX_FRAMES && !isTileConverged(ivec2(gl_FragCoord.xy))) {
         // Perform shading
+        vec3  vpl_col     = vec3(0.0);
         float transm_frag = 1.0;
         const vec3 w_pos  = getWorldPos();
         const vec3 ray_d  = normalize(w_pos - cam_w_pos);
@@ -323,21 +417,42 @@ void main() {
                 }
             }
             if (gi_enabled) {
-                // Gather contribution of VPLs
-                for (int i = tri_buf_idx * MAX_VPLS, e = i + n_vpls; i < e; ++i) {
-                    frag_col += transm_frag * calcVplContrib(i, w_pos, w_norm, -ray_d, material);
+                // With interleaved sampling, the pixel only shades its subset of VPLs
+                const int n_subsets = interleaved ? ILV_SZ * ILV_SZ : 1;
+                const int subset    = interleaved ? calcVplSubset() : 0;
+                // Gather contribution of VPLs which (noticeably) affect the tile
+                const ivec2 tile  = ivec2(gl_FragCoord.xy) / TILE_SZ;
+                const int   first = (tile.y * (CAM_RES / TILE_SZ) + tile.x) * (MAX_VPLS + 1);
+                const int   count = int(tile_vpls[first]);
+                for (int j = first + 1, e = j + count; j < e; ++j) {
+                    const int k = int(tile_vpls[j]);
+                    if (subset != k % n_subsets) continue;
+                    const int i = tri_buf_idx * MAX_VPLS + k;
+                    vpl_col += calcVplContrib(i, w_pos, w_norm, -ray_d, material);
                 }
+                // Each subset estimates the contribution of all VPLs
+                vpl_col *= transm_frag * n_subsets;
             }
         }
+        if (0 == frame_id && keep_history) {
+            // The combination pass blends the history with the frame
+            saveHistory();
+        }
+        recordDirect(frag_col);
+        if (gi_enabled && interleaved) {
+            // Leave the VPL contribution to the discontinuity buffer filter
+            recordVplContrib(vpl_col);
+        } else {
+            frag_col += vpl_col;
+        }
+        vec4 accum = vec4(frag_col, 1.0);
         if (frame_id > 0) {
-            // Read the value from the previous frame
-            const vec3 prev_color = readFromAccumBuffer();
-            // Accumulate radiance
-            frag_col += prev_color;
+            // Accumulate radiance and count the frame
+            accum += readFromAccumBuffer();
         }
         // Update the accumulation buffer
-        writeToAccumBuffer(frag_col);
+        writeToAccumBuffer(accum);
     } else {
-        // Do nothing; accumulation buffer values are final
+        // Do nothing; accumulation buffer values are final (or have converged)
     }
 }
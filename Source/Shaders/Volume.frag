@@ -1,15 +1,17 @@
 #version 440
 
 #define INV_PI        0.318309873       // 1 / π
-#define CAM_RES       1024 / 2          // Camera sensor resolution
+#define CAM_RES       1024              // Camera sensor resolution
+#define TILE_SZ       16                // Tile size used for convergence tracking
 #define HG_G          0.25              // Henyey-Greenstein scattering asymmetry parameter
 #define R_M_INTERVALS 8                 // Number of ray marching intervals
 #define CLAMP_DIST_SQ 75.0 * 75.0       // Radius squared used for clamping
-#define MAX_MATERIALS 8                 // Max. number of materials
 #define MAX_PPLS      1                 // Max. number of primary lights
 #define MAX_VPLS      150               // Max. number of secondary lights
 #define MAX_FRAMES    30                // Max. number of frames before convergence is achieved
 #define MAX_VOL_SAMP   32               // Max. number of volume samples per pixel
+#define TRANSM_EPS    0.001             // Transmittance below which fog is ignored
+#define FULL_SAMP_OPAC 0.5              // Fog opacity along the ray which requires all samples
 #define SAFE          restrict coherent // Assume coherency within shader, enforce it between shaders
 
 struct Material {
@@ -49,6 +51,12 @@ uniform VPLs {
     VirtualPointLight vpls[3 * MAX_VPLS];
 };
 
+// For each tile: 1 if it has converged (and no longer has to be shaded), 0 otherwise
+layout (std430, binding = 2)
+restrict readonly buffer TileConv {
+    uint tile_conv[];
+};
+
 // Omnidirectional shadow mapping
 uniform int                    n_vpls;          // Number of active VPLs
 uniform samplerCubeArrayShadow ppl_shadow_cube; // Cubemap array of shadowmaps of PPLs
@@ -61,6 +69,7 @@ uniform sampler2D     w_positions;      // Per-fragment position(s) in world spa
 // Fog
 uniform sampler3D     vol_dens;         // Normalized volume density (3D texture)
 uniform sampler3D     pi_dens;          // Preintegrated fog density values
+uniform sampler3D     ppl_dens;         // Fog density integrated towards the primary light
 uniform vec3          fog_bounds[2];    // Minimal and maximal bounding points of fog volume
 uniform vec3          inv_fog_dims;     // Inverse of fog dimensions
 uniform float         sca_k;            // Scattering coefficient per unit density
@@ -72,7 +81,7 @@ uniform SAFE readonly layout(rg32f) image2D fog_dist; // Primary ray entry/exit
 // Misc
 uniform bool          gi_enabled;       // Flag indicating whether Global Illumination is enabled
 uniform bool          clamp_rsq;        // Determines whether radius squared is clamped
-uniform bool          transm_opt;       // If set to false, shadow rays use ray marching for transmittance
+uniform bool          transm_opt;       // If set to false, VPL shadow rays use ray marching
 uniform int           frame_id;         // Frame index, is set to zero on reset
 uniform int           exposure;         // Exposure time
 uniform vec3          cam_w_pos;        // Camera position in world space
@@ -97,6 +106,56 @@ void restoreRayDist(out float t_min, out float t_max) {
     t_max = v.g;
 }
 
+// Returns the knot of the piecewise-linear optical depth along the primary ray
+// Knots 1..n_slices are located at the centers of the slices of the preintegrated density
+// Knots 0 and (n_slices + 1) are located at the beginning and the end of the fog interval
+vec2 getOptDepthKnot(in const ivec2 texel, in const int n_slices, in const int k) {
+    if (0 == k) {
+        return vec2(0.0);
+    } else if (k <= n_slices) {
+        return vec2((k - 0.5) / n_slices, ext_k * texelFetch(pi_dens, ivec3(texel, k - 1), 0).r);
+    } else {
+        // Extrapolate over the last half of the slice
+        const float last = texelFetch(pi_dens, ivec3(texel, n_slices - 1), 0).r;
+        const float prev = texelFetch(pi_dens, ivec3(texel, n_slices - 2), 0).r;
+        return vec2(1.0, ext_k * (last + 0.5 * (last - prev)));
+    }
+}
+
+// Returns the normalized distance along the primary ray at which the optical depth
+// reaches the specified value; also returns the derivative of the optical depth there
+// The optical depth must be below that of the last knot; otherwise, the derivative is 0
+float invertOptDepth(in const ivec2 texel, in const int n_slices, in const float opt_depth,
+                     out float d_opt_depth) {
+    if (opt_depth >= getOptDepthKnot(texel, n_slices, n_slices + 1).y) {
+        // Round-off has moved the sample past the end of the fog interval
+        d_opt_depth = 0.0;
+        return 1.0;
+    }
+    // Find the first knot with a larger optical depth using binary search
+    int lo = 1, hi = n_slices + 1;
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (getOptDepthKnot(texel, n_slices, mid).y > opt_depth) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    // Interpolate linearly between the adjacent knots
+    const vec2 k0 = getOptDepthKnot(texel, n_slices, lo - 1);
+    const vec2 k1 = getOptDepthKnot(texel, n_slices, lo);
+    d_opt_depth = (k1.y - k0.y) / (k1.x - k0.x);
+    return k0.x + (opt_depth - k0.y) / d_opt_depth;
+}
+
+// Returns whether the tile containing the pixel has converged
+// The flags are out of date once progressive rendering restarts
+bool isTileConverged(in const ivec2 pixel) {
+    const ivec2 tile = pixel / TILE_SZ;
+    return frame_id > 0 && 0 != tile_conv[tile.y * (CAM_RES / TILE_SZ) + tile.x];
+}
+
 // Performs ray-BBox intersection
 bool intersectBBox(in const vec3 bound_pts[2], in const vec3 ray_o, in const vec3 ray_d,
                    in const float max_dist, out float t_min, out float t_max) {
@@ -118,11 +177,25 @@ bool intersectBBox(in const vec3 bound_pts[2], in const vec3 ray_o, in const vec
     return t_max > max(t_min, 0.0) && t_min < max_dist;
 }
 
-// Computes fog density at the specified world position
-float calcFogDens(in const vec3 w_pos) {
+// Computes fog density at the specified world position using the specified MIP level
+float calcFogDens(in const vec3 w_pos, in const float lod) {
     const vec3 r_pos = w_pos - fog_bounds[0];
     const vec3 n_pos = r_pos * inv_fog_dims;
-    return texture(vol_dens, n_pos).r;
+    return textureLod(vol_dens, n_pos, lod).r;
+}
+
+// Computes fog density at the specified world position
+float calcFogDens(in const vec3 w_pos) {
+    return calcFogDens(w_pos, 0.0);
+}
+
+// Computes the MIP level of the density texture appropriate for the given ray marching step
+float calcDensLod(in const float step) {
+    const vec3  texels_per_unit = vec3(textureSize(vol_dens, 0)) * inv_fog_dims;
+    // Use the largest texel footprint, just as OpenGL does
+    const float texels_per_step = step * max(max(texels_per_unit.x, texels_per_unit.y),
+                                             texels_per_unit.z);
+    return log2(max(texels_per_step, 1.0));
 }
 
 // Returns the scattering coefficient at the specified world space position
@@ -136,16 +209,24 @@ float sampleExtK(in const vec3 w_pos) {
     return ext_k * calcFogDens(w_pos);
 }
 
+// Returns the extinction coefficient at the specified world space position
+// using the specified MIP level
+float sampleExtK(in const vec3 w_pos, in const float lod) {
+    return ext_k * calcFogDens(w_pos, lod);
+}
+
 // Performs ray marching
 float rayMarch(in const vec3 ray_o, in const vec3 ray_d,
                in const float t_min, in const float t_max) {
     const float dt    = (t_max - t_min) / R_M_INTERVALS;
-    float prev_ext_k  = sampleExtK(ray_o + t_min * ray_d);
+    // Large steps use coarse MIP levels to avoid aliasing
+    const float lod   = calcDensLod(dt);
+    float prev_ext_k  = sampleExtK(ray_o + t_min * ray_d, lod);
     float total_ext_k = 0.0;
     for (int i = 1; i <= R_M_INTERVALS; ++i) {
         // Distance to the end of the interval
         const float t = t_min + i * dt;
-        const float curr_ext_k = sampleExtK(ray_o + t * ray_d);
+        const float curr_ext_k = sampleExtK(ray_o + t * ray_d, lod);
         // Use trapezoidal rule for integration
         total_ext_k += 0.5 * (prev_ext_k + curr_ext_k);
         prev_ext_k = curr_ext_k;
@@ -180,6 +261,21 @@ float calcTransm(in const vec3 samp_pt, const float density, in const vec3 dir,
     return transm;
 }
 
+// Calculates transmittance towards the primary light using the cached density integral
+// Falls back to ray marching for points outside of the fog volume
+float calcPplTransm(in const vec3 samp_pt, const float density, in const vec3 dir,
+                    in const float dist_sq) {
+    const vec3 n_pos = (samp_pt - fog_bounds[0]) * inv_fog_dims;
+    const bool in_fog = all(greaterThanEqual(n_pos, vec3(0.0))) &&
+                        all(lessThanEqual(n_pos, vec3(1.0)));
+    if (ext_k > 0.0 && in_fog) {
+        // Apply Beer's law
+        return exp(-ext_k * texture(ppl_dens, n_pos).r);
+    } else {
+        return calcTransm(samp_pt, density, dir, dist_sq);
+    }
+}
+
 // Evaluates the Phong BRDF
 vec3 phongBRDF(in const vec3 I, in const vec3 N, in const vec3 O,
                in const vec3 k_d, in const vec3 k_s, in const float n_s) {
@@ -231,7 +327,7 @@ vec3 calcPplContrib(in const int light_id, in const vec3 w_pos, in const vec3 O)
         // Light is visible from the fragment
         const vec3  I       = normalize(-d);
         const float density = calcFogDens(w_pos);
-        const float transm  = calcTransm(w_pos, density, I, dist_sq);
+        const float transm  = calcPplTransm(w_pos, density, I, dist_sq);
         const float falloff = 1.0 / dist_sq;
         const vec3  Li      = transm * ppls[light_id].intens * falloff;
         // Evaluate the rendering equation
@@ -267,46 +363,62 @@ vec3 calcVplContrib(in const int light_id, in const vec3 w_pos, in const vec3 O)
 
 void main() {
     frag_col = vec3(0.0);
-    if (frame_id < MAX_FRAMES) {
+    // Use the tile of the full resolution pixel which provides the G-buffer data
+    const ivec2 pixel = 2 * ivec2(gl_FragCoord.xy) + ivec2(1, 1);
+    if (frame_id < MAX_FRAMES && !isTileConverged(pixel)) {
         // Perform shading
         // Reload t_min and t_max values computed in the previous shader
         float t_min, t_max;
         restoreRayDist(t_min, t_max);
         if (t_max > 0.0) {
             // There is fog along the ray; sample it
-            const int n_samples = gi_enabled ? MAX_VOL_SAMP / 4 : MAX_VOL_SAMP;
-            const vec3 w_pos = getWorldPos();
-            const vec3 ray_o = cam_w_pos;
-            const vec3 ray_d = normalize(w_pos - cam_w_pos);
+            const vec3  w_pos = getWorldPos();
+            const vec3  ray_o = cam_w_pos;
+            const vec3  ray_d = normalize(w_pos - cam_w_pos);
+            const int   n_slices = textureSize(pi_dens, 0).z;
+            // Ignore fog beyond the point where transmittance becomes negligible
+            const float max_opt_depth = min(getOptDepthKnot(pixel, n_slices, n_slices + 1).y,
+                                            -log(TRANSM_EPS));
+            const float opacity = 1.0 - exp(-max_opt_depth);
+            // Thin fog requires fewer samples
+            const int max_samples = gi_enabled ? MAX_VOL_SAMP / 4 : MAX_VOL_SAMP;
+            const int n_samples   = int(ceil(max_samples * min(opacity / FULL_SAMP_OPAC, 1.0)));
             // Fetch the random ray offset
             const float z_offset = texelFetch(rnd_offsets, ivec2(gl_FragCoord.xy), 0).r;
             for (int s = 0; s < n_samples; ++s) {
+                // Distribute samples proportionally to transmittance-weighted extinction
+                // Invert the CDF (1 - transmittance) to find the optical depth of the sample
+                const float h = texelFetch(halton_seq, s + max_samples * frame_id).r;
+                const float u = fract(h + z_offset);
+                const float opt_depth = -log(1.0 - u * opacity);
                 // Compute the sample position
-                const vec2 xy = gl_FragCoord.xy / CAM_RES;
-                const float z = clamp(texelFetch(halton_seq, s + n_samples * frame_id).r + z_offset, 0.0, 0.995);
+                float d_opt_depth;
+                const float z = invertOptDepth(pixel, n_slices, opt_depth, d_opt_depth);
+                // Skip degenerate samples (the PDF is zero there)
+                if (!(d_opt_depth > 0.0)) continue;
                 const float t = t_min + z * (t_max - t_min);
                 const vec3  s_pos = ray_o + t * ray_d;
-                // Compute transmittance on the camera-to-sample interval
-                const float opt_depth = ext_k * texture(pi_dens, vec3(xy, z)).r;
+                // Transmittance on the camera-to-sample interval is known by construction
                 const float transm = exp(-opt_depth);
-                if (transm > 0.001) {
-                    if (clamp_rsq) {
-                        // Gather contribution of primary lights
-                        for (int i = tri_buf_idx * MAX_PPLS, e = i + MAX_PPLS; i < e; ++i) {
-                            frag_col += transm * calcPplContrib(i, s_pos, -ray_d);
-                        }
+                // The sampling PDF (with respect to z) is (d_opt_depth * transm / opacity)
+                const float inv_p  = opacity / (d_opt_depth * transm);
+                vec3 samp_col = vec3(0.0);
+                if (clamp_rsq) {
+                    // Gather contribution of primary lights
+                    for (int i = tri_buf_idx * MAX_PPLS, e = i + MAX_PPLS; i < e; ++i) {
+                        samp_col += calcPplContrib(i, s_pos, -ray_d);
                     }
-                    if (gi_enabled) {
-                        // Gather contribution of VPLs
-                        for (int i = tri_buf_idx * MAX_VPLS, e = i + n_vpls; i < e; ++i) {
-                            frag_col += transm * calcVplContrib(i, s_pos, -ray_d);
-                        }
+                }
+                if (gi_enabled) {
+                    // Gather contribution of VPLs
+                    for (int i = tri_buf_idx * MAX_VPLS, e = i + n_vpls; i < e; ++i) {
+                        samp_col += calcVplContrib(i, s_pos, -ray_d);
                     }
                 }
+                frag_col += transm * inv_p * samp_col;
             }
-            // Normalize with respect to the sampling probability
-            const float inv_p = t_max - t_min;
-            frag_col *= inv_p / n_samples;
+            // Normalize with respect to the number of samples, and convert from z to t
+            frag_col *= (t_max - t_min) / max(n_samples, 1);
         }
     } else {
         // Do nothing; accumulation buffer values are final
@@ -1,5 +1,6 @@
 #include "InputHandler.h"
 #include "..\Common\Timer.h"
+#include "..\Common\TraceLog.h"
 #include "..\Common\Constants.h"
 #include "..\Common\Renderer.h"
 #include "..\Common\Scene.h"
@@ -18,6 +19,7 @@ void InputHandler::init(RenderSettings* params) {
 }
 
 void InputHandler::updateParams(GLFWwindow* const wnd) {
+    TRACE_ZONE("Input");
     m_params->curr_time_ms = HighResTimer::time_ms();
     // Process keyboard events
     glfwPollEvents();
@@ -43,6 +45,16 @@ void InputHandler::handleToggles(GLFWwindow* const wnd) {
             m_params->clamp_r_sq = !m_params->clamp_r_sq;
             updateLastTime();
             resetFrameCount();
+        } else if (glfwGetKey(wnd, GLFW_KEY_I)) {
+            // Toggle interleaved sampling of VPLs
+            m_params->interleaved = !m_params->interleaved;
+            updateLastTime();
+            resetFrameCount();
+        } else if (glfwGetKey(wnd, GLFW_KEY_T)) {
+            // Toggle temporal reuse of the accumulation buffer
+            m_params->temporal = !m_params->temporal;
+            updateLastTime();
+            resetFrameCount();
         } else if (glfwGetKey(wnd, GLFW_KEY_M)) {
             // Toggle ray marching transmittance optimization
             m_params->transm_opt = !m_params->transm_opt;
@@ -71,20 +83,20 @@ void InputHandler::handleSmoothInput(GLFWwindow* const wnd) {
     if (glfwGetKey(wnd, GLFW_KEY_LEFT)) {
         // Move light to the left
         m_params->ppl_w_pos.x += delta_pos;
-        resetFrameCount();
+        lightMoved();
     } else if (glfwGetKey(wnd, GLFW_KEY_RIGHT)) {
         // Move light to the right
         m_params->ppl_w_pos.x -= delta_pos;
-        resetFrameCount();
+        lightMoved();
     }
     if (glfwGetKey(wnd, GLFW_KEY_UP)) {
         // Move light up
         m_params->ppl_w_pos.y += delta_pos;
-        resetFrameCount();
+        lightMoved();
     } else if (glfwGetKey(wnd, GLFW_KEY_DOWN)) {
         // Move light down
         m_params->ppl_w_pos.y -= delta_pos;
-        resetFrameCount();
+        lightMoved();
     }
     if (glfwGetKey(wnd, GLFW_KEY_KP_ADD)) {
         // Make fog denser
@@ -133,6 +145,9 @@ void InputHandler::reset() {
     m_params->gi_enabled   = false;
     m_params->clamp_r_sq   = true;
     m_params->transm_opt   = false;
+    m_params->interleaved  = false;
+    m_params->temporal     = false;
+    m_params->keep_history = false;
     m_params->exposure     = EXPOSURE;
     m_params->frame_num    = 0;
     m_params->max_num_vpls = MAX_N_VPLS;
@@ -149,5 +164,13 @@ void InputHandler::updateLastTime() {
 }
 
 void InputHandler::resetFrameCount() {
-    m_params->frame_num = 0;
+    m_params->frame_num    = 0;
+    m_params->keep_history = false;
+}
+
+void InputHandler::lightMoved() {
+    // The history is only worth keeping if at least one frame has been accumulated
+    m_params->keep_history = m_params->temporal &&
+                             (m_params->frame_num > 0 || m_params->keep_history);
+    m_params->frame_num    = 0;
 }
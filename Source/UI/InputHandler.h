@@ -25,6 +25,8 @@ private:
     static void updateLastTime();
     // Resets current frame number to 0
     static void resetFrameCount();
+    // Restarts progressive rendering after the light moves, keeping the history if possible
+    static void lightMoved();
     // Private data members
     static RenderSettings* m_params;    // Controlled parameters
     static uint m_last_time_ms;         // Number of milliseconds since timer reset (last toggle)
@@ -0,0 +1,146 @@
+#include "ScriptHandler.h"
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <GLM\common.hpp>
+#include "..\Common\Constants.h"
+#include "..\Common\Utility.hpp"
+#include "..\Common\Timer.h"
+#include "..\Common\Renderer.h"
+#include "..\Common\Scene.h"
+
+extern Scene* scene;
+
+/* Step of a script */
+struct ScriptHandler::Step {
+    /* Named parameter value */
+    struct Param {
+        std::string name;
+        float       value;
+    };
+    uint               n_frames;        // Number of rendered frames
+    std::string        output_file;     // Output file (may be empty)
+    std::vector<Param> params;          // Parameters changed at the start of the step
+};
+
+RenderSettings*                   ScriptHandler::m_params;
+std::vector<ScriptHandler::Step>  ScriptHandler::m_steps;
+uint                              ScriptHandler::m_step;
+uint                              ScriptHandler::m_frame;
+
+void ScriptHandler::init(RenderSettings* params, const char* const file_name) {
+    m_params = params;
+    m_step   = 0;
+    m_frame  = 0;
+    m_steps.clear();
+    // Open file
+    auto file = fopen(file_name, "r");
+    if (!file) {
+        printError("Failed to open render script %s for reading.", file_name);
+        TERMINATE();
+    }
+    const char* const delims{" \t\r\n"};
+    char line[SCRIPT_LN_LEN];
+    for (uint line_num = 1; fgets(line, SCRIPT_LN_LEN, file); ++line_num) {
+        const char* token{strtok(line, delims)};
+        // Skip empty lines and comments
+        if (!token || '#' == token[0]) continue;
+        Step step;
+        const int n_frames{atoi(token)};
+        const char* const output_file{strtok(nullptr, delims)};
+        if (n_frames <= 0 || !output_file) {
+            printError("Render script %s, line %u: expected a number of frames and an output file.",
+                       file_name, line_num);
+            TERMINATE();
+        }
+        step.n_frames    = static_cast<uint>(n_frames);
+        step.output_file = strcmp(output_file, "-") ? output_file : "";
+        // Parse the parameters
+        RenderSettings scratch;
+        while ((token = strtok(nullptr, delims))) {
+            const char* const sep{strchr(token, '=')};
+            const std::string name{token, sep ? sep : token + strlen(token)};
+            const float value{sep ? static_cast<float>(atof(sep + 1)) : 0.0f};
+            if (!sep || !setParam(scratch, name.c_str(), value)) {
+                printError("Render script %s, line %u: invalid parameter %s.",
+                           file_name, line_num, token);
+                TERMINATE();
+            }
+            step.params.push_back({name, value});
+        }
+        m_steps.push_back(step);
+    }
+    // Close file
+    fclose(file);
+    printInfo("Loaded render script %s (%u steps).", file_name,
+              static_cast<uint>(m_steps.size()));
+}
+
+bool ScriptHandler::updateParams() {
+    if (m_step >= m_steps.size()) return false;
+    m_params->curr_time_ms = HighResTimer::time_ms();
+    if (0 == m_frame) {
+        // Start the step
+        bool is_light_only{m_step > 0};
+        for (const auto& param : m_steps[m_step].params) {
+            setParam(*m_params, param.name.c_str(), param.value);
+            is_light_only = is_light_only && (0 == param.name.compare(0, 6, "light_") ||
+                                              0 == param.name.compare("temporal"));
+        }
+        scene->updateFogCoeffs(m_params->maj_ext_k, m_params->abs_k, m_params->sca_k);
+        // Restart progressive rendering
+        m_params->frame_num    = 0;
+        m_params->keep_history = m_params->temporal && is_light_only;
+    }
+    return true;
+}
+
+const char* ScriptHandler::outputFile() {
+    assert(m_step < m_steps.size());
+    const Step& step = m_steps[m_step];
+    const bool is_last_frame{m_frame + 1 == step.n_frames};
+    return (is_last_frame && !step.output_file.empty()) ? step.output_file.c_str() : nullptr;
+}
+
+void ScriptHandler::nextFrame() {
+    assert(m_step < m_steps.size());
+    if (++m_frame == m_steps[m_step].n_frames) {
+        // Advance to the next step
+        ++m_step;
+        m_frame = 0;
+    }
+}
+
+bool ScriptHandler::setParam(RenderSettings& params, const char* const name, const float value) {
+    if (0 == strcmp(name, "gi")) {
+        params.gi_enabled = (0.0f != value);
+    } else if (0 == strcmp(name, "clamp_r_sq")) {
+        params.clamp_r_sq = (0.0f != value);
+    } else if (0 == strcmp(name, "transm_opt")) {
+        params.transm_opt = (0.0f != value);
+    } else if (0 == strcmp(name, "interleaved")) {
+        params.interleaved = (0.0f != value);
+    } else if (0 == strcmp(name, "temporal")) {
+        params.temporal = (0.0f != value);
+    } else if (0 == strcmp(name, "exposure")) {
+        params.exposure = static_cast<int>(value);
+    } else if (0 == strcmp(name, "max_num_vpls")) {
+        params.max_num_vpls = glm::clamp(static_cast<int>(value), 0, MAX_N_VPLS);
+    } else if (0 == strcmp(name, "abs_k")) {
+        params.abs_k = value;
+    } else if (0 == strcmp(name, "sca_k")) {
+        params.sca_k = value;
+    } else if (0 == strcmp(name, "maj_ext_k")) {
+        params.maj_ext_k = value;
+    } else if (0 == strcmp(name, "light_x")) {
+        params.ppl_w_pos.x = value;
+    } else if (0 == strcmp(name, "light_y")) {
+        params.ppl_w_pos.y = value;
+    } else if (0 == strcmp(name, "light_z")) {
+        params.ppl_w_pos.z = value;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include "..\Common\Definitions.h"
+
+struct RenderSettings;
+
+/* Static class driving rendering parameters from a script (instead of HID input)
+   Each line of a script describes a step: "<number of frames> <output file | -> [key=value]*"
+   Every step restarts progressive rendering; the settings persist until they are changed
+   The supported keys are: gi, clamp_r_sq, transm_opt, interleaved, temporal, exposure,
+   max_num_vpls, abs_k, sca_k, maj_ext_k, light_x, light_y, light_z; lines starting with '#'
+   are ignored. With temporal=1, a step which only moves the light reuses the history
+   Scripts are rendered in a hidden window, which still requires a display */
+class ScriptHandler {
+public:
+    ScriptHandler() = delete;
+    RULE_OF_ZERO(ScriptHandler);
+    // Acquires all controlled parameters, and loads the script from the specified file
+    static void init(RenderSettings* params, const char* const file_name);
+    // Adjusts parameters based on the script; returns 'false' once the script is complete
+    static bool updateParams();
+    // Returns the output file if the current frame is the last one of a step, or nullptr
+    static const char* outputFile();
+    // Advances to the next frame
+    static void nextFrame();
+private:
+    struct Step;
+    // Assigns the value to the parameter with the specified name; returns 'false' if unknown
+    static bool setParam(RenderSettings& params, const char* const name, const float value);
+    // Private data members
+    static RenderSettings*   m_params;  // Controlled parameters
+    static std::vector<Step> m_steps;   // Steps of the script
+    static uint              m_step;    // Index of the current step
+    static uint              m_frame;   // Index of the current frame within the step
+};
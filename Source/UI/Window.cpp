@@ -98,7 +98,9 @@ static inline void APIENTRY debugCallback(const GLenum source, const GLenum type
     printError("%s message: %s[ %s ] ( %d ): %s\n", src_str, type_str, severity_str, id, msg);
 }
 
-Window::Window(const int res_x, const int res_y): m_res_x{res_x}, m_res_y{res_y}, m_is_ok{true} {
+Window::Window(const int res_x, const int res_y, const bool is_visible): m_res_x{res_x},
+                                                                         m_res_y{res_y},
+                                                                         m_is_ok{true} {
     glfwSetErrorCallback(errorCallback);
     // Init GLFW
     if (!glfwInit()) {
@@ -112,6 +114,7 @@ Window::Window(const int res_x, const int res_y): m_res_x{res_x}, m_res_y{res_y}
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+    glfwWindowHint(GLFW_VISIBLE, is_visible ? GL_TRUE : GL_FALSE);
     // Request an sRGB8 framebuffer without a depth buffer
     glfwWindowHint(GLFW_SRGB_CAPABLE, TRUE);
     glfwWindowHint(GLFW_RED_BITS,   8);
@@ -11,7 +11,8 @@ public:
     Window() = delete;
     RULE_OF_FIVE_NO_COPY(Window);
     // Constructs a window with specified resolution
-    explicit Window(const int res_x, const int res_y);
+    // A hidden window only provides an OpenGL context (for offscreen rendering)
+    explicit Window(const int res_x, const int res_y, const bool is_visible = true);
     // Returns true if window has been opened successfully
     const bool isOpen() const;
     // Returns true if closing sequence has been triggered
@@ -16,6 +16,8 @@ void OmniShadowMap::generate(const Scene& scene, const LightArray<PL>& la,
     gl::Uniform1f(UL_SM_INVMAXD2, m_inv_max_dist_sq);
     assert(la.size() <= m_max_vpls);
     const GLsizei n{la.size()};
+    // A texel of a cube map face subtends (at most) 2 / res radians
+    const float texel_angle{2.0f / m_res};
     for (GLsizei i = 0; i < n; ++i) {
         const glm::vec3& light_w_pos{la[i].wPos()};
         const glm::mat4  light_inv_trans{glm::translate(glm::mat4{1.0f}, -light_w_pos)};
@@ -31,7 +33,7 @@ void OmniShadowMap::generate(const Scene& scene, const LightArray<PL>& la,
         gl::UniformMatrix4fv(UL_SM_LIGHTMVP, 6, GL_FALSE, &lightMVPs[0][0][0]);
         // Set layer index
         gl::Uniform1i(UL_SM_LAYER_ID, 6 * i);
-        // Render scene to depth map
-        scene.render(true);
+        // Render scene to depth map, reducing the level of detail of distant meshes
+        scene.render(light_w_pos, texel_angle);
     }
 }